@@ -0,0 +1,120 @@
+#include "nacre.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* time finding every match of each pattern in a file with the lazy dfa and
+   with the jit, which must find the same matches */
+
+static const char* DEFAULT_PATTERNS[] = {
+    "[a-zA-Z]+ing", "[^ ]+ [^ ]+", "e[^e]*e", "(a|e|i|o|u)+t",
+    "[0-9]+\\.[0-9]+", "\\w+@\\w+",
+};
+
+/* a run of this many rounds is timed, and the fastest is kept */
+#define BENCH_ROUNDS 5
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* return the number of matches, and the fastest time in seconds */
+static size_t
+find_all(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, double* seconds
+)
+{
+    nacre_match_t match;
+    size_t start, count = 0;
+    double begin, elapsed, best = -1;
+    int round;
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        begin = now();
+        count = 0;
+        start = 0;
+        while (start < input_len
+               && nacre_find(regex, scratch, input, input_len, start, &match)) {
+            count++;
+            start = match.offset + match.length;
+        }
+        elapsed = now() - begin;
+        if (best < 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    *seconds = best;
+    return count;
+}
+
+int
+main(int argc, char* argv[])
+{
+    const char** patterns = DEFAULT_PATTERNS;
+    size_t pattern_num = sizeof(DEFAULT_PATTERNS) / sizeof(char*);
+    nacre_scratch_t* scratch;
+    const char* input;
+    struct stat st;
+    size_t i, count, jit_count;
+    double seconds, jit_seconds;
+    int fd, exit_code = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s INPUT_FILE [PATTERN]...\n", argv[0]);
+        return 1;
+    }
+    fd = open(argv[1], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        perror("Error: Failed to read the input");
+        return 1;
+    }
+    input = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (input == MAP_FAILED) {
+        perror("Error: Failed to map the input");
+        return 1;
+    }
+    if (argc > 2) {
+        patterns = (const char**)argv + 2;
+        pattern_num = argc - 2;
+    }
+    scratch = nacre_scratch_new();
+    printf(
+        "%-24s %10s %10s %10s %8s\n", "pattern", "matches", "dfa MB/s",
+        "jit MB/s", "speedup"
+    );
+    for (i = 0; i < pattern_num; i++) {
+        nacre_regex_t* regex = nacre_compile(patterns[i], 0);
+        nacre_regex_t* jit_regex = nacre_compile(patterns[i], NACRE_JIT);
+        if (regex == NULL || jit_regex == NULL) {
+            fprintf(stderr, "Error: Failed to parse regex.\n");
+            return 1;
+        }
+        count = find_all(regex, scratch, input, st.st_size, &seconds);
+        jit_count = find_all(
+            jit_regex, scratch, input, st.st_size, &jit_seconds
+        );
+        printf(
+            "%-24s %10lu %10.1f %10.1f %7.2fx\n", patterns[i], count,
+            st.st_size / seconds / 1e6, st.st_size / jit_seconds / 1e6,
+            seconds / jit_seconds
+        );
+        if (count != jit_count) {
+            fprintf(stderr, "Error: the jit found %lu matches\n", jit_count);
+            exit_code = 1;
+        }
+        nacre_free(regex);
+        nacre_free(jit_regex);
+    }
+    nacre_scratch_free(scratch);
+    munmap((void*)input, st.st_size);
+    close(fd);
+    return exit_code;
+}
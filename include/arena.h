@@ -0,0 +1,242 @@
+#include "nacre.h"
+#include <assert.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ARENA_H
+#define ARENA_H
+
+/* bump allocator: memory is taken from big blocks and is only given back all
+   at once by arena_free. the blocks come from the allocator hooks, or from
+   malloc and free if there is none */
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+typedef struct arena_block {
+    struct arena_block* prev;
+    size_t cap;
+    size_t used;
+    unsigned char data[];
+} arena_block_t;
+
+typedef struct arena {
+    arena_block_t* head;
+    nacre_allocator_t allocator;
+    void* last_alloc; /* the latest allocation, which can grow in place */
+} arena_t;
+
+static void*
+default_alloc(size_t size, void* ctx)
+{
+    (void)ctx;
+    return malloc(size);
+}
+
+static void
+default_free(void* ptr, void* ctx)
+{
+    (void)ctx;
+    free(ptr);
+}
+
+static inline arena_t
+arena_new(const nacre_allocator_t* allocator)
+{
+    arena_t a = {
+        .head = NULL,
+        .allocator = {
+            .alloc = default_alloc,
+            .free = default_free,
+            .ctx = NULL,
+        },
+        .last_alloc = NULL,
+    };
+    if (allocator != NULL) {
+        a.allocator = *allocator;
+    }
+    return a;
+}
+
+static inline void
+arena_free(arena_t* self)
+{
+    arena_block_t* b = self->head;
+    while (b != NULL) {
+        arena_block_t* prev = b->prev;
+        self->allocator.free(b, self->allocator.ctx);
+        b = prev;
+    }
+    self->head = NULL;
+    self->last_alloc = NULL;
+}
+
+/* return the aligned offset of the next allocation in block b */
+static inline size_t
+arena_block_next(const arena_block_t* b)
+{
+    uintptr_t p = (uintptr_t)(b->data + b->used);
+    p = (p + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+    return p - (uintptr_t)b->data;
+}
+
+/* return zeroed memory of size bytes */
+static inline void*
+arena_alloc(arena_t* self, size_t size)
+{
+    arena_block_t* b = self->head;
+    size_t offset;
+    void* ptr;
+    if (size == 0) {
+        size = 1;
+    }
+    if (b == NULL || arena_block_next(b) + size > b->cap) {
+        size_t cap = ARENA_BLOCK_SIZE - sizeof(arena_block_t);
+        if (size + ARENA_ALIGN > cap) {
+            cap = size + ARENA_ALIGN;
+        }
+        b = self->allocator.alloc(
+            sizeof(arena_block_t) + cap, self->allocator.ctx
+        );
+        if (b == NULL) {
+            /* the library only allocates under a guard that jumps out
+               before this, so only an arena on hooks of its own gets here */
+            fprintf(stderr, "arena_alloc: out of memory\n");
+            abort();
+        }
+        b->cap = cap;
+        b->used = 0;
+        /* a big block goes under the head so that the head can keep filling */
+        if (self->head != NULL && size * 4 > ARENA_BLOCK_SIZE) {
+            b->prev = self->head->prev;
+            self->head->prev = b;
+        } else {
+            b->prev = self->head;
+            self->head = b;
+        }
+    }
+    offset = arena_block_next(b);
+    ptr = b->data + offset;
+    b->used = offset + size;
+    memset(ptr, 0, size);
+    self->last_alloc = (b == self->head) ? ptr : NULL;
+    return ptr;
+}
+
+/* a guard is a set of allocator hooks that keeps a ring of every block
+   taken through it, so that all of them can be given back at once after a
+   failure, whatever arenas took them. if an allocation fails while fail is
+   set, it jumps there instead of returning NULL */
+typedef struct arena_guard_block {
+    struct arena_guard_block* prev;
+    struct arena_guard_block* next;
+} arena_guard_block_t;
+
+typedef struct arena_guard {
+    nacre_allocator_t allocator; /* the hooks the blocks come from */
+    arena_guard_block_t blocks; /* the ring of live blocks */
+    jmp_buf* fail;
+} arena_guard_t;
+
+static void*
+guard_alloc(size_t size, void* ctx)
+{
+    arena_guard_t* guard = ctx;
+    arena_guard_block_t* b = guard->allocator.alloc(
+        sizeof(arena_guard_block_t) + size, guard->allocator.ctx
+    );
+    if (b == NULL) {
+        if (guard->fail != NULL) {
+            longjmp(*guard->fail, 1);
+        }
+        return NULL;
+    }
+    b->prev = &guard->blocks;
+    b->next = guard->blocks.next;
+    guard->blocks.next->prev = b;
+    guard->blocks.next = b;
+    return b + 1;
+}
+
+static void
+guard_free(void* ptr, void* ctx)
+{
+    arena_guard_t* guard = ctx;
+    arena_guard_block_t* b = (arena_guard_block_t*)ptr - 1;
+    b->prev->next = b->next;
+    b->next->prev = b->prev;
+    guard->allocator.free(b, guard->allocator.ctx);
+}
+
+/* return a guard on allocator, or on malloc and free if it is NULL. the
+   guard itself comes from the same hooks, NULL if they fail */
+static inline arena_guard_t*
+arena_guard_new(const nacre_allocator_t* allocator)
+{
+    const nacre_allocator_t hooks = allocator != NULL
+        ? *allocator
+        : (nacre_allocator_t) {
+              .alloc = default_alloc,
+              .free = default_free,
+              .ctx = NULL,
+          };
+    arena_guard_t* guard = hooks.alloc(sizeof(arena_guard_t), hooks.ctx);
+    if (guard == NULL) {
+        return NULL;
+    }
+    guard->allocator = hooks;
+    guard->blocks.prev = guard->blocks.next = &guard->blocks;
+    guard->fail = NULL;
+    return guard;
+}
+
+/* the hooks for the arenas that the guard tracks */
+static inline nacre_allocator_t
+arena_guard_hooks(arena_guard_t* self)
+{
+    return (nacre_allocator_t) {
+        .alloc = guard_alloc,
+        .free = guard_free,
+        .ctx = self,
+    };
+}
+
+/* give back every block that is still taken, then the guard */
+static inline void
+arena_guard_free(arena_guard_t* self)
+{
+    const nacre_allocator_t hooks = self->allocator;
+    while (self->blocks.next != &self->blocks) {
+        guard_free(self->blocks.next + 1, self);
+    }
+    hooks.free(self, hooks.ctx);
+}
+
+/* grow ptr from old_size to new_size bytes. the latest allocation grows in
+   place when the head block has room, otherwise the content is moved */
+static inline void*
+arena_realloc(arena_t* self, void* ptr, size_t old_size, size_t new_size)
+{
+    arena_block_t* b = self->head;
+    void* new_ptr;
+    if (ptr == NULL) {
+        return arena_alloc(self, new_size);
+    }
+    if (new_size <= old_size) {
+        return ptr;
+    }
+    if (ptr == self->last_alloc
+        && (unsigned char*)ptr - b->data + new_size <= b->cap) {
+        memset((unsigned char*)ptr + old_size, 0, new_size - old_size);
+        b->used = (unsigned char*)ptr - b->data + new_size;
+        return ptr;
+    }
+    new_ptr = arena_alloc(self, new_size);
+    memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+#endif
@@ -1,3 +1,4 @@
+#include "arena.h"
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -14,13 +15,27 @@ typedef struct bitmask {
 static bitmask_t
 bitmask_new(size_t size)
 {
-    assert(size != 0 && size < 256);
+    assert(size != 0);
     return (bitmask_t) {
         .mask = calloc((size - 1) / 8 + 1, 1),
         .byte_size = (size - 1) / 8 + 1,
     };
 }
 
+/* the mask of a bitmask from an arena is given back with its arena */
+static bitmask_t
+bitmask_new_in(arena_t* arena, size_t size)
+{
+    assert(size != 0);
+    if (arena == NULL) {
+        return bitmask_new(size);
+    }
+    return (bitmask_t) {
+        .mask = arena_alloc(arena, (size - 1) / 8 + 1),
+        .byte_size = (size - 1) / 8 + 1,
+    };
+}
+
 static void
 bitmask_add(bitmask_t* self, const int key)
 {
@@ -0,0 +1,187 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef BYTE_SCAN_H
+#define BYTE_SCAN_H
+
+/* find the first byte of a set in input[start:input_len], 16 bytes at a time
+   where SSE2 is there. they return input_len if there is none */
+
+static inline size_t
+scan_byte(
+    const char* input, const size_t input_len, const size_t start,
+    const unsigned char a
+)
+{
+    const char* p;
+    if (start >= input_len) {
+        return input_len;
+    }
+    p = memchr(input + start, a, input_len - start);
+    return p ? (size_t)(p - input) : input_len;
+}
+
+/* a lower case letter in either case. setting the 0x20 bit only turns the
+   upper case of the same letter into it */
+static inline size_t
+scan_byte_folded(
+    const char* input, const size_t input_len, const size_t start,
+    const unsigned char lower
+)
+{
+    size_t pos = start;
+#ifdef __SSE2__
+    const __m128i vl = _mm_set1_epi8((char)lower);
+    const __m128i vcase = _mm_set1_epi8(0x20);
+    for (; pos + 16 <= input_len; pos += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(input + pos));
+        int mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_or_si128(x, vcase), vl)
+        );
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; pos < input_len; pos++) {
+        if (((unsigned char)input[pos] | 0x20) == lower) {
+            return pos;
+        }
+    }
+    return input_len;
+}
+
+/* two or three bytes, give the same byte twice for two */
+static inline size_t
+scan_byte3(
+    const char* input, const size_t input_len, const size_t start,
+    const unsigned char a, const unsigned char b, const unsigned char c
+)
+{
+    size_t pos = start;
+#ifdef __SSE2__
+    const __m128i va = _mm_set1_epi8((char)a);
+    const __m128i vb = _mm_set1_epi8((char)b);
+    const __m128i vc = _mm_set1_epi8((char)c);
+    for (; pos + 16 <= input_len; pos += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(input + pos));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)),
+            _mm_cmpeq_epi8(x, vc)
+        );
+        int mask = _mm_movemask_epi8(eq);
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; pos < input_len; pos++) {
+        unsigned char x = input[pos];
+        if (x == a || x == b || x == c) {
+            return pos;
+        }
+    }
+    return input_len;
+}
+
+/* the bytes from lo to hi */
+static inline size_t
+scan_range(
+    const char* input, const size_t input_len, const size_t start,
+    const unsigned char lo, const unsigned char hi
+)
+{
+    size_t pos = start;
+#ifdef __SSE2__
+    /* x - lo <= hi - lo as unsigned bytes, which min tells */
+    const __m128i vlo = _mm_set1_epi8((char)lo);
+    const __m128i vspan = _mm_set1_epi8((char)(hi - lo));
+    for (; pos + 16 <= input_len; pos += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(input + pos));
+        __m128i d = _mm_sub_epi8(x, vlo);
+        __m128i in = _mm_cmpeq_epi8(_mm_min_epu8(d, vspan), d);
+        int mask = _mm_movemask_epi8(in);
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; pos < input_len; pos++) {
+        if ((unsigned char)((unsigned char)input[pos] - lo)
+            <= (unsigned char)(hi - lo)) {
+            return pos;
+        }
+    }
+    return input_len;
+}
+
+/* any set, as a bitmap of 32 bytes */
+static inline size_t
+scan_bitmap(
+    const char* input, const size_t input_len, const size_t start,
+    const unsigned char* bitmap
+)
+{
+    size_t pos = start;
+    for (; pos + 4 <= input_len; pos += 4) {
+        const unsigned char* p = (const unsigned char*)input + pos;
+        if (bitmap[p[0] / 8] & (1 << (p[0] % 8))) {
+            return pos;
+        }
+        if (bitmap[p[1] / 8] & (1 << (p[1] % 8))) {
+            return pos + 1;
+        }
+        if (bitmap[p[2] / 8] & (1 << (p[2] % 8))) {
+            return pos + 2;
+        }
+        if (bitmap[p[3] / 8] & (1 << (p[3] % 8))) {
+            return pos + 3;
+        }
+    }
+    for (; pos < input_len; pos++) {
+        unsigned char x = input[pos];
+        if (bitmap[x / 8] & (1 << (x % 8))) {
+            return pos;
+        }
+    }
+    return input_len;
+}
+
+/* is input[0:n] equal to lower[0:n] once its ascii letters are in lower
+   case */
+static inline int
+is_equal_folded(const char* input, const unsigned char* lower, const size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i va = _mm_set1_epi8('A');
+    const __m128i vspan = _mm_set1_epi8('Z' - 'A');
+    const __m128i vcase = _mm_set1_epi8(0x20);
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(input + i));
+        __m128i d = _mm_sub_epi8(x, va);
+        __m128i is_upper = _mm_cmpeq_epi8(_mm_min_epu8(d, vspan), d);
+        __m128i folded = _mm_or_si128(x, _mm_and_si128(is_upper, vcase));
+        __m128i y = _mm_loadu_si128((const __m128i*)(lower + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(folded, y)) != 0xFFFF) {
+            return 0;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        unsigned char x = input[i];
+        if (x >= 'A' && x <= 'Z') {
+            x |= 0x20;
+        }
+        if (x != lower[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#endif
@@ -14,4 +14,30 @@ char_class_set(char_class_t* c, uint8_t i)
     c->bitmap[i / 8] |= (uint8_t)(1 << (i % 8));
 }
 
+static inline void
+char_class_unset(char_class_t* c, uint8_t i)
+{
+    c->bitmap[i / 8] &= (uint8_t) ~(1 << (i % 8));
+}
+
+static inline int
+char_class_has(const char_class_t* c, uint8_t i)
+{
+    return (c->bitmap[i / 8] >> (i % 8)) & 1;
+}
+
+/* add the other case of every ascii letter in the bitmap. a negated class
+   stays negated, so it then misses both cases */
+static inline void
+char_class_fold_case(char_class_t* c)
+{
+    uint8_t i;
+    for (i = 'A'; i <= 'Z'; i++) {
+        if (char_class_has(c, i) || char_class_has(c, i + ('a' - 'A'))) {
+            char_class_set(c, i);
+            char_class_set(c, i + ('a' - 'A'));
+        }
+    }
+}
+
 #endif
@@ -0,0 +1,127 @@
+#include "arena.h"
+#include "dynarr.h"
+#include "nfa.h"
+#include <stdint.h>
+
+#ifndef DFA_H
+#define DFA_H
+
+/* lazy DFA: the states are sets of epsnfa states that are made only when the
+   input reaches them, and are kept in a cache of bounded size.
+
+   an anchor looks at the byte before and the byte after a position, so a
+   dfa state also keeps the kind of the byte before it, and the anchors are
+   taken when the byte after it is read. a transition also tells if the
+   state accepts before its byte. the end of input and a newline that ends
+   the input, which "$" sees as the end, have their own columns.
+
+   an unanchored cache finds where the first match ends instead: the start
+   states are added before every byte, as if the pattern began with ".*",
+   and a state only has the states reached from an earlier offset, so that
+   it accepts after a match of at least one byte. its empty set is a state
+   too, the dead state is never reached */
+
+#define DFA_COLUMN_END 256
+#define DFA_COLUMN_FINAL_NEWLINE 257
+#define DFA_COLUMN_NUM 258
+
+/* the kinds of the byte before a state */
+enum DFA_CONTEXT {
+    DFA_CONTEXT_START, /* the start of input */
+    DFA_CONTEXT_NEWLINE,
+    DFA_CONTEXT_WORD,
+    DFA_CONTEXT_OTHER,
+    DFA_CONTEXT_NUM,
+};
+
+#define DFA_DEAD_STATE 0
+#define DFA_UNKNOWN (-1)
+
+/* the cache is cleared when it has this many states */
+#define DFA_CACHE_MAX_STATES 2048
+/* the dfa gives up when it reads fewer bytes than this per state it makes
+   between two clears of the cache */
+#define DFA_MIN_BYTES_PER_STATE 10
+
+typedef struct dfa_state {
+    uint32_t set_begin; /* in set_pool */
+    uint32_t set_size;
+    uint8_t context;
+} dfa_state_t;
+
+/* the cache of one epsnfa, owned by a scratch. it must be reset before it
+   is used for another epsnfa */
+typedef struct dfa_cache {
+    const epsnfa* nfa; /* the epsnfa of the states */
+    int has_anchor; /* the context is only kept if the nfa has anchors */
+    int is_failed; /* the cache thrashed, the caller should not use it */
+    int is_unanchored;
+    dynarr_t states; /* type: dfa_state_t */
+    dynarr_t set_pool; /* type: uint32_t */
+    /* type: int32_t, DFA_COLUMN_NUM per state. an entry is the next state
+       shifted left by one, with the accept bit, or DFA_UNKNOWN */
+    dynarr_t transitions;
+    dynarr_t table; /* type: int32_t, hash table of the states */
+    int32_t start_states[DFA_CONTEXT_NUM];
+    size_t bytes_since_clear;
+    /* the working memory to make a state */
+    dynarr_t closure; /* type: uint32_t */
+    dynarr_t next_set; /* type: uint32_t */
+    dynarr_t stamps; /* type: size_t, per nfa state */
+    size_t generation;
+} dfa_cache_t;
+
+dfa_cache_t dfa_cache_new(arena_t* arena);
+
+/* drop every state and start over for nfa. an unanchored cache is only
+   used by dfa_scan */
+void dfa_cache_reset(
+    dfa_cache_t* cache, const epsnfa* nfa, const int is_unanchored
+);
+
+/* find the longest match at start_offset like epsnfa_find_initial_match.
+   return 0 if the cache thrashed and the result is not known, otherwise
+   return 1 and set matched_len */
+int dfa_find_initial_match(
+    dfa_cache_t* cache, const char* input_str, const size_t input_len,
+    const size_t start_offset, size_t* matched_len
+);
+
+/* the results of dfa_scan */
+enum DFA_SCAN {
+    DFA_SCAN_FAILED, /* the cache thrashed, the result is not known */
+    DFA_SCAN_MATCH, /* a match ends at pos */
+    DFA_SCAN_IDLE, /* no match that started before pos is still going */
+    DFA_SCAN_NONE, /* no match starts at or after start */
+};
+
+/* run the unanchored cache from start, and stop at the first offset where
+   a match ends. with is_idle_stop it also stops, after start, where no
+   match is going, so that the caller can skip ahead with a prefilter.
+   return the result and set pos where it stopped */
+enum DFA_SCAN dfa_scan(
+    dfa_cache_t* cache, const char* input_str, const size_t input_len,
+    const size_t start, const int is_idle_stop, size_t* pos
+);
+
+/* the full dfa of an epsnfa without anchors, made before any input is
+   read. its states are the sets of epsnfa states reached from the start
+   states, and state 0 is the start. an unanchored full dfa is made like an
+   unanchored cache: state 0 is the empty set, the start states are read
+   with every state, and no transition goes to the dead state */
+typedef struct dfa_full {
+    size_t state_num;
+    /* 256 per state: the next state + 1, or 0 for the dead state */
+    uint32_t* next;
+    uint8_t* is_accept; /* per state */
+} dfa_full_t;
+
+/* make the full dfa of nfa, which must have its jump tables, in arena.
+   return 0 if nfa has anchors or no start state, or if the dfa would have
+   more than max_states states */
+int dfa_full_build(
+    const epsnfa* nfa, const size_t max_states, const int is_unanchored,
+    dfa_full_t* dfa, arena_t* arena
+);
+
+#endif
@@ -1,3 +1,4 @@
+#include "arena.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
@@ -16,6 +17,7 @@ typedef struct dynarr {
     size_t size;
     size_t cap;
     void* data;
+    arena_t* arena; /* NULL if data is on the heap */
 } dynarr_t;
 
 #define dynarr_size sizeof(dynarr_t)
@@ -33,16 +35,35 @@ dynarr_new(int elem_size)
     x.elem_size = elem_size;
     x.size = 0;
     x.cap = DYN_ARR_INIT_CAP;
+    x.arena = NULL;
     return x;
 };
 
+/* create a new empty dynamic array whose memory is taken from arena.
+   arena can be NULL to use the heap */
+static inline dynarr_t
+dynarr_new_in(arena_t* arena, int elem_size)
+{
+    dynarr_t x;
+    if (arena == NULL) {
+        return dynarr_new(elem_size);
+    }
+    x.data = arena_alloc(arena, elem_size * DYN_ARR_INIT_CAP);
+    x.elem_size = elem_size;
+    x.size = 0;
+    x.cap = DYN_ARR_INIT_CAP;
+    x.arena = arena;
+    return x;
+}
+
+/* memory of an arena array is only given back with its arena */
 static inline void
 dynarr_free(dynarr_t* x)
 {
-    if (x->data != NULL) {
+    if (x->data != NULL && x->arena == NULL) {
         free(x->data);
-        x->data = NULL;
     }
+    x->data = NULL;
     x->size = x->cap = 0;
 };
 
@@ -50,7 +71,7 @@ static inline void
 dynarr_reset(dynarr_t* x)
 {
     dynarr_free(x);
-    *x = dynarr_new(x->elem_size);
+    *x = dynarr_new_in(x->arena, x->elem_size);
 }
 
 static inline dynarr_t
@@ -58,7 +79,8 @@ dynarr_copy(const dynarr_t* x)
 {
     dynarr_t y;
     y = *x;
-    y.data = calloc(y.cap, y.elem_size);
+    y.data = (x->arena != NULL) ? arena_alloc(x->arena, y.cap * y.elem_size)
+                                : calloc(y.cap, y.elem_size);
     memcpy(y.data, x->data, x->elem_size * x->size);
     return y;
 }
@@ -84,12 +106,46 @@ append(dynarr_t* x, const void* const elem)
     assert(x->size < INT32_MAX);
     if (x->size == x->cap) {
         x->cap *= 2;
-        x->data = realloc(x->data, x->elem_size * x->cap);
+        if (x->arena != NULL) {
+            x->data = arena_realloc(
+                x->arena, x->data, x->elem_size * x->size,
+                x->elem_size * x->cap
+            );
+        } else {
+            x->data = realloc(x->data, x->elem_size * x->cap);
+        }
     }
     memcpy(x->data + x->elem_size * x->size, elem, x->elem_size);
     x->size++;
 };
 
+/* set the size of x, the new elements are zeroed */
+static inline void
+dynarr_resize(dynarr_t* x, size_t size)
+{
+    if (size > x->cap) {
+        size_t old_cap = x->cap;
+        while (x->cap < size) {
+            x->cap = x->cap ? x->cap * 2 : size;
+        }
+        if (x->arena != NULL) {
+            x->data = arena_realloc(
+                x->arena, x->data, x->elem_size * old_cap,
+                x->elem_size * x->cap
+            );
+        } else {
+            x->data = realloc(x->data, x->elem_size * x->cap);
+        }
+    }
+    if (size > x->size) {
+        memset(
+            x->data + x->elem_size * x->size, 0,
+            x->elem_size * (size - x->size)
+        );
+    }
+    x->size = size;
+}
+
 #endif
 
 static inline void
@@ -0,0 +1,40 @@
+#include "arena.h"
+#include "nfa.h"
+#include <stdio.h>
+
+#ifndef EMIT_C_H
+#define EMIT_C_H
+
+/* write the full dfa of an epsnfa as a C file that needs nothing but the
+   C library, so a pattern fixed at build time can be compiled into a
+   program with no parsing or compiling at run time. the file has:
+
+   size_t NAME_match(const char* input, size_t len);
+       the length of the longest non-empty match that starts at input[0],
+       or 0 if there is none
+   int NAME_find(
+       const char* input, size_t len, size_t start, size_t* offset,
+       size_t* length
+   );
+       the leftmost-longest non-empty match in input[start:len] like
+       nacre_find, return 1 and set offset and length if there is one
+
+   a dfa of up to EMIT_C_MAX_SWITCH_STATES states is a switch on the byte
+   in each state, which jumps to the next with a goto. a larger dfa is a
+   loop over a static const table. NAME_find reads the input once with a
+   static const table of the unanchored dfa, up to where the first match
+   ends, and then extends the leftmost match with NAME_match */
+
+/* the largest dfa that is written */
+#define EMIT_C_MAX_STATES 4096
+#define EMIT_C_MAX_SWITCH_STATES 256
+
+/* is name a C identifier */
+int emit_c_is_name(const char* name);
+
+/* nfa must have its jump tables. return 0 and write nothing if name is not
+   a C identifier, nfa has anchors, or one of its dfas has more than
+   EMIT_C_MAX_STATES states. arena is only used while writing */
+int emit_c(FILE* out, const char* name, const epsnfa* nfa, arena_t* arena);
+
+#endif
@@ -0,0 +1,19 @@
+#include "arena.h"
+#include "nfa.h"
+#include "re_ast.h"
+
+#ifndef GLUSHKOV_H
+#define GLUSHKOV_H
+
+/* compile the ast into its position automaton: state 0 is the start and
+   every byte, wildcard, class or anchor in the ast is one more state. an
+   edge goes into a position and carries the matcher of that position, so
+   the automaton has no epsilon transitions to reduce. the result is
+   allocated in arena, or on the heap if arena is NULL. an ast with a token
+   that has no place in it gives error its error and an nfa of one state */
+extern epsnfa re_ast_to_glushkov_nfa(
+    const re_ast_t* re_ast, const int flags, arena_t* arena, const int is_debug,
+    nacre_error_t* error
+);
+
+#endif
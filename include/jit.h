@@ -0,0 +1,64 @@
+#include "arena.h"
+#include "dfa.h"
+#include "nfa.h"
+#include <stddef.h>
+
+#ifndef JIT_H
+#define JIT_H
+
+/* the jit turns the full dfas of an epsnfa into x86-64 code in executable
+   memory. a dfa state is a block of code: it records the match if the
+   state accepts, reads a byte and jumps to the next block with compares
+   for a few byte ranges or with a table for more. a state that stays on
+   itself for one or two byte ranges first skips 16 of those bytes at a
+   time with SSE2. only an epsnfa without anchors is compiled, since the
+   code does not keep the kind of the byte before.
+
+   the anchored dfa makes the match function and the unanchored dfa the
+   scan function, which stops in the first state that accepts */
+
+/* the longest non-empty match that starts at start, as its length, or 0 if
+   there is none, like dfa_find_initial_match */
+typedef size_t (*jit_match_fn)(
+    const unsigned char* start, const unsigned char* end
+);
+
+/* what the scan function returns, in rax and rdx */
+typedef struct jit_scan {
+    size_t length; /* from start to where the scan stopped */
+    enum DFA_SCAN result; /* never DFA_SCAN_FAILED */
+} jit_scan_t;
+
+/* dfa_scan from start, with is_idle_stop as it was compiled */
+typedef jit_scan_t (*jit_scan_fn)(
+    const unsigned char* start, const unsigned char* end
+);
+
+/* each dfa is only compiled up to this many states */
+#define JIT_MAX_STATES 255
+
+/* a state with more byte ranges than this to other states jumps by a table
+   instead of compares */
+#define JIT_MAX_COMPARES 8
+
+typedef struct jit_program {
+    jit_match_fn match; /* NULL if there is no code */
+    jit_scan_fn scan; /* NULL if there is no code */
+    void* memory; /* the mapping of the code and its tables */
+    size_t memory_size;
+    size_t state_num;
+    size_t scan_state_num;
+    size_t code_size;
+} jit_program_t;
+
+/* compile nfa, which must have its jump tables, with the idle stop of the
+   scan if is_idle_stop. both functions are NULL if nfa has anchors, one of
+   its dfas has more than JIT_MAX_STATES states, or this is not x86-64.
+   arena is only used while compiling */
+jit_program_t jit_compile(
+    const epsnfa* nfa, const int is_idle_stop, arena_t* arena
+);
+
+void jit_free(jit_program_t* self);
+
+#endif
@@ -13,17 +13,19 @@
 #define MATCHER_FLAG_BYTE 0x04
 #define MATCHER_FLAG_ANCHOR 0x08
 #define MATCHER_FLAG_CLASS 0x10
+#define MATCHER_FLAG_SAVE 0x20
 
 typedef struct matcher {
     uint8_t flag;
     /*   flag | payload
        -------|-------------
           nil | NULL
-          eps | undefined
+          eps | 1 if it leads to the left side of a union, otherwise 0
            wc | wc enum
          byte | byte
        anchor | anchor enum
         class | class index
+         save | slot index, with the eps flag
     */
     uint32_t payload;
 } matcher_t;
@@ -40,10 +42,26 @@ get_matcher_str(matcher_t m)
                 payload_char = ANCHOR_START_CHAR;
             } else if (m.payload == ANCHOR_END) {
                 payload_char = ANCHOR_END_CHAR;
+            } else if (m.payload == ANCHOR_LINE_START) {
+                payload_char = ANCHOR_START_CHAR;
+            } else if (m.payload == ANCHOR_LINE_END) {
+                payload_char = ANCHOR_END_CHAR;
+            } else if (m.payload == ANCHOR_NOT_WORD_BEHIND) {
+                payload_char = '<';
+            } else if (m.payload == ANCHOR_NOT_WORD_AHEAD) {
+                payload_char = '>';
             } else if (m.flag) {
                 payload_char = ANCHOR_WEDGE_CHAR;
             }
-            sprintf(matcher_str, "[ANCH %c]", payload_char);
+            sprintf(
+                matcher_str, "[ANCH %s%c]",
+                (m.payload == ANCHOR_LINE_START || m.payload == ANCHOR_LINE_END)
+                    ? "LINE "
+                    : "",
+                payload_char
+            );
+        } else if (m.flag & MATCHER_FLAG_SAVE) {
+            sprintf(matcher_str, "[SAVE %d]", m.payload);
         } else {
             sprintf(matcher_str, "[EPS]");
         }
@@ -68,6 +86,25 @@ typedef int anchor_byte;
 #define ANCHOR_BYTE_START ((anchor_byte)(-(ANCHOR_START + 1)))
 #define ANCHOR_BYTE_END ((anchor_byte)(-(ANCHOR_END + 1)))
 
+/* the byte before pos, or ANCHOR_BYTE_START at the start of input */
+static inline anchor_byte
+get_behind(const char* input_str, const size_t pos)
+{
+    return pos == 0 ? ANCHOR_BYTE_START : (unsigned char)input_str[pos - 1];
+}
+
+/* the byte at pos, or ANCHOR_BYTE_END at the end of input. like Perl, a
+   single newline that terminates the input is also seen as the end */
+static inline anchor_byte
+get_ahead(const char* input_str, const size_t input_len, const size_t pos)
+{
+    if (pos >= input_len
+        || (pos == input_len - 1 && input_str[input_len - 1] == '\n')) {
+        return ANCHOR_BYTE_END;
+    }
+    return (unsigned char)input_str[pos];
+}
+
 static inline int
 isword(anchor_byte byte)
 {
@@ -125,12 +162,29 @@ match_byte(matcher_t m, unsigned char byte)
     );
 }
 
+/* the line anchors also match after and before a newline so that multiline
+   mode needs no line splitting */
 static inline int
 match_anchor(enum ANCHOR_NAME anchor, anchor_byte behind, anchor_byte ahead)
 {
-    return (anchor == ANCHOR_START && behind == ANCHOR_BYTE_START)
-        || (anchor == ANCHOR_END && ahead == ANCHOR_BYTE_END)
-        || (anchor == ANCHOR_WEDGE && (isword(behind) != isword(ahead)));
+    switch (anchor) {
+    case ANCHOR_START:
+        return behind == ANCHOR_BYTE_START;
+    case ANCHOR_END:
+        return ahead == ANCHOR_BYTE_END;
+    case ANCHOR_WEDGE:
+        return isword(behind) != isword(ahead);
+    case ANCHOR_LINE_START:
+        return behind == ANCHOR_BYTE_START || behind == '\n';
+    case ANCHOR_LINE_END:
+        return ahead == ANCHOR_BYTE_END || ahead == '\n';
+    case ANCHOR_NOT_WORD_BEHIND:
+        return !isword(behind);
+    case ANCHOR_NOT_WORD_AHEAD:
+        return !isword(ahead);
+    default:
+        return 0;
+    }
 }
 
 static inline matcher_t
@@ -145,6 +199,19 @@ eps_matcher()
     return (matcher_t) { .flag = MATCHER_FLAG_EPS, .payload = 0 };
 }
 
+/* an epsilon to the left alternative, which is preferred by the captures */
+static inline matcher_t
+alter_eps_matcher()
+{
+    return (matcher_t) { .flag = MATCHER_FLAG_EPS, .payload = 1 };
+}
+
+static inline int
+is_alter_eps(matcher_t m)
+{
+    return m.flag == MATCHER_FLAG_EPS && m.payload == 1;
+}
+
 static inline matcher_t
 wc_matcher(enum WILDCARD_NAME wc)
 {
@@ -166,6 +233,16 @@ anchor_matcher(enum ANCHOR_NAME anch)
     };
 }
 
+/* record the position in a capture slot, only used by the capture nfa */
+static inline matcher_t
+save_matcher(int slot)
+{
+    return (matcher_t) {
+        .flag = MATCHER_FLAG_SAVE | MATCHER_FLAG_EPS,
+        .payload = slot,
+    };
+}
+
 static inline matcher_t
 class_matcher(int class_index)
 {
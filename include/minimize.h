@@ -0,0 +1,18 @@
+#include "arena.h"
+#include "nfa.h"
+
+#ifndef MINIMIZE_H
+#define MINIMIZE_H
+
+/* merge the states that cannot be told apart: first the states with the
+   same finality and the same (matcher, next block) pairs, which is forward
+   bisimulation, then the states with the same start-ness and the same
+   (matcher, previous block) pairs, which is backward bisimulation. both keep
+   the language, so every engine gets the same matches from fewer states.
+   an nfa with many more transitions than states is copied as it is, and a
+   refinement that takes too long keeps every state. the jump tables are not
+   made. the result and a copy of the character classes are allocated in
+   output_arena, or on the heap if it is NULL */
+epsnfa epsnfa_minimize(const epsnfa* input, arena_t* output_arena);
+
+#endif
@@ -0,0 +1,176 @@
+#include <stddef.h>
+#include <stdio.h>
+
+#ifndef NACRE_H
+#define NACRE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* public interface of libnacre
+
+   a pattern is compiled once into a nacre_regex_t. the compiled regex is
+   never modified by matching, so one handle can be shared by any number of
+   threads. everything that matching writes to lives in a nacre_scratch_t,
+   which every thread must own privately. once a scratch has grown to fit the
+   pattern and input, the match functions do not allocate.
+
+   nothing in the library ends the process. a malformed pattern or an
+   allocator that returns NULL makes nacre_compile return NULL, and
+   nacre_compile_with_error tells why. */
+
+/* compile flags */
+#define NACRE_MULTILINE 0x01 /* "^" and "$" also match at line boundaries */
+#define NACRE_GLUSHKOV 0x02 /* compile into the position automaton */
+#define NACRE_IGNORE_CASE 0x04 /* ascii letters match in either case */
+/* no match holds a newline, as if every line were matched on its own */
+#define NACRE_SINGLE_LINE 0x08
+/* no word byte is right before or after a match, like "grep -w" */
+#define NACRE_WHOLE_WORD 0x10
+/* a match is a whole line, like "grep -x". it implies NACRE_SINGLE_LINE
+   and NACRE_MULTILINE, so "^" and "$" in the pattern are line anchors */
+#define NACRE_WHOLE_LINE 0x20
+/* the pattern and input are utf-8: ".", negated wildcards and classes, and
+   classes with non-ascii characters match whole characters. "\w", "\d",
+   "\s", "\b" and ignoring case still only know ascii */
+#define NACRE_UTF8 0x40
+#define NACRE_DEBUG 0x80 /* print parsing and compiling steps to stdout */
+/* compile the dfas into x86-64 code when the lazy dfa would run: the
+   unanchored one that finds where a match ends, and the anchored one that
+   extends it. a pattern with anchors, a dfa of more than 255 states or
+   another machine keeps the lazy dfa */
+#define NACRE_JIT 0x100
+
+typedef struct nacre_regex nacre_regex_t;
+typedef struct nacre_scratch nacre_scratch_t;
+
+/* allocator hooks. a regex and a scratch get all their memory from these
+   hooks in big blocks, and give it back all at once when they are freed */
+typedef struct nacre_allocator {
+    void* (*alloc)(size_t size, void* ctx);
+    void (*free)(void* ptr, void* ctx);
+    void* ctx;
+} nacre_allocator_t;
+
+/* the error codes of a compile or a scratch */
+#define NACRE_OK 0
+#define NACRE_ERROR_EMPTY 1 /* the pattern is empty */
+#define NACRE_ERROR_SYNTAX 2 /* the pattern is malformed */
+#define NACRE_ERROR_LIMIT 3 /* the pattern or a repetition is too long */
+#define NACRE_ERROR_NO_MEMORY 4 /* the allocator returned NULL */
+
+#define NACRE_ERROR_MESSAGE_SIZE 128
+
+typedef struct nacre_error {
+    int code; /* NACRE_OK if there is no error */
+    char message[NACRE_ERROR_MESSAGE_SIZE];
+} nacre_error_t;
+
+typedef struct nacre_match {
+    size_t offset;
+    size_t length;
+} nacre_match_t;
+
+/* the offset of a capture group that takes no part in a match */
+#define NACRE_NO_GROUP ((size_t)-1)
+
+/* return NULL if the pattern is empty or malformed, or memory runs out */
+nacre_regex_t* nacre_compile(const char* pattern, const int flags);
+
+/* same as nacre_compile, allocator can be NULL to use malloc and free */
+nacre_regex_t* nacre_compile_with_allocator(
+    const char* pattern, const int flags, const nacre_allocator_t* allocator
+);
+
+/* same as nacre_compile_with_allocator, and if it returns NULL, error gets
+   the code and a message. error can be NULL */
+nacre_regex_t* nacre_compile_with_error(
+    const char* pattern, const int flags, const nacre_allocator_t* allocator,
+    nacre_error_t* error
+);
+
+void nacre_free(nacre_regex_t* regex);
+
+/* a scratch can be used with any regex, it grows as needed. return NULL
+   if memory runs out. if it runs out while a match function grows the
+   scratch, that call finds no match and the scratch keeps
+   NACRE_ERROR_NO_MEMORY: every later call finds nothing, and it can only
+   be freed */
+nacre_scratch_t* nacre_scratch_new(void);
+
+nacre_scratch_t*
+nacre_scratch_new_with_allocator(const nacre_allocator_t* allocator);
+
+void nacre_scratch_free(nacre_scratch_t* scratch);
+
+/* NACRE_OK, or NACRE_ERROR_NO_MEMORY once a match function ran out */
+int nacre_scratch_error(const nacre_scratch_t* scratch);
+
+/* return the length of the longest non-empty match that starts exactly at
+   input[offset], or 0 if there is none */
+size_t nacre_match_at(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t offset
+);
+
+/* find the leftmost-longest non-empty match in input[start:input_len].
+   return 1 and fill match if found, otherwise return 0. the bytes before
+   start are still seen by anchors */
+int nacre_find(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t start, nacre_match_t* match
+);
+
+/* the offset of a record in a batch that has no match */
+#define NACRE_NO_MATCH ((size_t)-1)
+
+/* find the first match of each of count records, like nacre_find from
+   offset 0. the records are in struct of arrays form: record i is
+   inputs[i][0:lens[i]]. matches[i] gets its match, or NACRE_NO_MATCH as
+   the offset. the scratch is shared by the whole batch, and the bytes of
+   the records ahead are prefetched while a record is matched. return the
+   number of records with a match */
+size_t nacre_find_batch(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch,
+    const char* const* inputs, const size_t* lens, const size_t count,
+    nacre_match_t* matches
+);
+
+/* same as nacre_find_batch, but only set bit i % 8 of bitmap[i / 8] if
+   record i has a match, and clear it if not. bitmap must have
+   (count + 7) / 8 bytes */
+size_t nacre_match_batch(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch,
+    const char* const* inputs, const size_t* lens, const size_t count,
+    unsigned char* bitmap
+);
+
+/* print to stdout how the regex is matched: the engine the planner picked
+   for it, the prefilter, and the numbers it is picked by */
+void nacre_explain(const nacre_regex_t* regex);
+
+/* write a C file to out with the dfa of the regex as NAME_match and
+   NAME_find, which need nothing but the C library. return 0 and write
+   nothing if name is not a C identifier, the pattern has anchors, or one
+   of its dfas is too large */
+int nacre_emit_c(const nacre_regex_t* regex, const char* name, FILE* out);
+
+/* the number of capture groups, they are numbered from 1 by their "(" */
+int nacre_group_count(const nacre_regex_t* regex);
+
+/* same as nacre_find, and also fill in the capture groups of the match.
+   groups must have nacre_group_count(regex) + 1 entries, groups[0] gets the
+   match itself. the groups are taken from one way to parse the match that
+   prefers the left alternative and the longer repetition. a group that
+   takes no part gets NACRE_NO_GROUP as its offset */
+int nacre_find_groups(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t start, nacre_match_t* groups
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,101 +5,280 @@
 #ifndef NFA_H
 #define NFA_H
 
-#define NFA_STATE_NUM_LIMIT 65535
-
 typedef struct transition {
     matcher_t matcher;
     size_t to_state;
 } transition_t;
 
-/* Thompson epsilon-NFA: only one start and one finish.
-   edge stored as linked-lists */
+/* a chain of states that each have one transition on one byte, so that the
+   matchers can compare the bytes of the chain at once. the bytes are
+   run_bytes[offset] to run_bytes[offset + length - 1] and the chain ends
+   in to_state */
+typedef struct literal_run {
+    uint32_t offset;
+    uint32_t length; /* 0 if no run starts at the state */
+    uint32_t to_state;
+} literal_run_t;
+
+/* Thompson epsilon-NFA: the fragments of all sub-expressions append their
+   states and transitions to the same arrays, so joining two fragments costs
+   O(1) and never rewrites the transitions that are already there */
 typedef struct tepsnfa {
     size_t state_num;
+    dynarr_t transitions; /* type: tepsnfa_transition_t */
+    arena_t* arena;
+} tepsnfa;
+
+typedef struct tepsnfa_transition {
+    size_t from_state;
+    matcher_t matcher;
+    size_t to_state;
+} tepsnfa_transition_t;
+
+/* a sub-automaton in a tepsnfa with only one start and one final state. the
+   start state has no in-transition and the final state has no
+   out-transition. the states and transitions that belong to a fragment are
+   contiguous ranges, so that it can be copied */
+typedef struct tepsnfa_frag {
     size_t start_state;
     size_t final_state;
-    /* type: dynarr of transtion. index is starting state. */
-    dynarr_t state_transitions;
-} tepsnfa;
+    size_t states_begin;
+    size_t states_end;
+    size_t transitions_begin;
+    size_t transitions_end;
+} tepsnfa_frag_t;
 
-/* epsilon NFA: edges stored as an adjacent matrix */
+/* epsilon NFA: the out-transitions of state i are
+   transitions[transition_offsets[i]] to transitions[transition_offsets[i+1]]
+*/
 typedef struct epsnfa {
     size_t state_num;
-    matcher_t* transition_table;
+    size_t transition_num;
+    size_t* transition_offsets; /* size: state_num + 1 */
+    transition_t* transitions;
     bitmask_t is_start;
     bitmask_t is_finish;
     dynarr_t char_class_pool; /* type: char_class_t */
+    arena_t* arena; /* where the tables are, NULL for the heap */
+    /* made by epsnfa_build_jump_table once the transitions are final. the
+       bytes that no transition tells apart share a class, and the
+       consuming transitions of a state on a class go to the targets from
+       jump_offsets[state * class_num + class] to the next offset */
+    uint8_t byte_classes[256];
+    size_t class_num; /* 0 if there are no tables yet */
+    uint32_t* jump_offsets; /* size: state_num * class_num + 1 */
+    uint32_t* jump_targets;
+    /* the anchor transitions of each state, in their own list */
+    size_t* anchor_offsets; /* size: state_num + 1 */
+    transition_t* anchor_transitions;
+    /* the literal run that starts at each state */
+    literal_run_t* runs; /* size: state_num */
+    unsigned char* run_bytes;
 } epsnfa;
 
-/* Thompson epsilon-NFA methods */
+/* Thompson nfa that keeps its epsilon and save transitions, for extracting
+   the capture groups of a match. the out-transitions of a state are in
+   priority order, so the preferred way to parse a match is tried first */
+typedef struct capnfa {
+    size_t state_num;
+    size_t start_state;
+    size_t final_state;
+    size_t* transition_offsets; /* size: state_num + 1 */
+    transition_t* transitions;
+    dynarr_t char_class_pool; /* type: char_class_t */
+    int group_num;
+} capnfa;
 
-/* initialize an Thompson epsnfa of one start states, one final states, and one
-   transition between them */
-tepsnfa tepsnfa_one_transition(matcher_t m);
+/* Thompson epsilon-NFA methods */
 
-size_t tepsnfa_print(tepsnfa* self);
+/* the tepsnfa keeps all its memory in arena */
+tepsnfa tepsnfa_new(arena_t* arena);
 
-void tepsnfa_clear(tepsnfa* self);
+size_t tepsnfa_print(const tepsnfa* self, const tepsnfa_frag_t* frag);
 
-void tepsnfa_add_state(tepsnfa* self);
+size_t tepsnfa_add_state(tepsnfa* self);
 
 void tepsnfa_add_transition(
     tepsnfa* self, size_t from, matcher_t matcher, size_t to
 );
 
-tepsnfa tepsnfa_deepcopy(const tepsnfa* self);
+/* a fragment of two states and one transition between them */
+tepsnfa_frag_t tepsnfa_one_transition(tepsnfa* self, matcher_t m);
+
+/* append a copy of frag's states and transitions */
+tepsnfa_frag_t tepsnfa_copy(tepsnfa* self, const tepsnfa_frag_t* frag);
 
 /* a, b -> ab */
-void tepsnfa_concat(tepsnfa* self, const tepsnfa* right);
+tepsnfa_frag_t tepsnfa_concat(
+    tepsnfa* self, const tepsnfa_frag_t* left, const tepsnfa_frag_t* right
+);
 
 /* a, b -> a|b */
-void tepsnfa_union(tepsnfa* self, const tepsnfa* right);
-
-/* a, b -> a|b where b is one-transition epsnfa */
-void tepsnfa_fast_union(tepsnfa* self, const tepsnfa* right);
+tepsnfa_frag_t tepsnfa_union(
+    tepsnfa* self, const tepsnfa_frag_t* left, const tepsnfa_frag_t* right
+);
 
 /* r -> r* */
-void tepsnfa_to_star(tepsnfa* self);
+tepsnfa_frag_t tepsnfa_to_star(tepsnfa* self, const tepsnfa_frag_t* frag);
+
+/* r -> r+ */
+tepsnfa_frag_t tepsnfa_to_plus(tepsnfa* self, const tepsnfa_frag_t* frag);
 
 /* r -> r? */
-void tepsnfa_to_opt(tepsnfa* self);
+tepsnfa_frag_t tepsnfa_to_opt(tepsnfa* self, const tepsnfa_frag_t* frag);
 
-epsnfa tepsnfa_to_epsnfa_and_reduce_eps(tepsnfa* input);
+/* r -> (r), saving the start and the end of r in the slots of the group */
+tepsnfa_frag_t
+tepsnfa_to_group(tepsnfa* self, const tepsnfa_frag_t* frag, int group);
+
+/* make a capnfa of the fragment as it is. the output is allocated in
+   output_arena */
+capnfa tepsnfa_to_capnfa(
+    const tepsnfa* input, const tepsnfa_frag_t* frag, arena_t* output_arena
+);
+
+/* make an epsnfa without epsilon transitions from the fragment. only the
+   states reachable from its start are kept. the intermediates are in the
+   arena of input and the output is allocated in output_arena */
+epsnfa tepsnfa_to_epsnfa_and_reduce_eps(
+    const tepsnfa* input, const tepsnfa_frag_t* frag, arena_t* output_arena
+);
 
 /* Epsilon-NFA methods */
 
-epsnfa epsnfa_new(const size_t state_num);
+epsnfa epsnfa_new(
+    const size_t state_num, const size_t transition_num, arena_t* arena
+);
+
+void epsnfa_print(const epsnfa* self);
 
-void epsnfa_get_eps_closure(epsnfa* self, size_t state, bitmask_t* closure);
+/* fold the consuming transitions from a state to the same state into one,
+   whose bytes are a class interned in char_class_pool, or a byte if there
+   is only one. every class transition is interned the same way. the anchor
+   transitions are kept apart without repeats. the transitions are
+   rewritten in place and can only get fewer */
+void epsnfa_merge_edges(epsnfa* self);
 
-void epsnfa_reduce_eps(epsnfa* self, size_t state);
+/* the shortest and the longest literal run. a longer chain is split into
+   runs that follow each other */
+#define NFA_RUN_MIN_LEN 4
+#define NFA_RUN_MAX_LEN 64
 
-void epsnfa_print(epsnfa* self);
+/* make the byte classes, jump tables, anchor lists and literal runs of the
+   nfa. the matchers only call this once the transitions are final */
+void epsnfa_build_jump_table(epsnfa* self);
+
+/* the consuming transitions of state on byte c go to the jump targets
+   from row[0] to row[1] */
+static inline const uint32_t*
+epsnfa_jump_row(const epsnfa* self, const size_t state, const unsigned char c)
+{
+    return self->jump_offsets + state * self->class_num
+        + self->byte_classes[c];
+}
 
 void epsnfa_clear(epsnfa* self);
 
-typedef struct match {
-    size_t offset;
-    size_t length;
-    size_t line;
-    size_t col;
-} match_t;
+/* a search state of the backtracker */
+typedef struct match_memory {
+    size_t cur_state;
+    size_t pos; /* the position in input string */
+} match_memory_t;
+
+/* the backtracker is used when one bit for every (state, position) pair of
+   the rest of the input fits in this many bits */
+#define BITSTATE_MAX_BITS (256 * 1024)
+
+/* the working memory of epsnfa_find_initial_match, owned by the caller */
+typedef struct nfa_memory {
+    dynarr_t stack; /* type: match_memory_t */
+    dynarr_t visited; /* type: uint64_t, the (state, position) bitmap */
+    size_t visited_dirty; /* the words of visited that can be non-zero */
+    dynarr_t cur_states; /* type: size_t */
+    dynarr_t next_states; /* type: size_t */
+    dynarr_t stamps; /* type: size_t, per state */
+    size_t generation;
+} nfa_memory_t;
+
+nfa_memory_t nfa_memory_new(arena_t* arena);
+
+/* the slots of a group that did not take part in the match */
+#define CAPNFA_NO_SLOT ((size_t)-1)
 
-#define MATCH_SEARCH_DEPTH_LIMIT 100000
+enum pike_job_kind {
+    PIKE_JOB_EXPLORE, /* add the thread at state */
+    PIKE_JOB_SAVE, /* set slot to the position, then explore state */
+    PIKE_JOB_RESTORE, /* set slot back to value */
+    PIKE_JOB_THREAD, /* add a thread that waits on transition state */
+};
 
-/* return n if n is the smallest integer such that input_str[0:n] matches
-   return -1 if no match found */
+/* the thread that has reached the final state */
+#define PIKE_FINAL_THREAD ((size_t)-1)
+
+typedef struct pike_job {
+    int kind;
+    size_t state;
+    size_t slot;
+    size_t value;
+} pike_job_t;
+
+/* the working memory of capnfa_find_groups, owned by the caller */
+typedef struct pike_memory {
+    dynarr_t thread_transitions[2]; /* type: size_t */
+    dynarr_t thread_slots[2]; /* type: size_t, slot_num per thread */
+    dynarr_t work_slots; /* type: size_t */
+    dynarr_t stamps; /* type: size_t, per state */
+    dynarr_t jobs; /* type: pike_job_t */
+    size_t generation;
+} pike_memory_t;
+
+pike_memory_t pike_memory_new(arena_t* arena);
+
+/* run the capnfa over exactly input_str[offset:offset+length], which must
+   be a match, with a pike vm. slots gets the start and end of every group,
+   2 * group_num in total, from the highest priority thread that reaches the
+   final state at the end. return 0 if no thread does */
+int capnfa_find_groups(
+    const capnfa* self, const char* input_str, const size_t input_len,
+    const size_t offset, const size_t length, pike_memory_t* memory,
+    size_t* slots
+);
+
+/* return n if n is the largest integer such that
+   input_str[start_offset:start_offset+n] matches, or 0 if no match found.
+   a backtracker that visits every (state, position) pair at most once is
+   used when its bitmap fits BITSTATE_MAX_BITS, otherwise the set of states
+   is simulated one byte at a time. both take O(states * input) at worst.
+   memory is reused between calls so that matching does not allocate once
+   it has grown */
 size_t epsnfa_find_initial_match(
-    const epsnfa* self, const char* input_str, const size_t intput_len,
-    const size_t start_offset
+    const epsnfa* self, const char* input_str, const size_t input_len,
+    const size_t start_offset, nfa_memory_t* memory
 );
 
-dynarr_t epsnfa_find_matches(
-    const epsnfa* epsnfa, const char* input, const int is_global
+/* make the nfa of the reversed language, with the jump tables. it reads
+   the input backwards and its anchors still hold where they held. the
+   char_class_pool is shared with self */
+epsnfa epsnfa_reverse(const epsnfa* self, arena_t* arena);
+
+#define NFA_NO_START ((size_t)-1)
+
+/* run the reversed nfa reverse from end back to limit. return the leftmost
+   p in [limit, end) such that input_str[p:end] matches the forward nfa, or
+   NFA_NO_START if there is none */
+size_t epsnfa_find_leftmost_start(
+    const epsnfa* reverse, const char* input_str, const size_t input_len,
+    const size_t end, const size_t limit, nfa_memory_t* memory
 );
 
-dynarr_t epsnfa_find_matches_multiline(
-    const epsnfa* epsnfa, const char* input, const int is_global
+#define NFA_NO_END ((size_t)-1)
+
+/* run the nfa from start with its start states added before every byte,
+   like the unanchored dfa. return the first offset after start where a
+   match that starts at or after start ends, or NFA_NO_END */
+size_t epsnfa_find_first_end(
+    const epsnfa* self, const char* input_str, const size_t input_len,
+    const size_t start, nfa_memory_t* memory
 );
 
 #endif
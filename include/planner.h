@@ -0,0 +1,103 @@
+#include "arena.h"
+#include "byte_scan.h"
+#include "jit.h"
+#include "nfa.h"
+#include "re_ast.h"
+
+#ifndef PLANNER_H
+#define PLANNER_H
+
+/* the planner looks at the ast and the compiled epsnfa once, and picks the
+   engine that finds the matches and the prefilter that skips the offsets
+   where no match can start */
+
+enum PLAN_ENGINE {
+    PLAN_ENGINE_LITERAL, /* the pattern is a string, search it directly */
+    PLAN_ENGINE_DFA, /* lazy dfa, or the nfa when its cache thrashes */
+    PLAN_ENGINE_NFA, /* bitstate backtracker or state set simulation */
+};
+
+/* how the offsets where no match can start are skipped */
+enum PLAN_SCAN {
+    PLAN_SCAN_NONE, /* every offset is tried */
+    PLAN_SCAN_PREFIX, /* the literal prefix of every match */
+    PLAN_SCAN_BYTES, /* up to three first bytes */
+    PLAN_SCAN_RANGE, /* the first bytes are one range */
+    PLAN_SCAN_BITMAP, /* any other set of first bytes */
+};
+
+/* where every match must end */
+enum PLAN_END_ANCHOR {
+    PLAN_END_ANY,
+    PLAN_END_INPUT, /* every match ends with "$" */
+    PLAN_END_LINE, /* every match ends with a line "$" and has no newline */
+};
+
+/* with more first bytes than this, a scan skips too little to pay */
+#define PLAN_SCAN_MAX_FIRST_BYTES 128
+
+/* the lazy dfa is only planned for an epsnfa up to this many states */
+#define PLAN_DFA_MAX_STATES 10000
+
+typedef struct plan {
+    enum PLAN_ENGINE engine;
+    /* the full dfas of PLAN_ENGINE_DFA compiled into machine code, which
+       is used instead of the lazy dfa if match is not NULL */
+    jit_program_t jit;
+    enum PLAN_SCAN scan;
+    /* the bytes that every match starts with. if is_prefix_folded, they
+       are in lower case and match in either case */
+    unsigned char* prefix;
+    size_t prefix_len;
+    int is_prefix_folded;
+    /* bitmap of the bytes that a match can start with */
+    unsigned char first_bytes[32];
+    int first_byte_num;
+    /* the bytes of PLAN_SCAN_BYTES, or the low and high of PLAN_SCAN_RANGE */
+    unsigned char scan_bytes[3];
+    /* what the plan is made from */
+    /* every match starts with "^", so only offset 0 is tried */
+    int is_start_anchored;
+    /* the matches are found by scanning back from where they can end with
+       the reverse nfa, which is only made for PLAN_END_INPUT,
+       PLAN_END_LINE and PLAN_ENGINE_DFA */
+    enum PLAN_END_ANCHOR end_anchor;
+    epsnfa reverse;
+    /* bitmap of the bytes that a match can end with, if there is reverse */
+    unsigned char last_bytes[32];
+    int is_literal;
+    int has_anchor;
+    int group_num;
+    size_t state_num;
+    size_t transition_num;
+} plan_t;
+
+/* the plan and its prefix are allocated in arena. flags are the RE_FLAGs
+   that nfa was compiled with, and RE_FLAG_JIT to compile the dfas when the
+   lazy dfa would be planned. the jit code must be freed by plan_free */
+plan_t plan_new(
+    const re_ast_t* re_ast, const epsnfa* nfa, const int flags, arena_t* arena
+);
+
+void plan_free(plan_t* self);
+
+size_t plan_print(const plan_t* self);
+
+/* does input start with the prefix */
+static inline int
+plan_is_prefix_at(const plan_t* self, const char* input)
+{
+    if (self->is_prefix_folded) {
+        return is_equal_folded(input, self->prefix, self->prefix_len);
+    }
+    return memcmp(input, self->prefix, self->prefix_len) == 0;
+}
+
+/* return the first offset from start where a match can start, or
+   input_len if there is none */
+size_t plan_next_candidate(
+    const plan_t* self, const char* input_str, const size_t input_len,
+    const size_t start
+);
+
+#endif
@@ -13,10 +13,74 @@ typedef struct re_ast {
     int* rights;
     int size;
     int root;
+    int group_num; /* the number of capture groups */
 } re_ast_t;
 
+/* flags for re_ast_to_nfa */
+#define RE_FLAG_MULTILINE 0x01 /* "^" and "$" also match at line boundaries */
+#define RE_FLAG_GLUSHKOV 0x02 /* use the position automaton compiler */
+#define RE_FLAG_CAPTURE 0x04 /* keep the groups, only for re_ast_to_capnfa */
+#define RE_FLAG_IGNORE_CASE 0x08 /* a letter is the class of both cases */
+#define RE_FLAG_SINGLE_LINE 0x10 /* nothing takes a newline */
+#define RE_FLAG_UTF8 0x20 /* the pattern and input are utf-8 */
+#define RE_FLAG_JIT 0x40 /* plan the compiled dfa, only for plan_new */
+
 void re_ast_free(re_ast_t* ast);
 
-extern epsnfa re_ast_to_nfa(const re_ast_t* re_ast, const int is_debug);
+/* return an equivalent ast in arena where every counted repetition is
+   expanded with copies of its operand, concat, opt and star. "r{0}" is kept
+   as is because it has no such expansion. like the ast from parse_regex, the
+   children of a node are before it and a subtree is a contiguous range */
+extern re_ast_t re_ast_expand_dups(const re_ast_t* re_ast, arena_t* arena);
+
+/* return an ast in arena that matches the same strings as re_ast with
+   fewer nodes for the automata and longer literals for the planner: the
+   groups are dropped, an alternation has its common prefixes and suffixes
+   factored out like a trie and its one byte alternatives merged into a
+   class, "error|errno" becomes "err(or|no)" and "a|b|c" becomes "[abc]",
+   repeated unary operators like "(a+)*" become one, and a fixed repetition
+   of a short literal is written out. the groups are gone, so it is not for
+   re_ast_to_capnfa */
+extern re_ast_t re_ast_simplify(const re_ast_t* re_ast, arena_t* arena);
+
+/* return an equivalent ast in arena of "before", then re_ast, then "after",
+   where both are anchors */
+extern re_ast_t re_ast_wrap_anchors(
+    const re_ast_t* re_ast, const enum ANCHOR_NAME before,
+    const enum ANCHOR_NAME after, arena_t* arena
+);
+
+/* hash-consing: return an array in arena that maps every node to the
+   first node whose subtree is the same, so that an equal subtree can be
+   compiled once and copied. the children of a node must be before it */
+extern int* re_ast_hash_cons(const re_ast_t* re_ast, arena_t* arena);
+
+/* the matcher of a byte, wildcard, class or anchor token. a class is
+   appended to char_class_pool. with RE_FLAG_IGNORE_CASE, a letter becomes
+   the class of its two cases and a class gets the other case of its
+   letters, so matching costs the same as without it. with
+   RE_FLAG_SINGLE_LINE, the newline is taken out of every matcher. another
+   token gives error its error and the epsilon matcher */
+extern matcher_t re_token_to_matcher(
+    const re_token_t* token, const int flags, dynarr_t* char_class_pool,
+    nacre_error_t* error
+);
+
+/* compile the ast with thompson's construction and epsilon reduction, or
+   into the position automaton with RE_FLAG_GLUSHKOV, then merge the states
+   that cannot be told apart and make the jump tables. the result is
+   allocated in arena, or on the heap if arena is NULL. an ast that is not
+   well formed gives error its error, and the nfa is of no use */
+extern epsnfa re_ast_to_nfa(
+    const re_ast_t* re_ast, const int flags, arena_t* arena, const int is_debug,
+    nacre_error_t* error
+);
+
+/* compile the ast into the thompson nfa with its groups, allocated in
+   arena. errors are given like re_ast_to_nfa */
+extern capnfa re_ast_to_capnfa(
+    const re_ast_t* re_ast, const int flags, arena_t* arena,
+    nacre_error_t* error
+);
 
 #endif
@@ -6,9 +6,35 @@
 
 #define RE_STR_LEN_LIMIT 65535
 
-extern char_class_t parse_bracket_expr(const char* input_str);
-extern int atoi_check_dup_max(const char dup_str[DUP_STR_MAX_LEN]);
-extern dynarr_t expand_dups(dynarr_t* ast);
-extern re_ast_t parse_regex(const char* input_str, const int is_debug);
+/* the largest unicode code point */
+#define UTF8_CODE_MAX 0x10FFFF
+
+/* a range of code points, both ends included */
+typedef struct code_range {
+    uint32_t from;
+    uint32_t to;
+} code_range_t;
+
+/* if wide_ranges is NULL, every byte is a member of the class. otherwise
+   the input is utf-8, the code points below 0x80 go to the bitmap and the
+   others are appended to wide_ranges (type: code_range_t) */
+extern char_class_t parse_bracket_expr(
+    const char* input_str, dynarr_t* wide_ranges, arena_t* arena,
+    nacre_error_t* error
+);
+extern int atoi_check_dup_max(
+    const char dup_str[DUP_STR_MAX_LEN], nacre_error_t* error
+);
+/* the ast is allocated in arena, or on the heap if arena is NULL. with
+   RE_FLAG_UTF8, the pattern is utf-8 and a non-ascii character, ".", a
+   negated wildcard or class, or a class with non-ascii characters becomes
+   the alternation of the byte sequences of its characters, so the
+   automata built from the ast still read one byte at a time. a malformed
+   pattern gives error its first error and an ast of size 0, which is also
+   what an empty pattern gives without an error */
+extern re_ast_t parse_regex(
+    const char* input_str, const int flags, arena_t* arena, const int is_debug,
+    nacre_error_t* error
+);
 
 #endif
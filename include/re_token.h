@@ -1,4 +1,5 @@
 #include "char_class.h"
+#include "nacre.h"
 #include <stdint.h>
 
 #ifndef RE_TOKEN_H
@@ -14,6 +15,7 @@ enum re_token_type {
     TYPE_LP, /* left parenthese */
     TYPE_RP, /* right parenthese */
     TYPE_ANCHOR, /* anchor */
+    TYPE_GROUP, /* the end of a capture group, an unary operator */
     TYPE_END,
 };
 #define RE_TYPES_NUM (TYPE_END)
@@ -52,6 +54,11 @@ enum ANCHOR_NAME {
     ANCHOR_START,
     ANCHOR_END,
     ANCHOR_WEDGE,
+    ANCHOR_LINE_START, /* "^" compiled in multiline mode */
+    ANCHOR_LINE_END, /* "$" compiled in multiline mode */
+    /* no syntax, they are put around the pattern for whole word matches */
+    ANCHOR_NOT_WORD_BEHIND, /* the byte before is not a word byte */
+    ANCHOR_NOT_WORD_AHEAD, /* the byte after is not a word byte */
 };
 #define ANCHOR_WEDGE_CHAR 'b'
 #define ANCHOR_START_CHAR '^'
@@ -76,7 +83,7 @@ extern const int OP_PRECED[OP_NAMES_NUM];
 #define OP_PRECED_LT(a, b) (OP_PRECED[a] < OP_PRECED[b])
 
 #define DUP_NUM_MAX 0xFF
-#define DUP_NO_MAX 0
+#define DUP_NO_MAX 0xFFFF
 #define DUP_STR_MAX_LEN 3
 #define DUP_START '{'
 #define DUP_SEP ','
@@ -94,6 +101,7 @@ typedef union token_payload {
     enum ANCHOR_NAME anch;
     enum OPERATOR_NAME op;
     char_class_t class;
+    uint16_t group; /* the index of a group, from 1 */
 } token_payload_t;
 
 typedef struct re_token {
@@ -104,4 +112,10 @@ typedef struct re_token {
 
 extern int re_token_print(re_token_t token);
 
+/* give error the code and the printf style message, unless it already has
+   an error, so that the first one is kept */
+extern void
+re_error_set(nacre_error_t* error, const int code, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
 #endif
\ No newline at end of file
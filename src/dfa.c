@@ -0,0 +1,601 @@
+#include "dfa.h"
+#include <stdio.h>
+#include <string.h>
+
+/* the hash table has twice as many slots as the cache has states */
+#define DFA_TABLE_SIZE (2 * DFA_CACHE_MAX_STATES)
+
+dfa_cache_t
+dfa_cache_new(arena_t* arena)
+{
+    dfa_cache_t cache = {
+        .nfa = NULL,
+        .has_anchor = 0,
+        .is_failed = 0,
+        .is_unanchored = 0,
+        .states = dynarr_new_in(arena, sizeof(dfa_state_t)),
+        .set_pool = dynarr_new_in(arena, sizeof(uint32_t)),
+        .transitions = dynarr_new_in(arena, sizeof(int32_t)),
+        .table = dynarr_new_in(arena, sizeof(int32_t)),
+        .bytes_since_clear = 0,
+        .closure = dynarr_new_in(arena, sizeof(uint32_t)),
+        .next_set = dynarr_new_in(arena, sizeof(uint32_t)),
+        .stamps = dynarr_new_in(arena, sizeof(size_t)),
+        .generation = 0,
+    };
+    return cache;
+}
+
+static inline uint8_t
+context_of(anchor_byte behind)
+{
+    if (behind == ANCHOR_BYTE_START) {
+        return DFA_CONTEXT_START;
+    }
+    if (behind == '\n') {
+        return DFA_CONTEXT_NEWLINE;
+    }
+    return isword(behind) ? DFA_CONTEXT_WORD : DFA_CONTEXT_OTHER;
+}
+
+/* a byte of the kind, the anchors only look at the kind */
+static inline anchor_byte
+behind_of(uint8_t context)
+{
+    static const anchor_byte behinds[DFA_CONTEXT_NUM] = {
+        ANCHOR_BYTE_START,
+        '\n',
+        'a',
+        ' ',
+    };
+    return behinds[context];
+}
+
+static inline uint32_t
+hash_set(uint8_t context, const uint32_t* set, size_t set_size)
+{
+    uint32_t h = 2166136261u ^ context;
+    size_t i;
+    for (i = 0; i < set_size; i++) {
+        h = (h ^ set[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void
+dfa_clear(dfa_cache_t* cache)
+{
+    dfa_state_t dead = { .set_begin = 0, .set_size = 0, .context = 0 };
+    int i;
+    cache->states.size = 0;
+    cache->set_pool.size = 0;
+    dynarr_resize(&cache->table, DFA_TABLE_SIZE);
+    memset(cache->table.data, 0xFF, DFA_TABLE_SIZE * sizeof(int32_t));
+    for (i = 0; i < DFA_CONTEXT_NUM; i++) {
+        cache->start_states[i] = DFA_UNKNOWN;
+    }
+    /* the dead state goes to itself and never accepts */
+    append(&cache->states, &dead);
+    cache->transitions.size = 0;
+    dynarr_resize(&cache->transitions, DFA_COLUMN_NUM);
+    cache->bytes_since_clear = 0;
+}
+
+void
+dfa_cache_reset(
+    dfa_cache_t* cache, const epsnfa* nfa, const int is_unanchored
+)
+{
+    size_t i;
+    cache->nfa = nfa;
+    cache->is_failed = 0;
+    cache->is_unanchored = is_unanchored;
+    cache->has_anchor = 0;
+    for (i = 0; i < nfa->transition_num; i++) {
+        if (nfa->transitions[i].matcher.flag & MATCHER_FLAG_ANCHOR) {
+            cache->has_anchor = 1;
+        }
+    }
+    if (cache->stamps.size < nfa->state_num) {
+        dynarr_resize(&cache->stamps, nfa->state_num);
+    }
+    dfa_clear(cache);
+}
+
+/* return the state of the set, which must be sorted. return DFA_UNKNOWN if
+   it is new and the cache is full */
+static int32_t
+dfa_add_state(
+    dfa_cache_t* cache, uint8_t context, const uint32_t* set, size_t set_size
+)
+{
+    int32_t* table = cache->table.data;
+    uint32_t h;
+    dfa_state_t state;
+    int32_t id;
+    size_t i, row;
+    if (set_size == 0 && !cache->is_unanchored) {
+        return DFA_DEAD_STATE;
+    }
+    if (!cache->has_anchor) {
+        context = 0;
+    }
+    h = hash_set(context, set, set_size) & (DFA_TABLE_SIZE - 1);
+    while (table[h] != DFA_UNKNOWN) {
+        const dfa_state_t* s = at(&cache->states, table[h]);
+        if (s->context == context && s->set_size == set_size
+            && memcmp(
+                   at(&cache->set_pool, s->set_begin), set,
+                   set_size * sizeof(uint32_t)
+               ) == 0) {
+            return table[h];
+        }
+        h = (h + 1) & (DFA_TABLE_SIZE - 1);
+    }
+    if (cache->states.size >= DFA_CACHE_MAX_STATES) {
+        return DFA_UNKNOWN;
+    }
+    id = cache->states.size;
+    state = (dfa_state_t) {
+        .set_begin = cache->set_pool.size,
+        .set_size = set_size,
+        .context = context,
+    };
+    for (i = 0; i < set_size; i++) {
+        append(&cache->set_pool, &set[i]);
+    }
+    append(&cache->states, &state);
+    row = cache->transitions.size;
+    dynarr_resize(&cache->transitions, row + DFA_COLUMN_NUM);
+    memset(
+        at(&cache->transitions, row), 0xFF, DFA_COLUMN_NUM * sizeof(int32_t)
+    );
+    table[h] = id;
+    return id;
+}
+
+static int
+compare_uint32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* add the targets of the anchors of the states from closure[begin] on that
+   hold between behind and ahead, and theirs, to closure */
+static void
+dfa_close_anchors(
+    dfa_cache_t* cache, size_t begin, const anchor_byte behind,
+    const anchor_byte ahead
+)
+{
+    const epsnfa* nfa = cache->nfa;
+    size_t* stamps = cache->stamps.data;
+    dynarr_t* closure = &cache->closure;
+    size_t i, j;
+    for (i = begin; i < closure->size; i++) {
+        uint32_t s = *(uint32_t*)at(closure, i);
+        for (j = nfa->anchor_offsets[s]; j < nfa->anchor_offsets[s + 1]; j++) {
+            const transition_t* t = &nfa->anchor_transitions[j];
+            uint32_t to = t->to_state;
+            if (stamps[to] != cache->generation
+                && match_anchor(t->matcher.payload, behind, ahead)) {
+                stamps[to] = cache->generation;
+                append(closure, &to);
+            }
+        }
+    }
+}
+
+/* make the transition of state id at column. return DFA_UNKNOWN if the
+   next state is new and the cache is full */
+static int32_t
+dfa_compute(dfa_cache_t* cache, int32_t id, int column)
+{
+    const epsnfa* nfa = cache->nfa;
+    const dfa_state_t state = *(dfa_state_t*)at(&cache->states, id);
+    const anchor_byte behind = behind_of(state.context);
+    const anchor_byte ahead = column < 256 ? column : ANCHOR_BYTE_END;
+    const unsigned char byte = column < 256 ? column : '\n';
+    size_t* stamps = cache->stamps.data;
+    dynarr_t* closure = &cache->closure;
+    dynarr_t* next_set = &cache->next_set;
+    int accept = 0;
+    int32_t next, entry;
+    size_t i, j, begin;
+
+    /* take the anchors that hold between the byte before and this one */
+    cache->generation++;
+    closure->size = 0;
+    for (i = 0; i < state.set_size; i++) {
+        uint32_t s = *(uint32_t*)at(&cache->set_pool, state.set_begin + i);
+        stamps[s] = cache->generation;
+        append(closure, &s);
+    }
+    dfa_close_anchors(cache, 0, behind, ahead);
+    for (i = 0; i < closure->size; i++) {
+        if (bitmask_contains(&nfa->is_finish, *(uint32_t*)at(closure, i))) {
+            accept = 1;
+        }
+    }
+    /* a match that starts here is not over yet, so it is added after the
+       accept is known */
+    if (cache->is_unanchored) {
+        begin = closure->size;
+        for (i = 0; i < nfa->state_num; i++) {
+            uint32_t s = i;
+            if (bitmask_contains(&nfa->is_start, s)
+                && stamps[s] != cache->generation) {
+                stamps[s] = cache->generation;
+                append(closure, &s);
+            }
+        }
+        dfa_close_anchors(cache, begin, behind, ahead);
+    }
+
+    /* then read the byte */
+    cache->generation++;
+    next_set->size = 0;
+    for (i = 0; column != DFA_COLUMN_END && i < closure->size; i++) {
+        const uint32_t* row
+            = epsnfa_jump_row(nfa, *(uint32_t*)at(closure, i), byte);
+        for (j = row[0]; j < row[1]; j++) {
+            uint32_t to = nfa->jump_targets[j];
+            if (stamps[to] != cache->generation) {
+                stamps[to] = cache->generation;
+                append(next_set, &to);
+            }
+        }
+    }
+    qsort(next_set->data, next_set->size, sizeof(uint32_t), compare_uint32);
+    next = dfa_add_state(
+        cache, context_of(byte), next_set->data, next_set->size
+    );
+    if (next == DFA_UNKNOWN) {
+        return DFA_UNKNOWN;
+    }
+    entry = (next << 1) | accept;
+    *(int32_t*)at(&cache->transitions, id * DFA_COLUMN_NUM + column) = entry;
+    return entry;
+}
+
+/* clear the cache but keep state id, return its new id. return
+   DFA_UNKNOWN if the cache thrashes */
+static int32_t
+dfa_restart(dfa_cache_t* cache, int32_t id)
+{
+    const dfa_state_t state = *(dfa_state_t*)at(&cache->states, id);
+    if (cache->bytes_since_clear
+        < DFA_MIN_BYTES_PER_STATE * cache->states.size) {
+        cache->is_failed = 1;
+        return DFA_UNKNOWN;
+    }
+    /* the set is saved in next_set because the pool is cleared */
+    cache->next_set.size = 0;
+    dynarr_resize(&cache->next_set, state.set_size);
+    memcpy(
+        cache->next_set.data, at(&cache->set_pool, state.set_begin),
+        state.set_size * sizeof(uint32_t)
+    );
+    dfa_clear(cache);
+    return dfa_add_state(
+        cache, state.context, cache->next_set.data, state.set_size
+    );
+}
+
+/* the state before the first byte. in an unanchored cache it is the empty
+   set, the start states are added when the byte is read */
+static int32_t
+dfa_start_state(dfa_cache_t* cache, uint8_t context)
+{
+    const epsnfa* nfa = cache->nfa;
+    size_t i;
+    if (cache->start_states[context] != DFA_UNKNOWN) {
+        return cache->start_states[context];
+    }
+    cache->next_set.size = 0;
+    for (i = 0; !cache->is_unanchored && i < nfa->state_num; i++) {
+        if (bitmask_contains(&nfa->is_start, i)) {
+            uint32_t s = i;
+            append(&cache->next_set, &s);
+        }
+    }
+    cache->start_states[context] = dfa_add_state(
+        cache, context, cache->next_set.data, cache->next_set.size
+    );
+    return cache->start_states[context];
+}
+
+int
+dfa_find_initial_match(
+    dfa_cache_t* cache, const char* input_str, const size_t input_len,
+    const size_t start_offset, size_t* matched_len
+)
+{
+    uint8_t context = 0;
+    int32_t cur;
+    size_t pos;
+    if (cache->is_failed) {
+        return 0;
+    }
+    if (cache->has_anchor) {
+        context = context_of(get_behind(input_str, start_offset));
+    }
+    cur = dfa_start_state(cache, context);
+    if (cur == DFA_UNKNOWN) {
+        dfa_clear(cache);
+        cur = dfa_start_state(cache, context);
+    }
+    *matched_len = 0;
+    for (pos = start_offset;; pos++) {
+        int column;
+        int32_t entry;
+        if (pos >= input_len) {
+            column = DFA_COLUMN_END;
+        } else if (pos == input_len - 1 && input_str[pos] == '\n') {
+            column = DFA_COLUMN_FINAL_NEWLINE;
+        } else {
+            column = (unsigned char)input_str[pos];
+        }
+        entry = ((int32_t*)cache->transitions.data)
+            [cur * DFA_COLUMN_NUM + column];
+        if (entry == DFA_UNKNOWN) {
+            entry = dfa_compute(cache, cur, column);
+            if (entry == DFA_UNKNOWN) {
+                cur = dfa_restart(cache, cur);
+                if (cur == DFA_UNKNOWN) {
+                    return 0;
+                }
+                entry = dfa_compute(cache, cur, column);
+            }
+        }
+        cache->bytes_since_clear++;
+        if ((entry & 1) && pos > start_offset) {
+            *matched_len = pos - start_offset;
+        }
+        cur = entry >> 1;
+        if (column == DFA_COLUMN_END || cur == DFA_DEAD_STATE) {
+            break;
+        }
+    }
+    return 1;
+}
+
+enum DFA_SCAN
+dfa_scan(
+    dfa_cache_t* cache, const char* input_str, const size_t input_len,
+    const size_t start, const int is_idle_stop, size_t* pos
+)
+{
+    uint8_t context = 0;
+    int32_t cur;
+    size_t p;
+    if (cache->is_failed) {
+        return DFA_SCAN_FAILED;
+    }
+    if (cache->has_anchor) {
+        context = context_of(get_behind(input_str, start));
+    }
+    cur = dfa_start_state(cache, context);
+    if (cur == DFA_UNKNOWN) {
+        dfa_clear(cache);
+        cur = dfa_start_state(cache, context);
+    }
+    for (p = start;; p++) {
+        int column;
+        int32_t entry;
+        if (p >= input_len) {
+            column = DFA_COLUMN_END;
+        } else if (p == input_len - 1 && input_str[p] == '\n') {
+            column = DFA_COLUMN_FINAL_NEWLINE;
+        } else {
+            column = (unsigned char)input_str[p];
+        }
+        entry = ((int32_t*)cache->transitions.data)
+            [cur * DFA_COLUMN_NUM + column];
+        if (entry == DFA_UNKNOWN) {
+            entry = dfa_compute(cache, cur, column);
+            if (entry == DFA_UNKNOWN) {
+                cur = dfa_restart(cache, cur);
+                if (cur == DFA_UNKNOWN) {
+                    return DFA_SCAN_FAILED;
+                }
+                entry = dfa_compute(cache, cur, column);
+            }
+        }
+        cache->bytes_since_clear++;
+        *pos = p;
+        /* the start state is empty and never accepts */
+        if (entry & 1) {
+            return DFA_SCAN_MATCH;
+        }
+        if (column == DFA_COLUMN_END) {
+            return DFA_SCAN_NONE;
+        }
+        cur = entry >> 1;
+        if (is_idle_stop
+            && ((dfa_state_t*)cache->states.data)[cur].set_size == 0) {
+            *pos = p + 1;
+            return DFA_SCAN_IDLE;
+        }
+    }
+}
+
+/* the sets of the states of a full dfa, and their hash table */
+typedef struct dfa_full_sets {
+    dynarr_t sets; /* type: uint32_t */
+    dynarr_t set_offsets; /* type: size_t, state_num + 1 */
+    dynarr_t is_accept; /* type: uint8_t */
+    int32_t* table;
+    size_t table_size; /* a power of two */
+} dfa_full_sets_t;
+
+/* return the state of the sorted set, adding it if it is new, or -1 if
+   there would be more than max_states */
+static int32_t
+dfa_full_add_state(
+    const epsnfa* nfa, dfa_full_sets_t* full, const size_t max_states,
+    const uint32_t* set, const size_t set_size
+)
+{
+    uint32_t h = hash_set(0, set, set_size) & (full->table_size - 1);
+    size_t i, begin;
+    uint8_t is_accept = 0;
+    int32_t id;
+    while (full->table[h] != -1) {
+        const size_t* offsets = full->set_offsets.data;
+        begin = offsets[full->table[h]];
+        if (offsets[full->table[h] + 1] - begin == set_size
+            && memcmp(
+                   at(&full->sets, begin), set, set_size * sizeof(uint32_t)
+               ) == 0) {
+            return full->table[h];
+        }
+        h = (h + 1) & (full->table_size - 1);
+    }
+    if (full->is_accept.size >= max_states) {
+        return -1;
+    }
+    id = full->is_accept.size;
+    for (i = 0; i < set_size; i++) {
+        append(&full->sets, &set[i]);
+        if (bitmask_contains(&nfa->is_finish, set[i])) {
+            is_accept = 1;
+        }
+    }
+    begin = full->sets.size;
+    append(&full->set_offsets, &begin);
+    append(&full->is_accept, &is_accept);
+    full->table[h] = id;
+    return id;
+}
+
+/* add the states reachable from the start set in next_set, and their
+   transitions to next. the states in starts are read with every state,
+   which keeps the empty set as a state. return 0 if there are too many */
+static int
+dfa_full_explore(
+    const epsnfa* nfa, dfa_full_sets_t* full, const size_t max_states,
+    const dynarr_t* starts, dynarr_t* next, dynarr_t* next_set,
+    size_t* stamps
+)
+{
+    unsigned char representatives[256];
+    size_t i, j, k, begin, end, generation = 0;
+    int32_t id, to;
+    int c;
+    for (c = 255; c >= 0; c--) {
+        representatives[nfa->byte_classes[c]] = c;
+    }
+    if (dfa_full_add_state(
+            nfa, full, max_states, next_set->data, next_set->size
+        ) == -1) {
+        return 0;
+    }
+    /* the states are added in order, so a new one is made later */
+    for (id = 0; (size_t)id < full->is_accept.size; id++) {
+        dynarr_resize(next, next->size + 256);
+        begin = *(size_t*)at(&full->set_offsets, id);
+        end = *(size_t*)at(&full->set_offsets, id + 1);
+        for (k = 0; k < nfa->class_num; k++) {
+            generation++;
+            next_set->size = 0;
+            for (i = begin; i < end + starts->size; i++) {
+                const uint32_t from = i < end
+                    ? *(uint32_t*)at(&full->sets, i)
+                    : *(uint32_t*)at(starts, i - end);
+                const uint32_t* row
+                    = epsnfa_jump_row(nfa, from, representatives[k]);
+                for (j = row[0]; j < row[1]; j++) {
+                    uint32_t target = nfa->jump_targets[j];
+                    if (stamps[target] != generation) {
+                        stamps[target] = generation;
+                        append(next_set, &target);
+                    }
+                }
+            }
+            if (next_set->size == 0 && starts->size == 0) {
+                continue;
+            }
+            qsort(
+                next_set->data, next_set->size, sizeof(uint32_t),
+                compare_uint32
+            );
+            to = dfa_full_add_state(
+                nfa, full, max_states, next_set->data, next_set->size
+            );
+            if (to == -1) {
+                return 0;
+            }
+            for (c = 0; c < 256; c++) {
+                if (nfa->byte_classes[c] == k) {
+                    *(uint32_t*)at(next, id * 256 + c) = to + 1;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+int
+dfa_full_build(
+    const epsnfa* nfa, const size_t max_states, const int is_unanchored,
+    dfa_full_t* dfa, arena_t* arena
+)
+{
+    arena_t tmp_arena = arena_new(arena ? &arena->allocator : NULL);
+    dfa_full_sets_t full = {
+        .sets = dynarr_new_in(&tmp_arena, sizeof(uint32_t)),
+        .set_offsets = dynarr_new_in(&tmp_arena, sizeof(size_t)),
+        .is_accept = dynarr_new_in(&tmp_arena, sizeof(uint8_t)),
+        .table = NULL,
+        .table_size = 1,
+    };
+    dynarr_t next = dynarr_new_in(&tmp_arena, sizeof(uint32_t));
+    dynarr_t next_set = dynarr_new_in(&tmp_arena, sizeof(uint32_t));
+    dynarr_t starts = dynarr_new_in(&tmp_arena, sizeof(uint32_t));
+    size_t* stamps;
+    size_t i, zero = 0;
+    int is_built;
+    if (nfa->class_num == 0 || nfa->anchor_offsets[nfa->state_num] > 0) {
+        arena_free(&tmp_arena);
+        return 0;
+    }
+    /* the table is at most half full */
+    while (full.table_size < 2 * max_states) {
+        full.table_size *= 2;
+    }
+    full.table = arena_alloc(&tmp_arena, full.table_size * sizeof(int32_t));
+    memset(full.table, 0xFF, full.table_size * sizeof(int32_t));
+    stamps = arena_alloc(&tmp_arena, nfa->state_num * sizeof(size_t));
+    memset(stamps, 0, nfa->state_num * sizeof(size_t));
+    append(&full.set_offsets, &zero);
+    for (i = 0; i < nfa->state_num; i++) {
+        if (bitmask_contains(&nfa->is_start, i)) {
+            uint32_t s = i;
+            append(&starts, &s);
+        }
+    }
+    is_built = starts.size > 0;
+    /* the unanchored dfa starts from the empty set, and the anchored one
+       from the start states without reading them again */
+    if (!is_unanchored) {
+        for (i = 0; i < starts.size; i++) {
+            append(&next_set, at(&starts, i));
+        }
+        starts.size = 0;
+    }
+    is_built = is_built
+        && dfa_full_explore(
+            nfa, &full, max_states, &starts, &next, &next_set, stamps
+        );
+    if (is_built) {
+        dfa->state_num = full.is_accept.size;
+        dfa->next = arena_alloc(arena, next.size * sizeof(uint32_t));
+        memcpy(dfa->next, next.data, next.size * sizeof(uint32_t));
+        dfa->is_accept = arena_alloc(arena, dfa->state_num);
+        memcpy(dfa->is_accept, full.is_accept.data, dfa->state_num);
+    }
+    arena_free(&tmp_arena);
+    return is_built;
+}
@@ -0,0 +1,319 @@
+#include "emit_c.h"
+#include "dfa.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the table values of a row are written this many to a line */
+#define EMIT_C_VALUES_PER_LINE 12
+
+int
+emit_c_is_name(const char* name)
+{
+    size_t i;
+    if (name == NULL || name[0] == '\0' || isdigit((unsigned char)name[0])) {
+        return 0;
+    }
+    for (i = 0; name[i] != '\0'; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* a letter or digit as itself, anything else in hex */
+static void
+write_case(FILE* out, const int c)
+{
+    if (isalnum(c)) {
+        fprintf(out, "    case '%c':\n", c);
+    } else {
+        fprintf(out, "    case 0x%02x:\n", c);
+    }
+}
+
+static void
+write_values(
+    FILE* out, const char* indent, const uint32_t* values,
+    const size_t value_num
+)
+{
+    size_t i;
+    for (i = 0; i < value_num; i++) {
+        if (i % EMIT_C_VALUES_PER_LINE == 0) {
+            fprintf(out, "%s", indent);
+        }
+        fprintf(out, "%u,", values[i]);
+        if (i % EMIT_C_VALUES_PER_LINE == EMIT_C_VALUES_PER_LINE - 1
+            || i + 1 == value_num) {
+            fprintf(out, "\n");
+        } else {
+            fprintf(out, " ");
+        }
+    }
+}
+
+/* one block of code and a label per state. the bytes that go to the
+   target that most of them go to are the default of the switch */
+static void
+write_switch_match(
+    FILE* out, const char* name, const dfa_full_t* dfa, arena_t* arena
+)
+{
+    unsigned char* is_target = arena_alloc(arena, dfa->state_num);
+    size_t counts[EMIT_C_MAX_SWITCH_STATES + 1];
+    size_t i, j;
+    uint32_t common;
+    int c;
+    for (i = 0; i < dfa->state_num * 256; i++) {
+        if (dfa->next[i] != 0) {
+            is_target[dfa->next[i] - 1] = 1;
+        }
+    }
+    fprintf(
+        out,
+        "size_t\n%s_match(const char* input, size_t len)\n{\n"
+        "    const unsigned char* p = (const unsigned char*)input;\n"
+        "    const unsigned char* end = p + len;\n"
+        "    size_t match_len = 0;\n",
+        name
+    );
+    for (i = 0; i < dfa->state_num; i++) {
+        const uint32_t* row = dfa->next + i * 256;
+        if (is_target[i]) {
+            fprintf(out, "s%lu:\n", i);
+        }
+        if (dfa->is_accept[i]) {
+            fprintf(
+                out, "    match_len = p - (const unsigned char*)input;\n"
+            );
+        }
+        memset(counts, 0, sizeof(counts));
+        for (c = 0; c < 256; c++) {
+            counts[row[c]]++;
+        }
+        common = 0;
+        for (j = 1; j <= dfa->state_num; j++) {
+            if (counts[j] > counts[common]) {
+                common = j;
+            }
+        }
+        if (counts[0] == 256) {
+            fprintf(out, "    return match_len;\n");
+            continue;
+        }
+        fprintf(
+            out, "    if (p == end) {\n        return match_len;\n    }\n"
+        );
+        if (counts[common] == 256) {
+            fprintf(out, "    p++;\n");
+        } else {
+            fprintf(out, "    switch (*p++) {\n");
+            for (j = 0; j <= dfa->state_num; j++) {
+                if (j == common || counts[j] == 0) {
+                    continue;
+                }
+                for (c = 0; c < 256; c++) {
+                    if (row[c] == j) {
+                        write_case(out, c);
+                    }
+                }
+                if (j == 0) {
+                    fprintf(out, "        return match_len;\n");
+                } else {
+                    fprintf(out, "        goto s%lu;\n", j - 1);
+                }
+            }
+            fprintf(out, "    default:\n");
+        }
+        fprintf(out, counts[common] == 256 ? "    " : "        ");
+        if (common == 0) {
+            fprintf(out, "return match_len;\n");
+        } else {
+            fprintf(out, "goto s%u;\n", common - 1);
+        }
+        if (counts[common] != 256) {
+            fprintf(out, "    }\n");
+        }
+    }
+    fprintf(out, "}\n\n");
+}
+
+/* a loop over the table of the next states */
+static void
+write_table_match(
+    FILE* out, const char* name, const dfa_full_t* dfa, arena_t* arena
+)
+{
+    uint32_t* is_accept
+        = arena_alloc(arena, dfa->state_num * sizeof(uint32_t));
+    size_t i;
+    fprintf(
+        out,
+        "/* the next state + 1 of each state and byte, or 0 */\n"
+        "static const unsigned short %s_next[%lu][256] = {\n", name,
+        dfa->state_num
+    );
+    for (i = 0; i < dfa->state_num; i++) {
+        fprintf(out, "    {\n");
+        write_values(out, "        ", dfa->next + i * 256, 256);
+        fprintf(out, "    },\n");
+    }
+    fprintf(
+        out, "};\n\nstatic const unsigned char %s_accept[%lu] = {\n", name,
+        dfa->state_num
+    );
+    for (i = 0; i < dfa->state_num; i++) {
+        is_accept[i] = dfa->is_accept[i];
+    }
+    write_values(out, "    ", is_accept, dfa->state_num);
+    fprintf(
+        out,
+        "};\n\n"
+        "size_t\n%s_match(const char* input, size_t len)\n{\n"
+        "    size_t pos, match_len = 0;\n"
+        "    unsigned state = 0;\n"
+        "    for (pos = 0; pos < len; pos++) {\n"
+        "        state = %s_next[state][(unsigned char)input[pos]];\n"
+        "        if (state == 0) {\n"
+        "            break;\n"
+        "        }\n"
+        "        state--;\n"
+        "        if (%s_accept[state]) {\n"
+        "            match_len = pos + 1;\n"
+        "        }\n"
+        "    }\n"
+        "    return match_len;\n"
+        "}\n\n",
+        name, name, name
+    );
+}
+
+/* the find function reads the input once with the table of the unanchored
+   dfa up to the first state that accepts. its state 0 is the empty set, so
+   no match starts before the last offset where it was in state 0, and the
+   first offset from there where a match starts is the leftmost */
+static void
+write_find(
+    FILE* out, const char* name, const dfa_full_t* dfa,
+    const dfa_full_t* scan_dfa, arena_t* arena
+)
+{
+    uint32_t* values
+        = arena_alloc(arena, scan_dfa->state_num * 256 * sizeof(uint32_t));
+    size_t i;
+    fprintf(
+        out,
+        "/* the bytes that a match can start with */\n"
+        "static const unsigned char %s_first_bytes[256] = {\n",
+        name
+    );
+    for (i = 0; i < 256; i++) {
+        values[i] = dfa->next[i] != 0;
+    }
+    write_values(out, "    ", values, 256);
+    fprintf(
+        out,
+        "};\n\n"
+        "/* the next state of each state and byte in the unanchored dfa */\n"
+        "static const unsigned short %s_scan_next[%lu][256] = {\n",
+        name, scan_dfa->state_num
+    );
+    for (i = 0; i < scan_dfa->state_num * 256; i++) {
+        values[i] = scan_dfa->next[i] - 1;
+    }
+    for (i = 0; i < scan_dfa->state_num; i++) {
+        fprintf(out, "    {\n");
+        write_values(out, "        ", values + i * 256, 256);
+        fprintf(out, "    },\n");
+    }
+    fprintf(
+        out, "};\n\nstatic const unsigned char %s_scan_accept[%lu] = {\n",
+        name, scan_dfa->state_num
+    );
+    for (i = 0; i < scan_dfa->state_num; i++) {
+        values[i] = scan_dfa->is_accept[i];
+    }
+    write_values(out, "    ", values, scan_dfa->state_num);
+    fprintf(
+        out,
+        "};\n\n"
+        "int\n%s_find(\n"
+        "    const char* input, size_t len, size_t start, size_t* offset,\n"
+        "    size_t* length\n"
+        ")\n{\n"
+        "    size_t pos, end, run_start = start, match_len;\n"
+        "    unsigned state = 0;\n"
+        "    for (end = start; end < len; end++) {\n"
+        "        if (state == 0) {\n"
+        "            run_start = end;\n"
+        "        }\n"
+        "        state = %s_scan_next[state][(unsigned char)input[end]];\n"
+        "        if (%s_scan_accept[state]) {\n"
+        "            break;\n"
+        "        }\n"
+        "    }\n"
+        "    if (end == len) {\n"
+        "        return 0;\n"
+        "    }\n"
+        "    /* the first match ends at end + 1 and starts at or after "
+        "run_start */\n"
+        "    for (pos = run_start; pos <= end; pos++) {\n"
+        "        if (!%s_first_bytes[(unsigned char)input[pos]]) {\n"
+        "            continue;\n"
+        "        }\n"
+        "        match_len = %s_match(input + pos, len - pos);\n"
+        "        if (match_len > 0) {\n"
+        "            *offset = pos;\n"
+        "            *length = match_len;\n"
+        "            return 1;\n"
+        "        }\n"
+        "    }\n"
+        "    return 0;\n"
+        "}\n",
+        name, name, name, name, name
+    );
+}
+
+int
+emit_c(FILE* out, const char* name, const epsnfa* nfa, arena_t* arena)
+{
+    arena_t tmp_arena = arena_new(arena ? &arena->allocator : NULL);
+    dfa_full_t dfa, scan_dfa;
+    if (!emit_c_is_name(name)
+        || !dfa_full_build(nfa, EMIT_C_MAX_STATES, 0, &dfa, &tmp_arena)
+        || !dfa_full_build(
+            nfa, EMIT_C_MAX_STATES, 1, &scan_dfa, &tmp_arena
+        )) {
+        arena_free(&tmp_arena);
+        return 0;
+    }
+    fprintf(
+        out,
+        "/* generated by nacre --emit-c, a dfa of %lu states and an "
+        "unanchored\n"
+        "   dfa of %lu states.\n\n"
+        "   %s_match returns the length of the longest non-empty match "
+        "that\n"
+        "   starts at input[0], or 0 if there is none. %s_find finds the\n"
+        "   leftmost-longest match in input[start:len], and returns 1 and "
+        "sets\n"
+        "   offset and length if there is one */\n\n"
+        "#include <stddef.h>\n\n"
+        "size_t %s_match(const char* input, size_t len);\n"
+        "int %s_find(\n"
+        "    const char* input, size_t len, size_t start, size_t* offset,\n"
+        "    size_t* length\n"
+        ");\n\n",
+        dfa.state_num, scan_dfa.state_num, name, name, name, name
+    );
+    if (dfa.state_num <= EMIT_C_MAX_SWITCH_STATES) {
+        write_switch_match(out, name, &dfa, &tmp_arena);
+    } else {
+        write_table_match(out, name, &dfa, &tmp_arena);
+    }
+    write_find(out, name, &dfa, &scan_dfa, &tmp_arena);
+    arena_free(&tmp_arena);
+    return 1;
+}
@@ -0,0 +1,308 @@
+#include "glushkov.h"
+#include "re_token.h"
+#include <stdio.h>
+#include <string.h>
+
+/* a set of positions is a tree of unions over single positions, so a union
+   costs O(1) and never copies the sets of the children */
+typedef struct position_set {
+    int position; /* -1 for a union */
+    int left;
+    int right;
+} position_set_t;
+
+#define EMPTY_SET (-1)
+
+/* the sets of one ast node, as indices into the set pool */
+typedef struct glushkov_node {
+    int nullable;
+    int first;
+    int last;
+} glushkov_node_t;
+
+typedef struct glushkov_edge {
+    size_t from_state;
+    size_t to_state;
+} glushkov_edge_t;
+
+static int
+position_single(dynarr_t* pool, int position)
+{
+    position_set_t set = { .position = position, .left = -1, .right = -1 };
+    append(pool, &set);
+    return pool->size - 1;
+}
+
+static int
+position_union(dynarr_t* pool, int a, int b)
+{
+    position_set_t set = { .position = -1, .left = a, .right = b };
+    if (a == EMPTY_SET) {
+        return b;
+    }
+    if (b == EMPTY_SET) {
+        return a;
+    }
+    append(pool, &set);
+    return pool->size - 1;
+}
+
+/* replace the content of out with the positions in set */
+static void
+position_list(const dynarr_t* pool, int set, dynarr_t* stack, dynarr_t* out)
+{
+    out->size = 0;
+    if (set == EMPTY_SET) {
+        return;
+    }
+    stack->size = 0;
+    append(stack, &set);
+    while (stack->size > 0) {
+        const position_set_t* node = at(pool, *(int*)back(stack));
+        pop(stack);
+        if (node->position != -1) {
+            append(out, &node->position);
+        } else {
+            append(stack, &node->right);
+            append(stack, &node->left);
+        }
+    }
+}
+
+/* every position in from can be followed by every position in to */
+static void
+add_follow(
+    dynarr_t* edges, const dynarr_t* pool, int from, int to, dynarr_t* stack,
+    dynarr_t* from_list, dynarr_t* to_list
+)
+{
+    size_t i, j;
+    if (from == EMPTY_SET || to == EMPTY_SET) {
+        return;
+    }
+    position_list(pool, from, stack, from_list);
+    position_list(pool, to, stack, to_list);
+    for (i = 0; i < from_list->size; i++) {
+        for (j = 0; j < to_list->size; j++) {
+            glushkov_edge_t e = {
+                .from_state = *(int*)at(from_list, i) + 1,
+                .to_state = *(int*)at(to_list, j) + 1,
+            };
+            append(edges, &e);
+        }
+    }
+}
+
+epsnfa
+re_ast_to_glushkov_nfa(
+    const re_ast_t* re_ast, const int flags, arena_t* arena, const int is_debug,
+    nacre_error_t* error
+)
+{
+    epsnfa result;
+    re_ast_t ast;
+    glushkov_node_t* nodes;
+    glushkov_node_t root;
+    unsigned char* is_dead;
+    matcher_t* position_matchers;
+    matcher_t* node_matchers;
+    int* first_equal;
+    dynarr_t edges, pool, stack, from_list, to_list;
+    dynarr_t char_class_pool = dynarr_new_in(arena, sizeof(char_class_t));
+    size_t *offsets, *fill, *last_from;
+    glushkov_edge_t* sorted;
+    size_t position_num = 0, state_num, transition_num = 0;
+    size_t i, j;
+    int k;
+    /* the sets only live until the result is made */
+    arena_t tmp_arena = arena_new(arena ? &arena->allocator : NULL);
+
+    if (re_ast->size == 0) {
+        result = epsnfa_new(1, 0, arena);
+        bitmask_add(&result.is_start, 0);
+        bitmask_add(&result.is_finish, 0);
+        result.char_class_pool = char_class_pool;
+        arena_free(&tmp_arena);
+        return result;
+    }
+
+    ast = re_ast_expand_dups(re_ast, &tmp_arena);
+    nodes = arena_alloc(&tmp_arena, ast.size * sizeof(glushkov_node_t));
+    is_dead = arena_alloc(&tmp_arena, ast.size * sizeof(unsigned char));
+    position_matchers = arena_alloc(&tmp_arena, ast.size * sizeof(matcher_t));
+    node_matchers = arena_alloc(&tmp_arena, ast.size * sizeof(matcher_t));
+    first_equal = re_ast_hash_cons(&ast, &tmp_arena);
+    edges = dynarr_new_in(&tmp_arena, sizeof(glushkov_edge_t));
+    pool = dynarr_new_in(&tmp_arena, sizeof(position_set_t));
+    stack = dynarr_new_in(&tmp_arena, sizeof(int));
+    from_list = dynarr_new_in(&tmp_arena, sizeof(int));
+    to_list = dynarr_new_in(&tmp_arena, sizeof(int));
+
+    /* nothing under "r{0}" can be matched, so it gets no position. a parent
+       is always after its children */
+    for (k = ast.size - 1; k >= 0; k--) {
+        if (is_dead[k]
+            || (ast.tokens[k].type == TYPE_DUP
+                && ast.tokens[k].payload.dup.max == 0)) {
+            if (ast.lefts[k] != -1) {
+                is_dead[ast.lefts[k]] = 1;
+            }
+            if (ast.rights[k] != -1) {
+                is_dead[ast.rights[k]] = 1;
+            }
+        }
+    }
+
+    /* the children are always done before their parent */
+    for (k = 0; k < ast.size; k++) {
+        re_token_t token = ast.tokens[k];
+        glushkov_node_t* node = &nodes[k];
+        glushkov_node_t *left = NULL, *right = NULL;
+        if (is_dead[k]) {
+            continue;
+        }
+        if (ast.lefts[k] != -1) {
+            left = &nodes[ast.lefts[k]];
+        }
+        if (ast.rights[k] != -1) {
+            right = &nodes[ast.rights[k]];
+        }
+        switch (token.type) {
+        case TYPE_BYTE:
+        case TYPE_WC:
+        case TYPE_CLASS:
+        case TYPE_ANCHOR: {
+            int position = position_num++;
+            /* the copies of an expanded repetition share their classes */
+            if (first_equal[k] != k && !is_dead[first_equal[k]]) {
+                node_matchers[k] = node_matchers[first_equal[k]];
+            } else {
+                node_matchers[k] = re_token_to_matcher(
+                    &token, flags, &char_class_pool, error
+                );
+            }
+            position_matchers[position] = node_matchers[k];
+            node->nullable = 0;
+            node->first = node->last = position_single(&pool, position);
+            break;
+        }
+        case TYPE_DUP:
+            /* only "r{0}" is left after the expansion */
+            node->nullable = 1;
+            node->first = node->last = EMPTY_SET;
+            break;
+        case TYPE_GROUP:
+            *node = *left;
+            break;
+        case TYPE_UOP:
+            *node = *left;
+            if (token.payload.op == OP_PLUS || token.payload.op == OP_STAR) {
+                add_follow(
+                    &edges, &pool, left->last, left->first, &stack,
+                    &from_list, &to_list
+                );
+            }
+            if (token.payload.op == OP_STAR || token.payload.op == OP_OPT) {
+                node->nullable = 1;
+            }
+            break;
+        case TYPE_BOP:
+            if (token.payload.op == OP_CONCAT) {
+                node->nullable = left->nullable && right->nullable;
+                node->first = left->nullable
+                    ? position_union(&pool, left->first, right->first)
+                    : left->first;
+                node->last = right->nullable
+                    ? position_union(&pool, left->last, right->last)
+                    : right->last;
+                add_follow(
+                    &edges, &pool, left->last, right->first, &stack,
+                    &from_list, &to_list
+                );
+            } else if (token.payload.op == OP_ALTER) {
+                node->nullable = left->nullable || right->nullable;
+                node->first = position_union(&pool, left->first, right->first);
+                node->last = position_union(&pool, left->last, right->last);
+            } else {
+                re_error_set(
+                    error, NACRE_ERROR_SYNTAX, "bad binary operator %d",
+                    token.payload.op
+                );
+            }
+            break;
+        default:
+            re_error_set(
+                error, NACRE_ERROR_SYNTAX, "bad token type %d", token.type
+            );
+        }
+        if (error->code != NACRE_OK) {
+            result = epsnfa_new(1, 0, arena);
+            result.char_class_pool = char_class_pool;
+            arena_free(&tmp_arena);
+            return result;
+        }
+    }
+    root = nodes[ast.root];
+    position_list(&pool, root.first, &stack, &to_list);
+    for (i = 0; i < to_list.size; i++) {
+        glushkov_edge_t e = {
+            .from_state = 0,
+            .to_state = *(int*)at(&to_list, i) + 1,
+        };
+        append(&edges, &e);
+    }
+
+    /* sort the edges by their from state, and drop the repeated ones that
+       nested stars make */
+    state_num = position_num + 1;
+    offsets = arena_alloc(&tmp_arena, (state_num + 1) * sizeof(size_t));
+    fill = arena_alloc(&tmp_arena, state_num * sizeof(size_t));
+    last_from = arena_alloc(&tmp_arena, state_num * sizeof(size_t));
+    sorted = arena_alloc(&tmp_arena, edges.size * sizeof(glushkov_edge_t));
+    for (i = 0; i < edges.size; i++) {
+        offsets[((glushkov_edge_t*)at(&edges, i))->from_state + 1]++;
+    }
+    for (i = 0; i < state_num; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    memcpy(fill, offsets, state_num * sizeof(size_t));
+    for (i = 0; i < edges.size; i++) {
+        glushkov_edge_t* e = at(&edges, i);
+        sorted[fill[e->from_state]++] = *e;
+    }
+    for (i = 0; i < state_num; i++) {
+        for (j = offsets[i]; j < offsets[i + 1]; j++) {
+            /* from state + 1 so that 0 means not seen */
+            if (last_from[sorted[j].to_state] != i + 1) {
+                last_from[sorted[j].to_state] = i + 1;
+                sorted[transition_num++] = sorted[j];
+            }
+        }
+    }
+
+    result = epsnfa_new(state_num, transition_num, arena);
+    for (i = 0; i < transition_num; i++) {
+        result.transition_offsets[sorted[i].from_state + 1]++;
+        result.transitions[i] = (transition_t) {
+            .matcher = position_matchers[sorted[i].to_state - 1],
+            .to_state = sorted[i].to_state,
+        };
+    }
+    for (i = 0; i < state_num; i++) {
+        result.transition_offsets[i + 1] += result.transition_offsets[i];
+    }
+    bitmask_add(&result.is_start, 0);
+    if (root.nullable) {
+        bitmask_add(&result.is_finish, 0);
+    }
+    position_list(&pool, root.last, &stack, &from_list);
+    for (i = 0; i < from_list.size; i++) {
+        bitmask_add(&result.is_finish, *(int*)at(&from_list, i) + 1);
+    }
+    result.char_class_pool = char_class_pool;
+    if (is_debug) {
+        epsnfa_print(&result);
+    }
+    arena_free(&tmp_arena);
+    return result;
+}
@@ -0,0 +1,450 @@
+#include "jit.h"
+#include "dfa.h"
+#include "dynarr.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* the code and its data are emitted into one buffer. a rel32 field is
+   patched once the label it points to has its offset */
+typedef struct emitter {
+    dynarr_t bytes; /* type: uint8_t */
+    dynarr_t labels; /* type: size_t, the offset of each label */
+    dynarr_t fixups; /* type: fixup_t */
+} emitter_t;
+
+typedef struct fixup {
+    size_t pos; /* the rel32 field, the last 4 bytes of its instruction */
+    size_t label;
+} fixup_t;
+
+static inline void
+emit(emitter_t* e, const uint8_t* bytes, const size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        append(&e->bytes, &bytes[i]);
+    }
+}
+
+#define EMIT(e, ...)                                                          \
+    do {                                                                      \
+        const uint8_t emit_bytes_[] = { __VA_ARGS__ };                        \
+        emit(e, emit_bytes_, sizeof(emit_bytes_));                            \
+    } while (0)
+
+static inline void
+emit_u32(emitter_t* e, const uint32_t x)
+{
+    EMIT(e, x & 0xFF, (x >> 8) & 0xFF, (x >> 16) & 0xFF, x >> 24);
+}
+
+/* a rel32 to label, relative to the end of the field */
+static inline void
+emit_rel32(emitter_t* e, const size_t label)
+{
+    fixup_t f = { .pos = e->bytes.size, .label = label };
+    append(&e->fixups, &f);
+    emit_u32(e, 0);
+}
+
+static inline size_t
+new_label(emitter_t* e)
+{
+    size_t unknown = SIZE_MAX;
+    append(&e->labels, &unknown);
+    return e->labels.size - 1;
+}
+
+static inline void
+bind_label(emitter_t* e, const size_t label)
+{
+    *(size_t*)at(&e->labels, label) = e->bytes.size;
+}
+
+static inline void
+align_to(emitter_t* e, const size_t alignment)
+{
+    while (e->bytes.size % alignment != 0) {
+        EMIT(e, 0xCC); /* int3 */
+    }
+}
+
+/* the ranges of the bytes c with next[c] == target, up to max_num. return
+   their number, or max_num + 1 if there are more */
+static int
+find_ranges(
+    const uint8_t* next, const uint8_t target, uint8_t* lows, uint8_t* highs,
+    const int max_num
+)
+{
+    int c = 0, end, num = 0;
+    while (c < 256) {
+        if (next[c] != target) {
+            c++;
+            continue;
+        }
+        for (end = c; end + 1 < 256 && next[end + 1] == target; end++)
+            ;
+        if (num == max_num) {
+            return max_num + 1;
+        }
+        lows[num] = c;
+        highs[num] = end;
+        num++;
+        c = end + 1;
+    }
+    return num;
+}
+
+/* the vectors of a range for the skip loop: the low byte, and the width */
+typedef struct skip_range {
+    size_t low_label;
+    size_t span_label;
+    uint8_t low;
+    uint8_t span;
+} skip_range_t;
+
+/* skip the bytes on which the state stays, 16 at a time while all of them
+   are. rdi is the position and rsi the end */
+static void
+emit_skip_loop(emitter_t* e, const skip_range_t* ranges, const int range_num)
+{
+    size_t loop = new_label(e), partial = new_label(e), done = new_label(e);
+    bind_label(e, loop);
+    EMIT(e, 0x48, 0x8D, 0x57, 0x10); /* lea rdx, [rdi + 16] */
+    EMIT(e, 0x48, 0x39, 0xF2); /* cmp rdx, rsi */
+    EMIT(e, 0x0F, 0x87); /* ja done */
+    emit_rel32(e, done);
+    EMIT(e, 0xF3, 0x0F, 0x6F, 0x07); /* movdqu xmm0, [rdi] */
+    /* the byte is in the range if min(byte - low, span) == byte - low */
+    EMIT(e, 0x66, 0x0F, 0x6F, 0xC8); /* movdqa xmm1, xmm0 */
+    EMIT(e, 0x66, 0x0F, 0xF8, 0x0D); /* psubb xmm1, [rip + low] */
+    emit_rel32(e, ranges[0].low_label);
+    EMIT(e, 0x66, 0x0F, 0x6F, 0xD1); /* movdqa xmm2, xmm1 */
+    EMIT(e, 0x66, 0x0F, 0xDA, 0x15); /* pminub xmm2, [rip + span] */
+    emit_rel32(e, ranges[0].span_label);
+    EMIT(e, 0x66, 0x0F, 0x74, 0xD1); /* pcmpeqb xmm2, xmm1 */
+    if (range_num == 2) {
+        EMIT(e, 0x66, 0x0F, 0x6F, 0xC8); /* movdqa xmm1, xmm0 */
+        EMIT(e, 0x66, 0x0F, 0xF8, 0x0D); /* psubb xmm1, [rip + low] */
+        emit_rel32(e, ranges[1].low_label);
+        EMIT(e, 0x66, 0x0F, 0x6F, 0xD9); /* movdqa xmm3, xmm1 */
+        EMIT(e, 0x66, 0x0F, 0xDA, 0x1D); /* pminub xmm3, [rip + span] */
+        emit_rel32(e, ranges[1].span_label);
+        EMIT(e, 0x66, 0x0F, 0x74, 0xD9); /* pcmpeqb xmm3, xmm1 */
+        EMIT(e, 0x66, 0x0F, 0xEB, 0xD3); /* por xmm2, xmm3 */
+    }
+    EMIT(e, 0x66, 0x0F, 0xD7, 0xD2); /* pmovmskb edx, xmm2 */
+    EMIT(e, 0x81, 0xFA, 0xFF, 0xFF, 0x00, 0x00); /* cmp edx, 0xFFFF */
+    EMIT(e, 0x0F, 0x85); /* jne partial */
+    emit_rel32(e, partial);
+    EMIT(e, 0x48, 0x83, 0xC7, 0x10); /* add rdi, 16 */
+    EMIT(e, 0xE9); /* jmp loop */
+    emit_rel32(e, loop);
+    bind_label(e, partial);
+    EMIT(e, 0xF7, 0xD2); /* not edx */
+    EMIT(e, 0x0F, 0xBC, 0xD2); /* bsf edx, edx */
+    EMIT(e, 0x48, 0x01, 0xD7); /* add rdi, rdx */
+    bind_label(e, done);
+}
+
+/* a state with at least this many bytes on which it stays skips them
+   with SSE2 */
+#define JIT_SKIP_MIN_BYTES 16
+
+/* return from the scan with the length from the start to rdi in rax and
+   result in edx */
+static void
+emit_scan_return(emitter_t* e, const size_t label, const enum DFA_SCAN result)
+{
+    bind_label(e, label);
+    EMIT(e, 0x48, 0x89, 0xF8); /* mov rax, rdi */
+    EMIT(e, 0x4C, 0x29, 0xC0); /* sub rax, r8 */
+    EMIT(e, 0xBA); /* mov edx, result */
+    emit_u32(e, result);
+    EMIT(e, 0xC3); /* ret */
+}
+
+/* emit a function, the match function or with is_scan the scan function.
+   rdi is the position, rsi the end, r8 the start and rax the end of the
+   longest match so far. next has 256 entries per state, the next state + 1
+   or 0. return 0 if there is no memory for the labels */
+static int
+emit_program(
+    emitter_t* e, const uint8_t* next, const uint8_t* is_accept,
+    const size_t state_num, const int is_scan, const int is_idle_stop
+)
+{
+    size_t* state_labels = malloc(state_num * sizeof(size_t));
+    size_t* table_labels = malloc(state_num * sizeof(size_t));
+    skip_range_t* skips = malloc(2 * state_num * sizeof(skip_range_t));
+    int* skip_nums = calloc(state_num, sizeof(int));
+    size_t done = new_label(e), jump_table = new_label(e);
+    size_t matched = new_label(e), idle = new_label(e);
+    uint8_t lows[JIT_MAX_COMPARES + 1], highs[JIT_MAX_COMPARES + 1];
+    size_t i, jump_table_pos;
+    int c, r, range_num, total, self_num;
+    if (state_labels == NULL || table_labels == NULL || skips == NULL
+        || skip_nums == NULL) {
+        free(state_labels);
+        free(table_labels);
+        free(skips);
+        free(skip_nums);
+        return 0;
+    }
+    for (i = 0; i < state_num; i++) {
+        state_labels[i] = new_label(e);
+        table_labels[i] = SIZE_MAX;
+    }
+
+    EMIT(e, 0x49, 0x89, 0xF8); /* mov r8, rdi */
+    EMIT(e, 0x48, 0x89, 0xF8); /* mov rax, rdi */
+    for (i = 0; i < state_num; i++) {
+        const uint8_t* row = next + i * 256;
+        bind_label(e, state_labels[i]);
+        /* the scan stops at the first match, and where state 0, the empty
+           set, is reached again */
+        if (is_scan && is_accept[i]) {
+            EMIT(e, 0xE9); /* jmp matched */
+            emit_rel32(e, matched);
+            continue;
+        }
+        if (is_scan && is_idle_stop && i == 0) {
+            EMIT(e, 0x4C, 0x39, 0xC7); /* cmp rdi, r8 */
+            EMIT(e, 0x0F, 0x87); /* ja idle */
+            emit_rel32(e, idle);
+        }
+        /* skip the bytes that stay on the state */
+        self_num = 0;
+        for (c = 0; c < 256; c++) {
+            self_num += row[c] == i + 1;
+        }
+        range_num = find_ranges(row, i + 1, lows, highs, 2);
+        if (self_num >= JIT_SKIP_MIN_BYTES && range_num <= 2) {
+            for (r = 0; r < range_num; r++) {
+                skips[2 * i + r] = (skip_range_t) {
+                    .low_label = new_label(e),
+                    .span_label = new_label(e),
+                    .low = lows[r],
+                    .span = highs[r] - lows[r],
+                };
+            }
+            skip_nums[i] = range_num;
+            emit_skip_loop(e, skips + 2 * i, range_num);
+        }
+        if (is_accept[i]) {
+            EMIT(e, 0x48, 0x89, 0xF8); /* mov rax, rdi */
+        }
+        EMIT(e, 0x48, 0x39, 0xF7); /* cmp rdi, rsi */
+        EMIT(e, 0x0F, 0x83); /* jae done */
+        emit_rel32(e, done);
+        EMIT(e, 0x0F, 0xB6, 0x0F); /* movzx ecx, byte [rdi] */
+        EMIT(e, 0x48, 0xFF, 0xC7); /* inc rdi */
+
+        /* count the ranges, the ones that stay on the state go first */
+        total = 0;
+        for (r = 0; r <= (int)state_num && total <= JIT_MAX_COMPARES; r++) {
+            if (r > 0) {
+                total += find_ranges(
+                    row, r, lows, highs, JIT_MAX_COMPARES - total
+                );
+            }
+        }
+        if (total <= JIT_MAX_COMPARES) {
+            int target = i + 1;
+            for (r = 0; r <= (int)state_num; r++) {
+                int k, num;
+                if (r > 0) {
+                    target = r == (int)i + 1 ? 0 : r;
+                }
+                if (target == 0) {
+                    continue;
+                }
+                num = find_ranges(row, target, lows, highs, JIT_MAX_COMPARES);
+                for (k = 0; k < num; k++) {
+                    if (lows[k] == highs[k]) {
+                        EMIT(e, 0x80, 0xF9, lows[k]); /* cmp cl, byte */
+                        EMIT(e, 0x0F, 0x84); /* je target */
+                    } else {
+                        /* lea edx, [rcx - low] */
+                        EMIT(e, 0x8D, 0x91);
+                        emit_u32(e, (uint32_t)-(int32_t)lows[k]);
+                        /* cmp edx, high - low */
+                        EMIT(e, 0x81, 0xFA);
+                        emit_u32(e, highs[k] - lows[k]);
+                        EMIT(e, 0x0F, 0x86); /* jbe target */
+                    }
+                    emit_rel32(e, state_labels[target - 1]);
+                }
+            }
+            EMIT(e, 0xE9); /* jmp done */
+            emit_rel32(e, done);
+        } else {
+            /* the byte picks the next state from the table of the state,
+               and the state its code from the jump table */
+            table_labels[i] = new_label(e);
+            EMIT(e, 0x48, 0x8D, 0x15); /* lea rdx, [rip + table] */
+            emit_rel32(e, table_labels[i]);
+            EMIT(e, 0x0F, 0xB6, 0x0C, 0x0A); /* movzx ecx, [rdx + rcx] */
+            EMIT(e, 0x48, 0x8D, 0x15); /* lea rdx, [rip + jump_table] */
+            emit_rel32(e, jump_table);
+            EMIT(e, 0x48, 0x63, 0x0C, 0x8A); /* movsxd rcx, [rdx + rcx*4] */
+            EMIT(e, 0x48, 0x01, 0xD1); /* add rcx, rdx */
+            EMIT(e, 0xFF, 0xE1); /* jmp rcx */
+        }
+    }
+    if (is_scan) {
+        emit_scan_return(e, done, DFA_SCAN_NONE);
+        emit_scan_return(e, matched, DFA_SCAN_MATCH);
+        emit_scan_return(e, idle, DFA_SCAN_IDLE);
+    } else {
+        bind_label(e, done);
+        EMIT(e, 0x4C, 0x29, 0xC0); /* sub rax, r8 */
+        EMIT(e, 0xC3); /* ret */
+    }
+
+    /* the data after the code */
+    align_to(e, 16);
+    for (i = 0; i < state_num; i++) {
+        for (r = 0; r < skip_nums[i]; r++) {
+            bind_label(e, skips[2 * i + r].low_label);
+            for (c = 0; c < 16; c++) {
+                EMIT(e, skips[2 * i + r].low);
+            }
+            bind_label(e, skips[2 * i + r].span_label);
+            for (c = 0; c < 16; c++) {
+                EMIT(e, skips[2 * i + r].span);
+            }
+        }
+    }
+    for (i = 0; i < state_num; i++) {
+        if (table_labels[i] != SIZE_MAX) {
+            bind_label(e, table_labels[i]);
+            emit(e, next + i * 256, 256);
+        }
+    }
+    /* entry 0 is the dead state, entry i + 1 is state i */
+    align_to(e, 4);
+    bind_label(e, jump_table);
+    jump_table_pos = e->bytes.size;
+    emit_u32(e, *(size_t*)at(&e->labels, done) - jump_table_pos);
+    for (i = 0; i < state_num; i++) {
+        emit_u32(e, *(size_t*)at(&e->labels, state_labels[i]) - jump_table_pos);
+    }
+    free(state_labels);
+    free(table_labels);
+    free(skips);
+    free(skip_nums);
+    return 1;
+}
+
+/* the states of dfa in a byte each */
+static uint8_t*
+byte_table(const dfa_full_t* dfa, arena_t* arena)
+{
+    uint8_t* next = arena_alloc(arena, dfa->state_num * 256);
+    size_t i;
+    for (i = 0; i < dfa->state_num * 256; i++) {
+        next[i] = dfa->next[i];
+    }
+    return next;
+}
+
+jit_program_t
+jit_compile(const epsnfa* nfa, const int is_idle_stop, arena_t* arena)
+{
+    jit_program_t program = {
+        .match = NULL,
+        .scan = NULL,
+        .memory = NULL,
+        .memory_size = 0,
+        .state_num = 0,
+        .scan_state_num = 0,
+        .code_size = 0,
+    };
+#if defined(__x86_64__) && defined(__SSE2__)
+    arena_t tmp_arena = arena_new(arena ? &arena->allocator : NULL);
+    dfa_full_t dfa, scan_dfa;
+    emitter_t e = {
+        .bytes = dynarr_new_in(&tmp_arena, sizeof(uint8_t)),
+        .labels = dynarr_new_in(&tmp_arena, sizeof(size_t)),
+        .fixups = dynarr_new_in(&tmp_arena, sizeof(fixup_t)),
+    };
+    const long page_size = sysconf(_SC_PAGESIZE);
+    size_t i, scan_offset = 0;
+    void* memory;
+    if (page_size <= 0
+        || !dfa_full_build(nfa, JIT_MAX_STATES, 0, &dfa, &tmp_arena)
+        || !dfa_full_build(nfa, JIT_MAX_STATES, 1, &scan_dfa, &tmp_arena)) {
+        arena_free(&tmp_arena);
+        return program;
+    }
+    /* the lazy dfa is used when the code cannot be made */
+    if (!emit_program(
+            &e, byte_table(&dfa, &tmp_arena), dfa.is_accept, dfa.state_num,
+            0, 0
+        )) {
+        arena_free(&tmp_arena);
+        return program;
+    }
+    align_to(&e, 16);
+    scan_offset = e.bytes.size;
+    if (!emit_program(
+            &e, byte_table(&scan_dfa, &tmp_arena), scan_dfa.is_accept,
+            scan_dfa.state_num, 1, is_idle_stop
+        )) {
+        arena_free(&tmp_arena);
+        return program;
+    }
+    for (i = 0; i < e.fixups.size; i++) {
+        const fixup_t* f = at(&e.fixups, i);
+        int32_t rel = *(size_t*)at(&e.labels, f->label) - (f->pos + 4);
+        memcpy(at(&e.bytes, f->pos), &rel, sizeof(int32_t));
+    }
+    /* the code is written, then made executable and read only */
+    program.memory_size = (e.bytes.size + page_size - 1) / page_size
+        * page_size;
+    memory = mmap(
+        NULL, program.memory_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if (memory == MAP_FAILED) {
+        arena_free(&tmp_arena);
+        program.memory_size = 0;
+        return program;
+    }
+    memcpy(memory, e.bytes.data, e.bytes.size);
+    if (mprotect(memory, program.memory_size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, program.memory_size);
+        arena_free(&tmp_arena);
+        program.memory_size = 0;
+        return program;
+    }
+    program.memory = memory;
+    program.match = (jit_match_fn)memory;
+    program.scan = (jit_scan_fn)((uint8_t*)memory + scan_offset);
+    program.state_num = dfa.state_num;
+    program.scan_state_num = scan_dfa.state_num;
+    program.code_size = e.bytes.size;
+    arena_free(&tmp_arena);
+#else
+    (void)nfa;
+    (void)is_idle_stop;
+    (void)arena;
+#endif
+    return program;
+}
+
+void
+jit_free(jit_program_t* self)
+{
+    if (self->memory != NULL) {
+        munmap(self->memory, self->memory_size);
+    }
+    self->memory = NULL;
+    self->match = NULL;
+    self->scan = NULL;
+}
@@ -1,9 +1,16 @@
-#include "nfa.h"
-#include "re_ast.h"
-#include "re_parser.h"
+#include "nacre.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #ifdef IS_DEBUG
@@ -12,35 +19,65 @@
 #define IS_DEBUG_FLAG 0
 #endif
 
-const size_t MAX_INPUT_BUF_SIZE = 128 * 1024 * 1024; // 128MB
+/* a stream is searched in windows of this size, and a match must end
+   STREAM_HOLD_SIZE before the end of a window that is not the last */
+const size_t STREAM_WINDOW_SIZE = 8 * 1024 * 1024; // 8MB
+const size_t STREAM_HOLD_SIZE = 1024 * 1024; // 1MB
+/* the reader thread reads ahead into two buffers of this size */
+const size_t STREAM_READ_SIZE = 4 * 1024 * 1024; // 4MB
 const size_t MAX_PRINT_BUFFER_SIZE = 1024;
 
 typedef struct match_flags {
     unsigned char global;
     unsigned char multiline;
+    unsigned char glushkov;
+    unsigned char jit;
+    unsigned char ignore_case;
+    unsigned char invert; /* print the lines without a match */
+    unsigned char whole_word;
+    unsigned char whole_line;
+    unsigned char utf8;
+    size_t before; /* the lines of context before each printed line */
+    size_t after;
+    unsigned char explain;
+    int only_group; /* print only this group of each match, -1 if unset */
 } match_flags_t;
 
-/* buffer the full input buffer */
+/* lines are selected and printed whole, instead of the matches */
+static inline int
+is_line_mode(const match_flags_t mflag)
+{
+    return mflag.invert || mflag.before > 0 || mflag.after > 0;
+}
+
+typedef struct match {
+    size_t offset;
+    size_t length;
+    size_t line;
+    size_t col;
+} match_t;
+
+/* print the lines of the match with "^"s under its bytes. line_start is
+   where the line of the match starts in buffer, so the line is not looked
+   for again */
 void
-print_match(const char* buffer, const match_t match)
+print_match(
+    const char* buffer, const size_t buffer_len, size_t line_start,
+    const match_t match
+)
 {
     int is_match_started = 0;
     size_t print_match_count = 0;
-    size_t line_start = 0, line_end = 0, i = 0;
+    size_t line_end = 0, i = 0;
     printf("%lu, %lu (%lu)\n", match.line, match.col, match.length);
 
-    /* find the start of the line containing the match */
-    line_start = match.offset;
-    while (line_start > 0 && buffer[line_start - 1] != '\n') {
-        line_start--;
-    }
     line_end = line_start;
 
-    while (buffer[line_end] && print_match_count < match.length) {
+    while (line_end < buffer_len && print_match_count < match.length) {
         /* print the line that contains the match */
-        while (buffer[line_end] != '\0' && buffer[line_end] != '\n') {
-            line_end++;
-        }
+        const char* nl
+            = memchr(buffer + line_end, '\n', buffer_len - line_end);
+        line_end = nl ? (size_t)(nl - buffer) : buffer_len;
         if (line_end > line_start) {
             fwrite(buffer + line_start, 1, line_end - line_start, stdout);
         }
@@ -48,7 +85,7 @@ print_match(const char* buffer, const match_t match)
         /* print the "^"s that mark the match */
         i = 0;
         if (is_match_started == 0) {
-            for (; i < match.col - 1; i++) { /* col -1 cause it starts from 1 */
+            for (; i < match.offset - line_start; i++) {
                 printf(" ");
             }
             is_match_started = 1;
@@ -69,24 +106,632 @@ print_match(const char* buffer, const match_t match)
     }
 }
 
+/* print the bytes of a group like "grep -o", a group that takes no part in
+   the match prints nothing */
+void
+print_group(const char* buffer, const nacre_match_t group)
+{
+    if (group.offset == NACRE_NO_GROUP) {
+        return;
+    }
+    fwrite(buffer + group.offset, 1, group.length, stdout);
+    printf("\n");
+}
+
+/* how far the search has gone, so that it goes on in the next window of a
+   stream. the offsets are from the start of the input, a window holds the
+   input from base */
+typedef struct search_state {
+    size_t base;
+    size_t next; /* everything before it is searched */
+    size_t line_num; /* the line at next, from 1 */
+    size_t line_start; /* the start of that line */
+    int is_done; /* the first match is printed and no more are wanted */
+    int is_failed; /* out of memory, the search is given up */
+    int is_skipping_line; /* the rest of the line of a match is skipped */
+    /* only for print_lines */
+    size_t printed; /* everything before it is printed or skipped */
+    int has_gap; /* lines before printed were skipped, not printed */
+    size_t after_left; /* the lines of context still to print */
+    int has_printed;
+} search_state_t;
+
+static const search_state_t SEARCH_STATE_INIT = {
+    .line_num = 1,
+};
+
+/* advance the line counter from input[from] to input[to] */
+static inline void
+count_lines(
+    const char* input, size_t from, const size_t to, search_state_t* state
+)
+{
+    const char* nl;
+    while (from < to && (nl = memchr(input + from, '\n', to - from))) {
+        from = nl - input + 1;
+        state->line_start = state->base + from;
+        state->line_num++;
+    }
+}
+
+/* find and print the leftmost-longest matches in one scan of the input. in
+   multiline mode without global, only the first match of each line is
+   printed. only the matches that end by limit are printed, the others are
+   left for the next window */
+void
+print_all_matches(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t limit, const match_flags_t mflag,
+    search_state_t* state
+)
+{
+    const size_t base = state->base;
+    size_t next = state->next - base, line_start;
+    nacre_match_t m;
+    nacre_match_t* groups = NULL;
+    const char* nl;
+    if (state->is_skipping_line) {
+        nl = memchr(input + next, '\n', limit - next);
+        state->is_skipping_line = nl == NULL;
+        next = nl ? (size_t)(nl - input) + 1 : limit;
+        count_lines(input, state->next - base, next, state);
+    }
+    if (mflag.only_group > 0) {
+        groups = malloc((nacre_group_count(regex) + 1) * sizeof(nacre_match_t));
+        if (groups == NULL) {
+            fprintf(stderr, "Error: out of memory.\n");
+            state->is_done = state->is_failed = 1;
+            return;
+        }
+    }
+    while (!state->is_done && !state->is_skipping_line) {
+        int is_found = groups != NULL
+            ? nacre_find_groups(regex, scratch, input, input_len, next, groups)
+            : nacre_find(regex, scratch, input, input_len, next, &m);
+        if (is_found && groups != NULL) {
+            m = groups[0];
+        }
+        if (!is_found || (m.offset + m.length > limit && limit < input_len)) {
+            /* a match that goes past limit may get longer in the next
+               window, and the ones that start before limit without ending
+               in this window are longer than it can hold */
+            size_t resume = is_found && m.offset < limit ? m.offset : limit;
+            if (resume > next) {
+                count_lines(input, next, resume, state);
+                next = resume;
+            }
+            break;
+        }
+        count_lines(input, next, m.offset, state);
+        if (groups != NULL) {
+            print_group(input, groups[mflag.only_group]);
+        } else if (mflag.only_group == 0) {
+            print_group(input, m);
+        } else {
+            /* the start of a line longer than a window may be gone */
+            line_start = state->line_start > base ? state->line_start - base
+                                                  : 0;
+            print_match(
+                input, input_len, line_start,
+                (match_t) {
+                    .offset = m.offset,
+                    .length = m.length,
+                    .line = state->line_num,
+                    .col = base + m.offset - state->line_start + 1,
+                }
+            );
+        }
+        next = m.offset + m.length;
+        if (!mflag.global) {
+            if (!mflag.multiline) {
+                state->is_done = 1;
+                break;
+            }
+            /* resume at the next line unless the match already went past */
+            nl = memchr(input + m.offset, '\n', limit - m.offset);
+            if (nl == NULL) {
+                state->is_skipping_line = 1;
+            } else if ((size_t)(nl - input) + 1 > next) {
+                next = (size_t)(nl - input) + 1;
+            }
+        }
+        count_lines(input, m.offset, next, state);
+    }
+    state->next = base + next;
+    free(groups);
+}
+
+/* the ranges of whole lines to print, one after another. without invert
+   a range is a line with a match, with invert it is all the lines between
+   two lines with a match. the regex is compiled for lines, so a match
+   never goes past the end of its line */
+typedef struct line_ranges {
+    const nacre_regex_t* regex;
+    nacre_scratch_t* scratch;
+    const char* input;
+    size_t input_len;
+    int invert;
+    size_t next; /* a line start, everything before it is done */
+} line_ranges_t;
+
+/* the end of the line at pos, after its newline */
+static inline size_t
+line_end_of(const char* input, const size_t input_len, const size_t pos)
+{
+    const char* nl = memchr(input + pos, '\n', input_len - pos);
+    return nl ? (size_t)(nl - input) + 1 : input_len;
+}
+
+/* the start of the line at pos, which is not before the line start from */
+static inline size_t
+line_start_of(const char* input, const size_t from, size_t pos)
+{
+    while (pos > from && input[pos - 1] != '\n') {
+        pos--;
+    }
+    return pos;
+}
+
+/* set [start, end) to the next range, return 0 if there is none */
+static int
+next_line_range(line_ranges_t* self, size_t* start, size_t* end)
+{
+    nacre_match_t m;
+    while (self->next < self->input_len) {
+        if (!nacre_find(
+                self->regex, self->scratch, self->input, self->input_len,
+                self->next, &m
+            )) {
+            if (!self->invert) {
+                break;
+            }
+            *start = self->next;
+            *end = self->next = self->input_len;
+            return 1;
+        }
+        *start = line_start_of(self->input, self->next, m.offset);
+        *end = line_end_of(self->input, self->input_len, m.offset);
+        if (!self->invert) {
+            self->next = *end;
+            return 1;
+        }
+        if (*start > self->next) {
+            /* the lines before the matching one */
+            *end = *start;
+            *start = self->next;
+            self->next = line_end_of(self->input, self->input_len, *end);
+            return 1;
+        }
+        self->next = *end;
+    }
+    self->next = self->input_len;
+    return 0;
+}
+
+/* write input[from:to], which is whole lines */
+static inline void
+write_lines(
+    const char* input, const size_t input_len, const size_t from,
+    const size_t to
+)
+{
+    fwrite(input + from, 1, to - from, stdout);
+    if (to == input_len && to > from && input[to - 1] != '\n') {
+        printf("\n");
+    }
+}
+
+/* print the lines with a match, or without one with invert, like grep.
+   before and after lines around them are printed once, and "--" goes
+   between the groups of lines that do not touch if there is any context.
+   the line starts are only looked for near the lines that are printed, and
+   every range is written straight from the input. input[0:input_len] is
+   whole lines, a line is only unfinished at the end of the input */
+void
+print_lines(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const match_flags_t mflag, search_state_t* state
+)
+{
+    const size_t base = state->base;
+    line_ranges_t ranges = {
+        .regex = regex,
+        .scratch = scratch,
+        .input = input,
+        .input_len = input_len,
+        .invert = mflag.invert,
+        .next = state->next - base,
+    };
+    const int has_context = mflag.before > 0 || mflag.after > 0;
+    size_t start, end, printed = state->printed - base, from, k;
+    while (next_line_range(&ranges, &start, &end)) {
+        /* the lines after the last range, up to this one */
+        from = printed;
+        while (state->after_left > 0 && printed < start) {
+            printed = line_end_of(input, input_len, printed);
+            state->after_left--;
+        }
+        write_lines(input, input_len, from, printed);
+        /* the lines before this range that are not printed yet */
+        from = start;
+        for (k = 0; k < mflag.before && from > printed; k++) {
+            from = line_start_of(input, printed, from - 1);
+        }
+        if (has_context && state->has_printed
+            && (from > printed || state->has_gap)) {
+            printf("--\n");
+        }
+        write_lines(input, input_len, from, end);
+        printed = end;
+        state->after_left = mflag.after;
+        state->has_printed = 1;
+        state->has_gap = 0;
+    }
+    /* the lines after the last range, as far as this window goes */
+    from = printed;
+    while (state->after_left > 0 && printed < input_len) {
+        printed = line_end_of(input, input_len, printed);
+        state->after_left--;
+    }
+    write_lines(input, input_len, from, printed);
+    state->next = base + ranges.next;
+    state->printed = base + printed;
+}
+
+/* search input[0:input_len], which starts at state->base of the whole
+   input. the matches that end by limit are printed, and the ones after it
+   are left for the next window. the lines are only searched up to limit,
+   which is a line start if it is not input_len */
+void
+search_window(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t limit, const match_flags_t mflag,
+    search_state_t* state
+)
+{
+    if (is_line_mode(mflag)) {
+        print_lines(regex, scratch, input, limit, mflag, state);
+    } else {
+        print_all_matches(
+            regex, scratch, input, input_len, limit, mflag, state
+        );
+    }
+}
+
+/* the offset from which the next window must keep the input: the line of
+   the next match to print it, or the lines of the before context, and one
+   byte before next for the anchors. a line that takes half of the window
+   is not kept */
+static size_t
+window_keep(
+    const search_state_t* state, const char* window, const match_flags_t mflag
+)
+{
+    size_t keep = state->next, k;
+    if (is_line_mode(mflag)) {
+        for (k = 0; k < mflag.before && keep > state->base; k++) {
+            keep = state->base
+                + line_start_of(window, 0, keep - state->base - 1);
+        }
+    } else if (state->line_start < keep) {
+        keep = state->line_start > state->base ? state->line_start
+                                               : state->base;
+    }
+    if (state->next - keep > STREAM_WINDOW_SIZE / 2) {
+        keep = state->next;
+    }
+    if (keep == state->next && keep > state->base) {
+        keep--;
+    }
+    return keep;
+}
+
+/* where the matches of a window that is not the end of the input must end.
+   the lines are searched up to the last line start, and a match in the
+   other modes must end STREAM_HOLD_SIZE before the end of the window */
+static size_t
+window_limit(
+    const char* window, const size_t window_len, const match_flags_t mflag
+)
+{
+    size_t limit = window_len;
+    if (is_line_mode(mflag)) {
+        while (limit > 0 && window[limit - 1] != '\n') {
+            limit--;
+        }
+        return limit;
+    }
+    return window_len > STREAM_HOLD_SIZE ? window_len - STREAM_HOLD_SIZE : 0;
+}
+
+/* a reader thread that fills one of two buffers of STREAM_READ_SIZE bytes
+   while the bytes of the other are searched, so reading and matching
+   overlap */
+typedef struct read_ahead {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char* buffers[2];
+    size_t lens[2];
+    int is_full[2]; /* filled by the reader and not all taken yet */
+    int is_last[2]; /* the input ends after the buffer */
+    int error; /* the errno of a failed read, after the last buffer */
+    int is_stopped; /* the reader is not needed anymore */
+    /* only for the searching thread */
+    int current; /* the buffer that is taken from */
+    size_t taken; /* the bytes of it already taken */
+} read_ahead_t;
+
+static void*
+read_ahead_run(void* arg)
+{
+    read_ahead_t* self = arg;
+    ssize_t bytes_read;
+    size_t len;
+    int i = 0, is_last = 0, error = 0;
+    /* the reader is only cancelled in read, never with the lock held */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    while (!is_last) {
+        pthread_mutex_lock(&self->lock);
+        while (self->is_full[i] && !self->is_stopped) {
+            pthread_cond_wait(&self->cond, &self->lock);
+        }
+        if (self->is_stopped) {
+            pthread_mutex_unlock(&self->lock);
+            break;
+        }
+        pthread_mutex_unlock(&self->lock);
+        /* the buffer is the reader's own until it is marked full */
+        len = 0;
+        while (len < STREAM_READ_SIZE && !is_last) {
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            bytes_read = read(
+                self->fd, self->buffers[i] + len, STREAM_READ_SIZE - len
+            );
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+            if (bytes_read < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes_read <= 0) {
+                is_last = 1;
+                error = bytes_read < 0 ? errno : 0;
+            } else {
+                len += bytes_read;
+            }
+        }
+        pthread_mutex_lock(&self->lock);
+        self->lens[i] = len;
+        self->is_last[i] = is_last;
+        self->error = error;
+        self->is_full[i] = 1;
+        pthread_cond_broadcast(&self->cond);
+        pthread_mutex_unlock(&self->lock);
+        i = !i;
+    }
+    return NULL;
+}
+
+/* start the reader, return 0 if it cannot be started */
+static int
+read_ahead_start(read_ahead_t* self, const int fd)
+{
+    memset(self, 0, sizeof(read_ahead_t));
+    self->fd = fd;
+    self->buffers[0] = malloc(STREAM_READ_SIZE);
+    self->buffers[1] = malloc(STREAM_READ_SIZE);
+    if (!self->buffers[0] || !self->buffers[1]) {
+        free(self->buffers[0]);
+        free(self->buffers[1]);
+        return 0;
+    }
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    if (pthread_create(&self->thread, NULL, read_ahead_run, self) != 0) {
+        pthread_mutex_destroy(&self->lock);
+        pthread_cond_destroy(&self->cond);
+        free(self->buffers[0]);
+        free(self->buffers[1]);
+        return 0;
+    }
+    return 1;
+}
+
+/* copy up to size bytes of the input to dst, waiting for the reader if
+   nothing is read yet. return the bytes copied, 0 at the end of the input,
+   or -1 with errno set if a read failed */
+static ssize_t
+read_ahead_take(read_ahead_t* self, char* dst, const size_t size)
+{
+    const int i = self->current;
+    size_t n;
+    int is_last, error;
+    pthread_mutex_lock(&self->lock);
+    while (!self->is_full[i]) {
+        pthread_cond_wait(&self->cond, &self->lock);
+    }
+    is_last = self->is_last[i];
+    error = self->error;
+    pthread_mutex_unlock(&self->lock);
+    n = self->lens[i] - self->taken;
+    if (n > size) {
+        n = size;
+    }
+    memcpy(dst, self->buffers[i] + self->taken, n);
+    self->taken += n;
+    if (self->taken == self->lens[i] && !is_last) {
+        /* give the buffer back to the reader */
+        pthread_mutex_lock(&self->lock);
+        self->is_full[i] = 0;
+        pthread_cond_broadcast(&self->cond);
+        pthread_mutex_unlock(&self->lock);
+        self->current = !i;
+        self->taken = 0;
+    }
+    if (n == 0 && error != 0) {
+        errno = error;
+        return -1;
+    }
+    return n;
+}
+
+/* stop the reader, which may be waiting in read for a pipe that never
+   ends */
+static void
+read_ahead_stop(read_ahead_t* self)
+{
+    pthread_mutex_lock(&self->lock);
+    self->is_stopped = 1;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+    pthread_cancel(self->thread);
+    pthread_join(self->thread, NULL);
+    pthread_mutex_destroy(&self->lock);
+    pthread_cond_destroy(&self->cond);
+    free(self->buffers[0]);
+    free(self->buffers[1]);
+}
+
+/* search a stream, like a pipe, in a window of STREAM_WINDOW_SIZE bytes
+   that is filled with large reads. after each window, the part of it that
+   the search still needs is moved to the front, so the memory does not
+   grow with the stream and the matches and line numbers are the same as
+   for a mapped file. only a match longer than STREAM_HOLD_SIZE, or a line
+   longer than the window, can be cut where a window ends. the reads are
+   done ahead by a reader thread while the window is searched */
+int
+search_stream(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const int fd,
+    const match_flags_t mflag
+)
+{
+    char* window = malloc(STREAM_WINDOW_SIZE);
+    search_state_t state = SEARCH_STATE_INIT;
+    read_ahead_t read_ahead;
+    size_t window_len = 0, keep;
+    ssize_t bytes_read;
+    int is_eof = 0, exit_code = 0;
+    if (!window || !read_ahead_start(&read_ahead, fd)) {
+        perror("Error allocating memory for buffer");
+        free(window);
+        return 1;
+    }
+    while (!state.is_done) {
+        while (!is_eof && window_len < STREAM_WINDOW_SIZE) {
+            bytes_read = read_ahead_take(
+                &read_ahead, window + window_len,
+                STREAM_WINDOW_SIZE - window_len
+            );
+            if (bytes_read < 0) {
+                perror("Error reading input");
+                exit_code = 1;
+                break;
+            }
+            is_eof = bytes_read == 0;
+            window_len += bytes_read;
+        }
+        if (exit_code != 0) {
+            break;
+        }
+        if (is_eof) {
+            search_window(
+                regex, scratch, window, window_len, window_len, mflag, &state
+            );
+            break;
+        }
+        search_window(
+            regex, scratch, window, window_len,
+            window_limit(window, window_len, mflag), mflag, &state
+        );
+        keep = window_keep(&state, window, mflag);
+        if (keep - state.base < STREAM_HOLD_SIZE) {
+            /* what the search needs does not fit, so it is cut here */
+            search_window(
+                regex, scratch, window, window_len, window_len, mflag, &state
+            );
+            keep = state.next;
+        }
+        if (state.printed < keep) {
+            state.printed = keep;
+            state.has_gap = 1;
+        }
+        window_len -= keep - state.base;
+        memmove(window, window + (keep - state.base), window_len);
+        state.base = keep;
+    }
+    read_ahead_stop(&read_ahead);
+    free(window);
+    return state.is_failed ? 1 : exit_code;
+}
+
+/* a regular file is mapped and searched as one window, the output is
+   written from the mapping. anything else is streamed */
+static int
+search_file(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const int fd,
+    const match_flags_t mflag
+)
+{
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        char* mapped
+            = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            search_state_t state = SEARCH_STATE_INIT;
+            madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+            search_window(
+                regex, scratch, mapped, st.st_size, st.st_size, mflag, &state
+            );
+            munmap(mapped, st.st_size);
+            return state.is_failed;
+        }
+    }
+    return search_stream(regex, scratch, fd, mflag);
+}
+
+/* the number of an option, in decimal digits only like grep takes it.
+   return 0 if str is anything else or is more than max */
+static int
+parse_count(const char* str, const unsigned long max, unsigned long* count)
+{
+    char* end;
+    if (!isdigit((unsigned char)str[0])) {
+        return 0;
+    }
+    errno = 0;
+    *count = strtoul(str, &end, 10);
+    return errno == 0 && *end == '\0' && *count <= max;
+}
+
 int
 main(int argc, char* argv[])
 {
 
     match_flags_t mflag;
-    const char* regex = NULL;
+    const char* regex_str = NULL;
     const char* input_file = NULL;
-    const char* opt_def = "gmi";
-    const char* usage = "Usage: %s [OPTION] PATTERN INPUT_FILE\n";
+    const char* emit_name = NULL;
+    const char* opt_def = "gmivxwuA:B:C:o::";
+    const struct option long_opts[] = {
+        { "glushkov", no_argument, NULL, 'G' },
+        { "explain", no_argument, NULL, 'E' },
+        { "jit", no_argument, NULL, 'J' },
+        { "emit-c", required_argument, NULL, 'e' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char* usage = "Usage: %s [OPTION] PATTERN [INPUT_FILE]\n";
+    unsigned long count;
     int c;
     extern int optind, optopt;
 
-    re_ast_t ast;
-    epsnfa nfa;
-    FILE* file;
+    nacre_error_t error;
+    nacre_regex_t* regex;
+    nacre_scratch_t* scratch;
+    int fd, exit_code = 0;
 
     memset(&mflag, 0, sizeof(match_flags_t));
-    while ((c = getopt(argc, argv, opt_def)) != -1) {
+    mflag.only_group = -1;
+    while ((c = getopt_long(argc, argv, opt_def, long_opts, NULL)) != -1) {
         switch (c) {
         case 'g':
             mflag.global = 1;
@@ -94,6 +739,63 @@ main(int argc, char* argv[])
         case 'm':
             mflag.multiline = 1;
             break;
+        case 'i':
+            mflag.ignore_case = 1;
+            break;
+        case 'v':
+            mflag.invert = 1;
+            break;
+        case 'x':
+            mflag.whole_line = 1;
+            break;
+        case 'w':
+            mflag.whole_word = 1;
+            break;
+        case 'u':
+            mflag.utf8 = 1;
+            break;
+        case 'A':
+        case 'B':
+        case 'C':
+            if (!parse_count(optarg, SIZE_MAX, &count)) {
+                fprintf(
+                    stderr, "Error: invalid context length \"%s\".\n", optarg
+                );
+                fprintf(stderr, usage, argv[0]);
+                return 1;
+            }
+            if (c != 'B') {
+                mflag.after = count;
+            }
+            if (c != 'A') {
+                mflag.before = count;
+            }
+            break;
+        case 'G':
+            mflag.glushkov = 1;
+            break;
+        case 'E':
+            mflag.explain = 1;
+            break;
+        case 'J':
+            mflag.jit = 1;
+            break;
+        case 'e':
+            emit_name = optarg;
+            break;
+        case 'o':
+            if (optarg == NULL) {
+                mflag.only_group = 0;
+            } else if (parse_count(optarg, INT_MAX, &count)) {
+                mflag.only_group = count;
+            } else {
+                fprintf(
+                    stderr, "Error: invalid group number \"%s\".\n", optarg
+                );
+                fprintf(stderr, usage, argv[0]);
+                return 1;
+            }
+            break;
         case '?':
             if (isprint(optopt)) {
                 fprintf(stderr, "Bad argument %c\n", (char)optopt);
@@ -107,58 +809,88 @@ main(int argc, char* argv[])
         }
     }
     if (argc - optind == 2) {
-        regex = argv[optind];
+        regex_str = argv[optind];
         input_file = argv[optind + 1];
+    } else if (argc - optind == 1) {
+        regex_str = argv[optind];
     } else {
         fprintf(stderr, usage, argv[0]);
+        return 1;
     }
 
-    // parse the regex into an AST
-    ast = parse_regex(regex, IS_DEBUG_FLAG);
-    if (ast.size == 0) {
-        fprintf(stderr, "Error: Failed to parse regex.\n");
+    // parse the regex and compile it into an reduced epsilon-NFA
+    regex = nacre_compile_with_error(
+        regex_str,
+        (mflag.multiline ? NACRE_MULTILINE : 0)
+            | (mflag.glushkov ? NACRE_GLUSHKOV : 0)
+            | (mflag.jit ? NACRE_JIT : 0)
+            | (mflag.ignore_case ? NACRE_IGNORE_CASE : 0)
+            | (mflag.whole_word ? NACRE_WHOLE_WORD : 0)
+            | (mflag.whole_line ? NACRE_WHOLE_LINE : 0)
+            | (mflag.utf8 ? NACRE_UTF8 : 0)
+            /* lines are selected as if they were matched one by one */
+            | (is_line_mode(mflag) ? NACRE_MULTILINE | NACRE_SINGLE_LINE : 0)
+            | (IS_DEBUG_FLAG ? NACRE_DEBUG : 0),
+        NULL, &error
+    );
+    if (regex == NULL) {
+        fprintf(stderr, "Error: %s.\n", error.message);
         return 1;
     }
-
-    // convert AST to an reduced epsilon-NFA
-    nfa = re_ast_to_nfa(&ast, IS_DEBUG_FLAG);
-
-    // ppen the input file
-    file = fopen(input_file, "r");
-    if (!file) {
-        perror("Error opening file");
+    if (mflag.only_group > nacre_group_count(regex)) {
+        fprintf(
+            stderr, "Error: the pattern has only %d group(s).\n",
+            nacre_group_count(regex)
+        );
+        nacre_free(regex);
+        return 1;
+    }
+    if (mflag.explain) {
+        nacre_explain(regex);
+    }
+    /* the dfa is written as C instead of searching */
+    if (emit_name != NULL) {
+        if (!nacre_emit_c(regex, emit_name, stdout)) {
+            fprintf(
+                stderr,
+                "Error: cannot emit C for \"%s\": the name must be a C "
+                "identifier, and the pattern must have no anchors and a dfa "
+                "of at most 4096 states.\n",
+                emit_name
+            );
+            exit_code = 1;
+        }
+        nacre_free(regex);
+        return exit_code;
+    }
+    scratch = nacre_scratch_new();
+    if (scratch == NULL) {
+        fprintf(stderr, "Error: out of memory.\n");
+        nacre_free(regex);
         return 1;
     }
 
-    /* read the file into a buffer with a size limit and find matches */
-    {
-        char* buffer = malloc(MAX_INPUT_BUF_SIZE + 1);
-        size_t i, bytes_read;
-        dynarr_t matches;
-        if (!buffer) {
-            perror("Error allocating memory for buffer");
-            fclose(file);
-            return 1;
+    /* the input is stdin without a file or with "-" */
+    if (input_file == NULL || strcmp(input_file, "-") == 0) {
+        fd = STDIN_FILENO;
+    } else {
+        fd = open(input_file, O_RDONLY);
+    }
+    if (fd < 0) {
+        perror("Error opening file");
+        exit_code = 1;
+    } else {
+        exit_code = search_file(regex, scratch, fd, mflag);
+        if (fd != STDIN_FILENO) {
+            close(fd);
         }
-        buffer[MAX_INPUT_BUF_SIZE] = '\0';
-        while ((bytes_read = fread(buffer, 1, MAX_INPUT_BUF_SIZE, file)) > 0) {
-            buffer[bytes_read] = '\0';
-            if (mflag.multiline) {
-                matches
-                    = epsnfa_find_matches_multiline(&nfa, buffer, mflag.global);
-            } else {
-                matches = epsnfa_find_matches(&nfa, buffer, mflag.global);
-            }
-            /* print all matches */
-            for (i = 0; i < matches.size; i++) {
-                print_match(buffer, *(match_t*)at(&matches, i));
-            }
-            dynarr_free(&matches);
+        /* the library finds nothing more once its scratch cannot grow */
+        if (nacre_scratch_error(scratch) != NACRE_OK) {
+            fprintf(stderr, "Error: out of memory.\n");
+            exit_code = 1;
         }
-        free(buffer);
     }
-    fclose(file);
-    epsnfa_clear(&nfa);
-    re_ast_free(&ast);
-    return 0;
+    nacre_scratch_free(scratch);
+    nacre_free(regex);
+    return exit_code;
 }
\ No newline at end of file
@@ -0,0 +1,555 @@
+#include "minimize.h"
+#include <string.h>
+
+/* the refinement gives up, and keeps every state, after it has made this
+   many signature entries per state and bit of the state count */
+#define MINIMIZE_WORK_PER_STATE 16
+
+/* the states are kept as they are if they have more transitions than this
+   on average. chains of optionals have quadratically many, and every split
+   of such a chain would dirty most of its states again */
+#define MINIMIZE_MAX_DEGREE 8
+
+#define NO_STATE ((size_t)-1)
+
+static inline int
+is_dense(const size_t state_num, const size_t transition_num)
+{
+    return transition_num > MINIMIZE_MAX_DEGREE * state_num;
+}
+
+/* the transitions of every state in one direction */
+typedef struct adjacency {
+    size_t* offsets; /* size: state_num + 1 */
+    transition_t* transitions;
+} adjacency_t;
+
+/* one entry of a signature, a matcher and the block that it leads to */
+typedef struct signature_pair {
+    uint64_t label;
+    size_t block;
+} signature_pair_t;
+
+/* a dirty state with its signature, pool[begin:begin + size] */
+typedef struct signed_entry {
+    uint64_t hash;
+    size_t state;
+    size_t begin;
+    size_t size;
+    size_t group;
+} signed_entry_t;
+
+/* the dirty states of one block with one signature */
+typedef struct group {
+    size_t leader; /* the first entry of the group */
+    size_t size;
+    size_t block;
+} group_t;
+
+/* a state that goes to another block at the end of the round */
+typedef struct move {
+    size_t state;
+    size_t block;
+} move_t;
+
+typedef struct labeled_edge {
+    size_t from;
+    uint64_t label;
+    size_t to;
+} labeled_edge_t;
+
+static inline uint64_t
+label_of(const matcher_t m)
+{
+    return ((uint64_t)m.flag << 32) | m.payload;
+}
+
+static inline matcher_t
+matcher_of(const uint64_t label)
+{
+    return (matcher_t) { .flag = label >> 32, .payload = (uint32_t)label };
+}
+
+static int
+compare_pair(const void* a, const void* b)
+{
+    const signature_pair_t *x = a, *y = b;
+    if (x->label != y->label) {
+        return x->label < y->label ? -1 : 1;
+    }
+    return (x->block > y->block) - (x->block < y->block);
+}
+
+static int
+compare_edge(const void* a, const void* b)
+{
+    const labeled_edge_t *x = a, *y = b;
+    if (x->from != y->from) {
+        return x->from < y->from ? -1 : 1;
+    }
+    if (x->label != y->label) {
+        return x->label < y->label ? -1 : 1;
+    }
+    return (x->to > y->to) - (x->to < y->to);
+}
+
+static adjacency_t
+forward_adjacency(const epsnfa* nfa)
+{
+    return (adjacency_t) {
+        .offsets = nfa->transition_offsets,
+        .transitions = nfa->transitions,
+    };
+}
+
+/* the incoming transitions of every state, with to_state as their source */
+static adjacency_t
+backward_adjacency(const epsnfa* nfa, arena_t* arena)
+{
+    adjacency_t adj = {
+        .offsets = arena_alloc(arena, (nfa->state_num + 1) * sizeof(size_t)),
+        .transitions
+        = arena_alloc(arena, nfa->transition_num * sizeof(transition_t) + 1),
+    };
+    size_t* fill = arena_alloc(arena, nfa->state_num * sizeof(size_t));
+    size_t i, j;
+    for (i = 0; i < nfa->transition_num; i++) {
+        adj.offsets[nfa->transitions[i].to_state + 1]++;
+    }
+    for (i = 0; i < nfa->state_num; i++) {
+        adj.offsets[i + 1] += adj.offsets[i];
+    }
+    memcpy(fill, adj.offsets, nfa->state_num * sizeof(size_t));
+    for (i = 0; i < nfa->state_num; i++) {
+        for (j = nfa->transition_offsets[i];
+             j < nfa->transition_offsets[i + 1]; j++) {
+            const transition_t* t = &nfa->transitions[j];
+            adj.transitions[fill[t->to_state]++] = (transition_t) {
+                .matcher = t->matcher,
+                .to_state = i,
+            };
+        }
+    }
+    return adj;
+}
+
+/* append the sorted (label, block) pairs of s without repeats to pool, and
+   return the entry with their hash */
+static signed_entry_t
+make_signature(
+    const adjacency_t* out, const size_t* block, const size_t s, dynarr_t* pool
+)
+{
+    signed_entry_t entry = {
+        .hash = 14695981039346656037u,
+        .state = s,
+        .begin = pool->size,
+    };
+    signature_pair_t* pairs;
+    size_t i, n = 0;
+    for (i = out->offsets[s]; i < out->offsets[s + 1]; i++) {
+        signature_pair_t pair = {
+            .label = label_of(out->transitions[i].matcher),
+            .block = block[out->transitions[i].to_state],
+        };
+        append(pool, &pair);
+    }
+    pairs = (signature_pair_t*)pool->data + entry.begin;
+    entry.size = pool->size - entry.begin;
+    if (entry.size > 1) {
+        qsort(pairs, entry.size, sizeof(signature_pair_t), compare_pair);
+    }
+    for (i = 0; i < entry.size; i++) {
+        if (n > 0 && compare_pair(&pairs[n - 1], &pairs[i]) == 0) {
+            continue;
+        }
+        pairs[n++] = pairs[i];
+        entry.hash = (entry.hash ^ pairs[i].label) * 1099511628211u;
+        entry.hash = (entry.hash ^ pairs[i].block) * 1099511628211u;
+    }
+    entry.size = n;
+    pool->size = entry.begin + n;
+    return entry;
+}
+
+static int
+is_same_signature(
+    const dynarr_t* pool, const signed_entry_t* a, const signed_entry_t* b
+)
+{
+    const signature_pair_t* pairs = pool->data;
+    return a->size == b->size
+        && memcmp(
+               pairs + a->begin, pairs + b->begin,
+               a->size * sizeof(signature_pair_t)
+           ) == 0;
+}
+
+/* put s at the front of the member list of block b */
+static inline void
+link_state(
+    size_t* first, size_t* next, size_t* prev, const size_t b, const size_t s
+)
+{
+    prev[s] = NO_STATE;
+    next[s] = first[b];
+    if (first[b] != NO_STATE) {
+        prev[first[b]] = s;
+    }
+    first[b] = s;
+}
+
+static inline void
+unlink_state(
+    size_t* first, size_t* next, size_t* prev, const size_t b, const size_t s
+)
+{
+    if (prev[s] != NO_STATE) {
+        next[prev[s]] = next[s];
+    } else {
+        first[b] = next[s];
+    }
+    if (next[s] != NO_STATE) {
+        prev[next[s]] = prev[s];
+    }
+}
+
+/* put the entries with the same signature in one group, in the order of
+   their first entry. table is an open addressing hash table of groups */
+static void
+find_groups(
+    const dynarr_t* pool, signed_entry_t* entries, const size_t entry_num,
+    dynarr_t* groups, dynarr_t* table
+)
+{
+    size_t table_size = 1, i, h;
+    size_t* slots;
+    group_t* gs;
+    while (table_size < 2 * entry_num) {
+        table_size *= 2;
+    }
+    dynarr_resize(table, table_size);
+    slots = table->data;
+    for (i = 0; i < table_size; i++) {
+        slots[i] = NO_STATE;
+    }
+    groups->size = 0;
+    for (i = 0; i < entry_num; i++) {
+        for (h = entries[i].hash & (table_size - 1); slots[h] != NO_STATE;
+             h = (h + 1) & (table_size - 1)) {
+            gs = groups->data;
+            if (is_same_signature(
+                    pool, &entries[i], &entries[gs[slots[h]].leader]
+                )) {
+                break;
+            }
+        }
+        if (slots[h] == NO_STATE) {
+            group_t g = { .leader = i, .size = 0 };
+            slots[h] = groups->size;
+            append(groups, &g);
+        }
+        gs = groups->data;
+        entries[i].group = slots[h];
+        gs[slots[h]].size++;
+    }
+}
+
+/* put s in the dirty list of block b, once a round */
+static inline void
+mark_dirty(
+    size_t* dirty_round, size_t* dirty_first, size_t* dirty_next,
+    dynarr_t* dirty_blocks, const size_t b, const size_t s, const size_t round
+)
+{
+    if (dirty_round[s] == round) {
+        return;
+    }
+    dirty_round[s] = round;
+    if (dirty_first[b] == NO_STATE) {
+        append(dirty_blocks, &b);
+    }
+    dirty_next[s] = dirty_first[b];
+    dirty_first[b] = s;
+}
+
+/* refine the partition by finality until every block is stable, and return
+   the block of every state, or NULL if the nfa is too dense or it takes
+   too long.
+
+   a round recomputes the signatures of the dirty states only, against the
+   partition at the start of the round. the other members of a block still
+   share one signature, so a dirty state stays if it has the signature of a
+   clean member and otherwise moves to a new block with the states of its
+   signature. the predecessors of the moved states are dirty next round */
+static size_t*
+bisimulation(
+    const size_t state_num, const adjacency_t* out, const adjacency_t* in,
+    const bitmask_t* is_final, size_t* block_num, arena_t* arena
+)
+{
+    size_t* block = arena_alloc(arena, state_num * sizeof(size_t));
+    size_t* first = arena_alloc(arena, state_num * sizeof(size_t));
+    size_t* next = arena_alloc(arena, state_num * sizeof(size_t));
+    size_t* prev = arena_alloc(arena, state_num * sizeof(size_t));
+    size_t* dirty_round = arena_alloc(arena, state_num * sizeof(size_t));
+    /* the dirty states of every block, and the blocks that have some */
+    size_t* dirty_first = arena_alloc(arena, state_num * sizeof(size_t));
+    size_t* dirty_next = arena_alloc(arena, state_num * sizeof(size_t));
+    dynarr_t dirty_blocks = dynarr_new_in(arena, sizeof(size_t));
+    dynarr_t entries = dynarr_new_in(arena, sizeof(signed_entry_t));
+    dynarr_t groups = dynarr_new_in(arena, sizeof(group_t));
+    dynarr_t table = dynarr_new_in(arena, sizeof(size_t));
+    dynarr_t moves = dynarr_new_in(arena, sizeof(move_t));
+    dynarr_t pool = dynarr_new_in(arena, sizeof(signature_pair_t));
+    size_t budget = MINIMIZE_WORK_PER_STATE * state_num;
+    size_t work = 0, round = 1, s, i, j, k;
+    int has_final = 0, has_other = 0;
+
+    if (is_dense(state_num, out->offsets[state_num])) {
+        return NULL;
+    }
+    for (s = state_num; s > 0; s >>= 1) {
+        budget += MINIMIZE_WORK_PER_STATE * state_num;
+    }
+    for (s = 0; s < state_num; s++) {
+        if (bitmask_contains(is_final, s)) {
+            has_final = 1;
+        } else {
+            has_other = 1;
+        }
+    }
+    *block_num = has_final + has_other;
+    for (s = 0; s < state_num; s++) {
+        first[s] = NO_STATE;
+        dirty_first[s] = NO_STATE;
+    }
+    for (s = 0; s < state_num; s++) {
+        block[s] = (has_other && bitmask_contains(is_final, s)) ? 1 : 0;
+        link_state(first, next, prev, block[s], s);
+        mark_dirty(
+            dirty_round, dirty_first, dirty_next, &dirty_blocks, block[s], s,
+            round
+        );
+    }
+
+    while (dirty_blocks.size > 0) {
+        moves.size = 0;
+        for (i = 0; i < dirty_blocks.size; i++) {
+            const size_t b = *(size_t*)at(&dirty_blocks, i);
+            size_t rep = NO_STATE, stay = NO_STATE, stay_size = 0;
+            signed_entry_t rep_sig = { 0 }, *es;
+            group_t* gs;
+            for (s = first[b]; s != NO_STATE; s = next[s]) {
+                if (dirty_round[s] != round) {
+                    rep = s;
+                    break;
+                }
+            }
+            pool.size = 0;
+            if (rep != NO_STATE) {
+                rep_sig = make_signature(out, block, rep, &pool);
+                work += rep_sig.size + 1;
+            }
+            entries.size = 0;
+            for (s = dirty_first[b]; s != NO_STATE; s = dirty_next[s]) {
+                signed_entry_t e = make_signature(out, block, s, &pool);
+                work += e.size + 1;
+                append(&entries, &e);
+            }
+            dirty_first[b] = NO_STATE;
+            if (work > budget) {
+                return NULL;
+            }
+            es = entries.data;
+            find_groups(&pool, es, entries.size, &groups, &table);
+            gs = groups.data;
+
+            /* the group of the clean members stays, or else the largest
+               group, so that fewer predecessors get dirty */
+            for (j = 0; j < groups.size; j++) {
+                if (rep != NO_STATE
+                        ? is_same_signature(&pool, &es[gs[j].leader], &rep_sig)
+                        : gs[j].size > stay_size) {
+                    stay = j;
+                    stay_size = gs[j].size;
+                }
+            }
+            for (j = 0; j < groups.size; j++) {
+                gs[j].block = j == stay ? b : (*block_num)++;
+            }
+            for (k = 0; k < entries.size; k++) {
+                if (es[k].group != stay) {
+                    move_t m = {
+                        .state = es[k].state,
+                        .block = gs[es[k].group].block,
+                    };
+                    append(&moves, &m);
+                }
+            }
+        }
+
+        /* apply the moves after the round, then dirty their predecessors */
+        round++;
+        dirty_blocks.size = 0;
+        for (i = 0; i < moves.size; i++) {
+            const move_t* m = at(&moves, i);
+            unlink_state(first, next, prev, block[m->state], m->state);
+            block[m->state] = m->block;
+            link_state(first, next, prev, m->block, m->state);
+        }
+        for (i = 0; i < moves.size; i++) {
+            const move_t* m = at(&moves, i);
+            for (k = in->offsets[m->state]; k < in->offsets[m->state + 1];
+                 k++) {
+                const size_t p = in->transitions[k].to_state;
+                mark_dirty(
+                    dirty_round, dirty_first, dirty_next, &dirty_blocks,
+                    block[p], p, round
+                );
+            }
+        }
+    }
+    return block;
+}
+
+/* the nfa with one state per block */
+static epsnfa
+quotient(
+    const epsnfa* nfa, const size_t* block, const size_t block_num,
+    arena_t* output_arena, arena_t* tmp_arena
+)
+{
+    epsnfa output;
+    labeled_edge_t* edges = arena_alloc(
+        tmp_arena, nfa->transition_num * sizeof(labeled_edge_t) + 1
+    );
+    size_t i, j, edge_num = 0;
+    for (i = 0; i < nfa->state_num; i++) {
+        for (j = nfa->transition_offsets[i];
+             j < nfa->transition_offsets[i + 1]; j++) {
+            edges[edge_num++] = (labeled_edge_t) {
+                .from = block[i],
+                .label = label_of(nfa->transitions[j].matcher),
+                .to = block[nfa->transitions[j].to_state],
+            };
+        }
+    }
+    qsort(edges, edge_num, sizeof(labeled_edge_t), compare_edge);
+    for (i = 0, j = 0; i < edge_num; i++) {
+        if (j == 0 || compare_edge(&edges[j - 1], &edges[i]) != 0) {
+            edges[j++] = edges[i];
+        }
+    }
+    edge_num = j;
+
+    output = epsnfa_new(block_num, edge_num, output_arena);
+    for (i = 0; i < edge_num; i++) {
+        output.transition_offsets[edges[i].from + 1]++;
+        output.transitions[i] = (transition_t) {
+            .matcher = matcher_of(edges[i].label),
+            .to_state = edges[i].to,
+        };
+    }
+    for (i = 0; i < block_num; i++) {
+        output.transition_offsets[i + 1] += output.transition_offsets[i];
+    }
+    for (i = 0; i < nfa->state_num; i++) {
+        if (bitmask_contains(&nfa->is_start, i)) {
+            bitmask_add(&output.is_start, block[i]);
+        }
+        if (bitmask_contains(&nfa->is_finish, i)) {
+            bitmask_add(&output.is_finish, block[i]);
+        }
+    }
+    output.char_class_pool
+        = dynarr_new_in(output_arena, sizeof(char_class_t));
+    for (i = 0; i < nfa->char_class_pool.size; i++) {
+        append(&output.char_class_pool, at(&nfa->char_class_pool, i));
+    }
+    return output;
+}
+
+/* the nfa as it is, in output_arena */
+static epsnfa
+copy(const epsnfa* nfa, arena_t* output_arena)
+{
+    epsnfa output
+        = epsnfa_new(nfa->state_num, nfa->transition_num, output_arena);
+    size_t i;
+    memcpy(
+        output.transition_offsets, nfa->transition_offsets,
+        (nfa->state_num + 1) * sizeof(size_t)
+    );
+    memcpy(
+        output.transitions, nfa->transitions,
+        nfa->transition_num * sizeof(transition_t)
+    );
+    for (i = 0; i < nfa->state_num; i++) {
+        if (bitmask_contains(&nfa->is_start, i)) {
+            bitmask_add(&output.is_start, i);
+        }
+        if (bitmask_contains(&nfa->is_finish, i)) {
+            bitmask_add(&output.is_finish, i);
+        }
+    }
+    output.char_class_pool
+        = dynarr_new_in(output_arena, sizeof(char_class_t));
+    for (i = 0; i < nfa->char_class_pool.size; i++) {
+        append(&output.char_class_pool, at(&nfa->char_class_pool, i));
+    }
+    return output;
+}
+
+/* every state in its own block */
+static size_t*
+identity_blocks(const size_t state_num, arena_t* arena)
+{
+    size_t* block = arena_alloc(arena, state_num * sizeof(size_t));
+    size_t s;
+    for (s = 0; s < state_num; s++) {
+        block[s] = s;
+    }
+    return block;
+}
+
+epsnfa
+epsnfa_minimize(const epsnfa* input, arena_t* output_arena)
+{
+    arena_t tmp_arena
+        = arena_new(output_arena ? &output_arena->allocator : NULL);
+    adjacency_t out, in;
+    epsnfa forward, result;
+    size_t* block;
+    size_t block_num;
+
+    if (is_dense(input->state_num, input->transition_num)) {
+        arena_free(&tmp_arena);
+        return copy(input, output_arena);
+    }
+    out = forward_adjacency(input);
+    in = backward_adjacency(input, &tmp_arena);
+    block = bisimulation(
+        input->state_num, &out, &in, &input->is_finish, &block_num, &tmp_arena
+    );
+    if (block == NULL) {
+        block = identity_blocks(input->state_num, &tmp_arena);
+        block_num = input->state_num;
+    }
+    forward = quotient(input, block, block_num, &tmp_arena, &tmp_arena);
+
+    /* backward bisimulation is forward bisimulation of the reversed nfa */
+    out = backward_adjacency(&forward, &tmp_arena);
+    in = forward_adjacency(&forward);
+    block = bisimulation(
+        forward.state_num, &out, &in, &forward.is_start, &block_num,
+        &tmp_arena
+    );
+    if (block == NULL) {
+        block = identity_blocks(forward.state_num, &tmp_arena);
+        block_num = forward.state_num;
+    }
+    result = quotient(&forward, block, block_num, output_arena, &tmp_arena);
+    arena_free(&tmp_arena);
+    return result;
+}
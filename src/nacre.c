@@ -0,0 +1,673 @@
+#include "nacre.h"
+#include "arena.h"
+#include "dfa.h"
+#include "emit_c.h"
+#include "nfa.h"
+#include "planner.h"
+#include "re_ast.h"
+#include "re_parser.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* every compiled regex gets its own serial, so a scratch can tell whether
+   its dfa cache was made for the regex it is given */
+static size_t regex_serial = 0;
+
+/* the regex itself and everything it owns are in its arena, whose blocks
+   are all tracked by its guard */
+struct nacre_regex {
+    arena_guard_t* guard;
+    arena_t arena;
+    int flags;
+    size_t serial;
+    epsnfa nfa;
+    capnfa cap; /* only made if there are groups */
+    plan_t plan;
+};
+
+/* the scratch itself and its buffers are in its arena. a match function
+   sets the fail jump of its guard while it can grow the buffers */
+struct nacre_scratch {
+    arena_guard_t* guard;
+    int error;
+    arena_t arena;
+    nfa_memory_t nfa_memory;
+    size_t dfa_serial; /* the regex of the dfa caches, 0 if none yet */
+    dfa_cache_t dfa;
+    dfa_cache_t search_dfa; /* unanchored, finds where a match ends */
+    pike_memory_t pike;
+    dynarr_t slots; /* type: size_t */
+};
+
+nacre_regex_t*
+nacre_compile(const char* pattern, const int flags)
+{
+    return nacre_compile_with_error(pattern, flags, NULL, NULL);
+}
+
+nacre_regex_t*
+nacre_compile_with_allocator(
+    const char* pattern, const int flags, const nacre_allocator_t* allocator
+)
+{
+    return nacre_compile_with_error(pattern, flags, allocator, NULL);
+}
+
+/* compile with every block taken through guard. return NULL and give error
+   its error if the pattern is empty or malformed */
+static nacre_regex_t*
+compile(
+    const char* pattern, const int flags, arena_guard_t* guard,
+    nacre_error_t* error
+)
+{
+    const nacre_allocator_t hooks = arena_guard_hooks(guard);
+    const int is_debug = (flags & NACRE_DEBUG) != 0;
+    const int re_flags
+        = ((flags & (NACRE_MULTILINE | NACRE_WHOLE_LINE)) ? RE_FLAG_MULTILINE
+                                                         : 0)
+        | ((flags & NACRE_IGNORE_CASE) ? RE_FLAG_IGNORE_CASE : 0)
+        | ((flags & (NACRE_SINGLE_LINE | NACRE_WHOLE_LINE))
+               ? RE_FLAG_SINGLE_LINE
+               : 0)
+        | ((flags & NACRE_UTF8) ? RE_FLAG_UTF8 : 0);
+    nacre_regex_t* regex;
+    arena_t regex_arena, ast_arena = arena_new(&hooks);
+    re_ast_t ast
+        = parse_regex(pattern, re_flags, &ast_arena, is_debug, error);
+    re_ast_t simple_ast;
+    if (ast.size == 0) {
+        re_error_set(error, NACRE_ERROR_EMPTY, "the pattern is empty");
+        return NULL;
+    }
+    /* the whole word and whole line modes are anchors around the pattern,
+       so the engines find them like any other match */
+    if (flags & NACRE_WHOLE_WORD) {
+        ast = re_ast_wrap_anchors(
+            &ast, ANCHOR_NOT_WORD_BEHIND, ANCHOR_NOT_WORD_AHEAD, &ast_arena
+        );
+    }
+    if (flags & NACRE_WHOLE_LINE) {
+        ast = re_ast_wrap_anchors(
+            &ast, ANCHOR_LINE_START, ANCHOR_LINE_END, &ast_arena
+        );
+    }
+    regex_arena = arena_new(&hooks);
+    regex = arena_alloc(&regex_arena, sizeof(nacre_regex_t));
+    regex->guard = guard;
+    regex->arena = regex_arena;
+    regex->flags = flags;
+    regex->serial = __atomic_add_fetch(&regex_serial, 1, __ATOMIC_RELAXED);
+    /* the automata and the plan are made from the simplified ast, only the
+       capnfa needs the groups */
+    simple_ast = re_ast_simplify(&ast, &ast_arena);
+    regex->nfa = re_ast_to_nfa(
+        &simple_ast,
+        re_flags | ((flags & NACRE_GLUSHKOV) ? RE_FLAG_GLUSHKOV : 0),
+        &regex->arena, is_debug, error
+    );
+    if (ast.group_num > 0 && error->code == NACRE_OK) {
+        regex->cap = re_ast_to_capnfa(&ast, re_flags, &regex->arena, error);
+    }
+    if (error->code != NACRE_OK) {
+        return NULL;
+    }
+    regex->plan = plan_new(
+        &simple_ast, &regex->nfa,
+        re_flags | ((flags & NACRE_JIT) ? RE_FLAG_JIT : 0), &regex->arena
+    );
+    arena_free(&ast_arena);
+    return regex;
+}
+
+/* running out of memory anywhere in the compile jumps back here, and the
+   guard gives back every block that was taken */
+static nacre_regex_t*
+compile_guarded(
+    const char* pattern, const int flags, arena_guard_t* guard,
+    nacre_error_t* error
+)
+{
+    jmp_buf fail;
+    if (setjmp(fail) != 0) {
+        re_error_set(error, NACRE_ERROR_NO_MEMORY, "out of memory");
+        return NULL;
+    }
+    guard->fail = &fail;
+    return compile(pattern, flags, guard, error);
+}
+
+nacre_regex_t*
+nacre_compile_with_error(
+    const char* pattern, const int flags, const nacre_allocator_t* allocator,
+    nacre_error_t* error
+)
+{
+    nacre_error_t ignored;
+    arena_guard_t* guard = arena_guard_new(allocator);
+    nacre_regex_t* regex;
+    if (error == NULL) {
+        error = &ignored;
+    }
+    error->code = NACRE_OK;
+    error->message[0] = '\0';
+    if (guard == NULL) {
+        re_error_set(error, NACRE_ERROR_NO_MEMORY, "out of memory");
+        return NULL;
+    }
+    regex = compile_guarded(pattern, flags, guard, error);
+    guard->fail = NULL;
+    if (regex == NULL) {
+        arena_guard_free(guard);
+    }
+    return regex;
+}
+
+void
+nacre_free(nacre_regex_t* regex)
+{
+    if (regex == NULL) {
+        return;
+    }
+    plan_free(&regex->plan);
+    /* the regex itself is in one of the blocks */
+    arena_guard_free(regex->guard);
+}
+
+nacre_scratch_t*
+nacre_scratch_new(void)
+{
+    return nacre_scratch_new_with_allocator(NULL);
+}
+
+nacre_scratch_t*
+nacre_scratch_new_with_allocator(const nacre_allocator_t* allocator)
+{
+    arena_guard_t* guard = arena_guard_new(allocator);
+    nacre_allocator_t hooks;
+    arena_t scratch_arena;
+    nacre_scratch_t* scratch;
+    jmp_buf fail;
+    if (guard == NULL) {
+        return NULL;
+    }
+    if (setjmp(fail) != 0) {
+        arena_guard_free(guard);
+        return NULL;
+    }
+    guard->fail = &fail;
+    hooks = arena_guard_hooks(guard);
+    scratch_arena = arena_new(&hooks);
+    scratch = arena_alloc(&scratch_arena, sizeof(nacre_scratch_t));
+    scratch->guard = guard;
+    scratch->error = NACRE_OK;
+    scratch->arena = scratch_arena;
+    scratch->nfa_memory = nfa_memory_new(&scratch->arena);
+    scratch->dfa_serial = 0;
+    scratch->dfa = dfa_cache_new(&scratch->arena);
+    scratch->search_dfa = dfa_cache_new(&scratch->arena);
+    scratch->pike = pike_memory_new(&scratch->arena);
+    scratch->slots = dynarr_new_in(&scratch->arena, sizeof(size_t));
+    guard->fail = NULL;
+    return scratch;
+}
+
+void
+nacre_scratch_free(nacre_scratch_t* scratch)
+{
+    if (scratch == NULL) {
+        return;
+    }
+    arena_guard_free(scratch->guard);
+}
+
+int
+nacre_scratch_error(const nacre_scratch_t* scratch)
+{
+    return scratch->error;
+}
+
+/* make the dfa caches of the scratch ready for regex */
+static void
+use_dfa(const nacre_regex_t* regex, nacre_scratch_t* scratch)
+{
+    if (scratch->dfa_serial != regex->serial) {
+        dfa_cache_reset(&scratch->dfa, &regex->nfa, 0);
+        dfa_cache_reset(&scratch->search_dfa, &regex->nfa, 1);
+        scratch->dfa_serial = regex->serial;
+    }
+}
+
+static size_t
+match_at(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t offset
+)
+{
+    const plan_t* plan = &regex->plan;
+    size_t match_len;
+    if (plan->engine == PLAN_ENGINE_LITERAL) {
+        if (offset + plan->prefix_len <= input_len
+            && plan_is_prefix_at(plan, input + offset)) {
+            return plan->prefix_len;
+        }
+        return 0;
+    }
+    if (plan->jit.match != NULL) {
+        return plan->jit.match(
+            (const unsigned char*)input + offset,
+            (const unsigned char*)input + input_len
+        );
+    }
+    if (plan->engine == PLAN_ENGINE_DFA) {
+        use_dfa(regex, scratch);
+        /* once the cache thrashes, the nfa does the rest for this regex */
+        if (dfa_find_initial_match(
+                &scratch->dfa, input, input_len, offset, &match_len
+            )) {
+            return match_len;
+        }
+    }
+    return epsnfa_find_initial_match(
+        &regex->nfa, input, input_len, offset, &scratch->nfa_memory
+    );
+}
+
+/* the leftmost match that starts in [start, end) and ends at end */
+static int
+find_ending_at(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t start, const size_t end,
+    nacre_match_t* match
+)
+{
+    size_t offset = epsnfa_find_leftmost_start(
+        &regex->plan.reverse, input, input_len, end, start,
+        &scratch->nfa_memory
+    );
+    if (offset == NFA_NO_START) {
+        return 0;
+    }
+    match->offset = offset;
+    match->length = match_at(regex, scratch, input, input_len, offset);
+    return 1;
+}
+
+/* a match of an end anchored pattern ends where its "$" holds, so it is
+   found by scanning back from there instead of trying every offset */
+static int
+find_end_anchored(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t start, nacre_match_t* match
+)
+{
+    nacre_match_t before_newline;
+    size_t line_start = start;
+    if (regex->plan.end_anchor == PLAN_END_INPUT) {
+        int is_found = find_ending_at(
+            regex, scratch, input, input_len, start, input_len, match
+        );
+        /* "$" also holds before a newline that ends the input */
+        if (input_len > start && input[input_len - 1] == '\n'
+            && find_ending_at(
+                regex, scratch, input, input_len, start, input_len - 1,
+                &before_newline
+            )
+            && (!is_found || before_newline.offset < match->offset)) {
+            *match = before_newline;
+            is_found = 1;
+        }
+        return is_found;
+    }
+    /* no match has a newline, so the lines are done in order */
+    for (;;) {
+        const char* newline
+            = memchr(input + line_start, '\n', input_len - line_start);
+        size_t line_end = newline ? (size_t)(newline - input) : input_len;
+        unsigned char last = line_end > line_start ? input[line_end - 1] : 0;
+        /* most lines end with a byte that no match ends with */
+        if (line_end > line_start
+            && (regex->plan.last_bytes[last / 8] & (1 << (last % 8)))
+            && find_ending_at(
+                regex, scratch, input, input_len, line_start, line_end, match
+            )) {
+            return 1;
+        }
+        if (newline == NULL) {
+            return 0;
+        }
+        line_start = line_end + 1;
+    }
+}
+
+/* try every offset from start up to end where the prefilter lets a match
+   start */
+static int
+find_each_offset(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t start, const size_t end,
+    nacre_match_t* match
+)
+{
+    size_t offset, match_len;
+    for (offset = start; offset < end; offset++) {
+        /* skip the offsets where no match can start */
+        offset = plan_next_candidate(&regex->plan, input, input_len, offset);
+        if (offset >= end) {
+            break;
+        }
+        match_len = match_at(regex, scratch, input, input_len, offset);
+        if (match_len) {
+            match->offset = offset;
+            match->length = match_len;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* the unanchored dfa, or its code, reads the input once up to where the
+   first match ends. no match is going where a scan starts, so the leftmost
+   match starts at or after the start of the last scan. if it is not right
+   there, the reverse nfa scans back to the leftmost start of the matches
+   that end where the scan stopped. a match that starts further left must
+   end later, so only the offsets before that start are tried one by one */
+static int
+find_with_dfa(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t start, nacre_match_t* match
+)
+{
+    const plan_t* plan = &regex->plan;
+    /* without a prefilter there is nothing to skip ahead with */
+    const int is_idle_stop = plan->scan != PLAN_SCAN_NONE;
+    size_t pos = start, scan_start, offset;
+    enum DFA_SCAN result = DFA_SCAN_IDLE;
+    use_dfa(regex, scratch);
+    /* a cache that thrashed is given up on for one search only */
+    scratch->dfa.is_failed = 0;
+    scratch->search_dfa.is_failed = 0;
+    do {
+        scan_start = plan_next_candidate(plan, input, input_len, pos);
+        if (scan_start >= input_len) {
+            return 0;
+        }
+        if (plan->jit.scan != NULL) {
+            const jit_scan_t scan = plan->jit.scan(
+                (const unsigned char*)input + scan_start,
+                (const unsigned char*)input + input_len
+            );
+            pos = scan_start + scan.length;
+            result = scan.result;
+        } else {
+            result = dfa_scan(
+                &scratch->search_dfa, input, input_len, scan_start,
+                is_idle_stop, &pos
+            );
+        }
+    } while (result == DFA_SCAN_IDLE);
+    /* the nfa finds the end in the same single pass when the cache
+       thrashes */
+    if (result == DFA_SCAN_FAILED) {
+        pos = epsnfa_find_first_end(
+            &regex->nfa, input, input_len, scan_start, &scratch->nfa_memory
+        );
+        result = pos == NFA_NO_END ? DFA_SCAN_NONE : DFA_SCAN_MATCH;
+    }
+    if (result == DFA_SCAN_NONE) {
+        return 0;
+    }
+    match->length = match_at(regex, scratch, input, input_len, scan_start);
+    if (match->length > 0) {
+        match->offset = scan_start;
+        return 1;
+    }
+    offset = epsnfa_find_leftmost_start(
+        &plan->reverse, input, input_len, pos, scan_start + 1,
+        &scratch->nfa_memory
+    );
+    if (offset == NFA_NO_START) {
+        return find_each_offset(
+            regex, scratch, input, input_len, scan_start + 1, input_len, match
+        );
+    }
+    if (find_each_offset(
+            regex, scratch, input, input_len, scan_start + 1, offset, match
+        )) {
+        return 1;
+    }
+    match->offset = offset;
+    match->length = match_at(regex, scratch, input, input_len, offset);
+    return 1;
+}
+
+static int
+find(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t start, nacre_match_t* match
+)
+{
+    size_t match_len;
+    if (regex->plan.is_start_anchored) {
+        /* only a match at offset 0 can start with "^" */
+        if (start > 0) {
+            return 0;
+        }
+        match_len = match_at(regex, scratch, input, input_len, 0);
+        match->offset = 0;
+        match->length = match_len;
+        return match_len > 0;
+    }
+    if (regex->plan.end_anchor != PLAN_END_ANY) {
+        return find_end_anchored(
+            regex, scratch, input, input_len, start, match
+        );
+    }
+    if (regex->plan.engine == PLAN_ENGINE_DFA) {
+        return find_with_dfa(regex, scratch, input, input_len, start, match);
+    }
+    return find_each_offset(
+        regex, scratch, input, input_len, start, input_len, match
+    );
+}
+
+/* the public match functions run the ones above with the fail jump of the
+   scratch set. if the scratch cannot grow, they find nothing from then on.
+   call sets a volatile result, so that it is kept across the jump */
+#define SCRATCH_TRY(scratch, fail, call)                                       \
+    do {                                                                       \
+        if ((scratch)->error == NACRE_OK) {                                    \
+            if (setjmp(fail) == 0) {                                           \
+                (scratch)->guard->fail = &(fail);                              \
+                call;                                                          \
+            } else {                                                           \
+                (scratch)->error = NACRE_ERROR_NO_MEMORY;                      \
+            }                                                                  \
+            (scratch)->guard->fail = NULL;                                     \
+        }                                                                      \
+    } while (0)
+
+size_t
+nacre_match_at(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t offset
+)
+{
+    volatile size_t match_len = 0;
+    jmp_buf fail;
+    SCRATCH_TRY(
+        scratch, fail,
+        match_len = match_at(regex, scratch, input, input_len, offset)
+    );
+    return match_len;
+}
+
+int
+nacre_find(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t start, nacre_match_t* match
+)
+{
+    volatile int is_found = 0;
+    jmp_buf fail;
+    SCRATCH_TRY(
+        scratch, fail,
+        is_found = find(regex, scratch, input, input_len, start, match)
+    );
+    return is_found;
+}
+
+/* prefetch the first bytes of the record this far ahead in a batch, so its
+   cache misses overlap the matching of the records before it */
+#define BATCH_PREFETCH_DISTANCE 4
+#define BATCH_PREFETCH_BYTES 256
+
+static inline void
+prefetch_record(
+    const char* const* inputs, const size_t* lens, const size_t count,
+    const size_t i
+)
+{
+    size_t j;
+    if (i >= count) {
+        return;
+    }
+    for (j = 0; j < lens[i] && j < BATCH_PREFETCH_BYTES; j += 64) {
+        __builtin_prefetch(inputs[i] + j);
+    }
+}
+
+size_t
+nacre_find_batch(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch,
+    const char* const* inputs, const size_t* lens, const size_t count,
+    nacre_match_t* matches
+)
+{
+    size_t i, match_num = 0;
+    for (i = 0; i < BATCH_PREFETCH_DISTANCE; i++) {
+        prefetch_record(inputs, lens, count, i);
+    }
+    for (i = 0; i < count; i++) {
+        prefetch_record(inputs, lens, count, i + BATCH_PREFETCH_DISTANCE);
+        if (nacre_find(regex, scratch, inputs[i], lens[i], 0, &matches[i])) {
+            match_num++;
+        } else {
+            matches[i].offset = NACRE_NO_MATCH;
+            matches[i].length = 0;
+        }
+    }
+    return match_num;
+}
+
+size_t
+nacre_match_batch(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch,
+    const char* const* inputs, const size_t* lens, const size_t count,
+    unsigned char* bitmap
+)
+{
+    nacre_match_t match;
+    size_t i, match_num = 0;
+    memset(bitmap, 0, (count + 7) / 8);
+    for (i = 0; i < BATCH_PREFETCH_DISTANCE; i++) {
+        prefetch_record(inputs, lens, count, i);
+    }
+    for (i = 0; i < count; i++) {
+        prefetch_record(inputs, lens, count, i + BATCH_PREFETCH_DISTANCE);
+        if (nacre_find(regex, scratch, inputs[i], lens[i], 0, &match)) {
+            bitmap[i / 8] |= (unsigned char)(1 << (i % 8));
+            match_num++;
+        }
+    }
+    return match_num;
+}
+
+void
+nacre_explain(const nacre_regex_t* regex)
+{
+    plan_print(&regex->plan);
+}
+
+int
+nacre_emit_c(const nacre_regex_t* regex, const char* name, FILE* out)
+{
+    /* a guard of its own, so that a regex shared by threads is not touched */
+    arena_guard_t* guard = arena_guard_new(&regex->guard->allocator);
+    nacre_allocator_t hooks;
+    arena_t tmp_arena;
+    int is_written = 0;
+    jmp_buf fail;
+    if (guard == NULL) {
+        return 0;
+    }
+    if (setjmp(fail) == 0) {
+        guard->fail = &fail;
+        hooks = arena_guard_hooks(guard);
+        tmp_arena = arena_new(&hooks);
+        is_written = emit_c(out, name, &regex->nfa, &tmp_arena);
+    }
+    arena_guard_free(guard);
+    return is_written;
+}
+
+int
+nacre_group_count(const nacre_regex_t* regex)
+{
+    return regex->cap.group_num;
+}
+
+static int
+find_groups(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t start, nacre_match_t* groups
+)
+{
+    const int group_num = regex->cap.group_num;
+    size_t* slots;
+    int i;
+    if (!find(regex, scratch, input, input_len, start, &groups[0])) {
+        return 0;
+    }
+    if (group_num == 0) {
+        return 1;
+    }
+    /* only the matched bytes are run again, to parse them into groups */
+    dynarr_resize(&scratch->slots, 2 * group_num);
+    slots = scratch->slots.data;
+    if (!capnfa_find_groups(
+            &regex->cap, input, input_len, groups[0].offset, groups[0].length,
+            &scratch->pike, slots
+        )) {
+        for (i = 0; i < 2 * group_num; i++) {
+            slots[i] = NACRE_NO_GROUP;
+        }
+    }
+    for (i = 1; i <= group_num; i++) {
+        size_t group_start = slots[2 * i - 2], group_end = slots[2 * i - 1];
+        if (group_start == CAPNFA_NO_SLOT || group_end == CAPNFA_NO_SLOT) {
+            groups[i].offset = NACRE_NO_GROUP;
+            groups[i].length = 0;
+        } else {
+            groups[i].offset = group_start;
+            groups[i].length = group_end - group_start;
+        }
+    }
+    return 1;
+}
+
+int
+nacre_find_groups(
+    const nacre_regex_t* regex, nacre_scratch_t* scratch, const char* input,
+    const size_t input_len, const size_t start, nacre_match_t* groups
+)
+{
+    volatile int is_found = 0;
+    jmp_buf fail;
+    SCRATCH_TRY(
+        scratch, fail,
+        is_found
+        = find_groups(regex, scratch, input, input_len, start, groups)
+    );
+    return is_found;
+}
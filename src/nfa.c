@@ -5,548 +5,851 @@
 #include <stdlib.h>
 #include <string.h>
 
-/* initialize an epsnfa of one start states, one final states, and one
-   transition between them
-*/
 tepsnfa
-tepsnfa_one_transition(matcher_t m)
-{
-    static const int init_final_state = 1;
-    tepsnfa res = { .state_num = 2,
-                    .start_state = 0,
-                    .final_state = 1,
-                    .state_transitions = dynarr_new(sizeof(dynarr_t)) };
-    dynarr_t transition_set_0 = dynarr_new(sizeof(transition_t)),
-             transition_set_1 = dynarr_new(sizeof(transition_t));
-    transition_t t;
-    res.final_state = init_final_state;
-    append(&res.state_transitions, &transition_set_0);
-    append(&res.state_transitions, &transition_set_1);
-    t = (transition_t) { .matcher = m, .to_state = 1 };
-    append((dynarr_t*)at(&res.state_transitions, 0), &t);
-    return res;
+tepsnfa_new(arena_t* arena)
+{
+    assert(arena != NULL);
+    return (tepsnfa) {
+        .state_num = 0,
+        .transitions = dynarr_new_in(arena, sizeof(tepsnfa_transition_t)),
+        .arena = arena,
+    };
 }
 
 size_t
-tepsnfa_print(tepsnfa* self)
+tepsnfa_print(const tepsnfa* self, const tepsnfa_frag_t* frag)
 {
-    size_t i, j, byte_count = 0;
+    size_t i, byte_count = 0;
     byte_count += printf("--- PRINT T-EPSNFA ---\n");
     byte_count += printf(
         "Number of state: %lu\nStarting state: %lu\nFinal states: %lu\n"
         "Transitions:\nstateDiagram\n",
-        self->state_num, self->start_state, self->final_state
+        frag->states_end - frag->states_begin, frag->start_state,
+        frag->final_state
     );
-    for (i = 0; i < self->state_transitions.size; i++) {
-        dynarr_t* transitions = at(&self->state_transitions, i);
-        for (j = 0; j < transitions->size; j++) {
-            transition_t* t = at(transitions, j);
-            byte_count += printf(
-                "  %lu --> %lu: %s\n", i, t->to_state,
-                get_matcher_str(t->matcher)
-            );
-        }
+    for (i = frag->transitions_begin; i < frag->transitions_end; i++) {
+        tepsnfa_transition_t* t = at(&self->transitions, i);
+        byte_count += printf(
+            "  %lu --> %lu: %s\n", t->from_state, t->to_state,
+            get_matcher_str(t->matcher)
+        );
     }
     byte_count += printf("----------------------\n");
     fflush(stdout);
     return byte_count;
 }
 
-void
-tepsnfa_clear(tepsnfa* self)
-{
-    size_t i;
-    for (i = 0; i < self->state_transitions.size; i++) {
-        dynarr_free((dynarr_t*)at(&self->state_transitions, i));
-    }
-    dynarr_free(&self->state_transitions);
-    self->state_num = 0;
-    self->start_state = -1;
-    self->final_state = -1;
-}
-
-void
+size_t
 tepsnfa_add_state(tepsnfa* self)
 {
-    self->state_num++;
-    dynarr_t transition_set = dynarr_new(sizeof(transition_t));
-    append(&self->state_transitions, &transition_set);
+    return self->state_num++;
 }
 
 void
 tepsnfa_add_transition(tepsnfa* self, size_t from, matcher_t matcher, size_t to)
 {
-    dynarr_t* from_transition_set = at(&self->state_transitions, from);
-    size_t i;
-    /* check repetition */
-    for (i = 0; i < from_transition_set->size; i++) {
-        transition_t* t = at(from_transition_set, i);
-        if (t->to_state == to
-            && memcmp(&t->matcher, &matcher, sizeof(matcher_t)) == 0) {
-            return;
-        }
-    }
-    transition_t t = { .matcher = matcher, .to_state = to };
-    append(from_transition_set, &t);
+    tepsnfa_transition_t t = {
+        .from_state = from,
+        .matcher = matcher,
+        .to_state = to,
+    };
+    append(&self->transitions, &t);
 }
 
-tepsnfa
-tepsnfa_deepcopy(const tepsnfa* self)
+/* the fragment that starts at start_state, ends at final_state and owns
+   everything appended since states_begin and transitions_begin */
+static inline tepsnfa_frag_t
+make_frag(
+    const tepsnfa* self, size_t start_state, size_t final_state,
+    size_t states_begin, size_t transitions_begin
+)
 {
-    size_t i, j;
-    tepsnfa copy = {
-        .state_num = self->state_num,
-        .start_state = self->start_state,
-        .final_state = self->final_state,
-        .state_transitions = dynarr_new(sizeof(dynarr_t)),
+    return (tepsnfa_frag_t) {
+        .start_state = start_state,
+        .final_state = final_state,
+        .states_begin = states_begin,
+        .states_end = self->state_num,
+        .transitions_begin = transitions_begin,
+        .transitions_end = self->transitions.size,
     };
-    for (i = 0; i < self->state_transitions.size; i++) {
-        dynarr_t* from_transition_set = at(&self->state_transitions, i);
-        dynarr_t to_transition_set = dynarr_new(sizeof(transition_t));
-        for (j = 0; j < from_transition_set->size; j++) {
-            append(&to_transition_set, at(from_transition_set, j));
-        }
-        append(&copy.state_transitions, &to_transition_set);
-    }
-    return copy;
 }
 
-void
-tepsnfa_concat(tepsnfa* self, const tepsnfa* right)
+static inline size_t
+min_size(size_t a, size_t b)
 {
-    size_t i, j;
-    transition_t new_t;
-    /* append right's transition to self */
-    for (i = 0; i < right->state_transitions.size; i++) {
-        dynarr_t* from_transition_set = at(&right->state_transitions, i);
-        dynarr_t to_transition_set = dynarr_new(sizeof(transition_t));
-        for (j = 0; j < from_transition_set->size; j++) {
-            transition_t* t = at(from_transition_set, j);
-            new_t = (transition_t) {
-                .matcher = t->matcher,
-                .to_state = self->state_num + t->to_state,
-            };
-            append(&to_transition_set, &new_t);
-        }
-        append(&self->state_transitions, &to_transition_set);
-    }
-    /* transition to self's final become to right's start */
-    for (i = 0; i < self->state_transitions.size; i++) {
-        dynarr_t* transition_set = at(&self->state_transitions, i);
-        for (j = 0; j < transition_set->size; j++) {
-            transition_t* t = at(transition_set, j);
-            if (t->to_state == self->final_state) {
-                t->to_state = self->state_num + right->start_state;
-            }
-        }
-    }
-    /* transform self's final to right's final by adding self->state_num */
-    self->final_state = right->final_state + self->state_num;
-    self->state_num += right->state_num;
+    return a < b ? a : b;
 }
 
-void
-tepsnfa_union(tepsnfa* self, const tepsnfa* right)
+tepsnfa_frag_t
+tepsnfa_one_transition(tepsnfa* self, matcher_t m)
 {
-    size_t i, j;
-    size_t new_start = self->state_num + right->state_num;
-    size_t new_final = new_start + 1;
-    /* append right's transition to self */
-    for (i = 0; i < right->state_transitions.size; i++) {
-        dynarr_t* from_transition_set = at(&right->state_transitions, i);
-        dynarr_t to_transition_set = dynarr_new(sizeof(transition_t));
-        for (j = 0; j < from_transition_set->size; j++) {
-            transition_t* t = at(from_transition_set, j);
-            transition_t new_t = {
-                .matcher = t->matcher,
-                .to_state = self->state_num + t->to_state,
-            };
-            append(&to_transition_set, &new_t);
-        }
-        append(&self->state_transitions, &to_transition_set);
-    }
-    /* add transition set for new state */
-    {
-        dynarr_t new_start_transition_set = dynarr_new(sizeof(transition_t));
-        dynarr_t new_final_transition_set = dynarr_new(sizeof(transition_t));
-        append(&self->state_transitions, &new_start_transition_set);
-        append(&self->state_transitions, &new_final_transition_set);
+    size_t states_begin = self->state_num;
+    size_t transitions_begin = self->transitions.size;
+    size_t start = tepsnfa_add_state(self);
+    size_t final = tepsnfa_add_state(self);
+    tepsnfa_add_transition(self, start, m, final);
+    return make_frag(self, start, final, states_begin, transitions_begin);
+}
+
+tepsnfa_frag_t
+tepsnfa_copy(tepsnfa* self, const tepsnfa_frag_t* frag)
+{
+    size_t i;
+    size_t states_begin = self->state_num;
+    size_t transitions_begin = self->transitions.size;
+    size_t shift = states_begin - frag->states_begin;
+    self->state_num += frag->states_end - frag->states_begin;
+    for (i = frag->transitions_begin; i < frag->transitions_end; i++) {
+        /* copy by value because append can move the array */
+        tepsnfa_transition_t t
+            = *(tepsnfa_transition_t*)at(&self->transitions, i);
+        t.from_state += shift;
+        t.to_state += shift;
+        append(&self->transitions, &t);
     }
-    /* add eps from new start to self start and right start */
-    tepsnfa_add_transition(self, new_start, eps_matcher(), self->start_state);
-    tepsnfa_add_transition(
-        self, new_start, eps_matcher(), right->start_state + self->state_num
+    return make_frag(
+        self, frag->start_state + shift, frag->final_state + shift,
+        states_begin, transitions_begin
     );
-    /* add eps from self final and right final to new final */
-    tepsnfa_add_transition(self, self->final_state, eps_matcher(), new_final);
+}
+
+tepsnfa_frag_t
+tepsnfa_concat(
+    tepsnfa* self, const tepsnfa_frag_t* left, const tepsnfa_frag_t* right
+)
+{
+    /* final of left has no out-transition, so joining it to the start of
+       right with an epsilon is enough */
     tepsnfa_add_transition(
-        self, right->final_state + self->state_num, eps_matcher(), new_final
+        self, left->final_state, eps_matcher(), right->start_state
+    );
+    return make_frag(
+        self, left->start_state, right->final_state,
+        min_size(left->states_begin, right->states_begin),
+        min_size(left->transitions_begin, right->transitions_begin)
     );
-    /* set new start and final state */
-    self->final_state = new_final;
-    self->start_state = new_start;
-    self->state_num += right->state_num + 2;
 }
 
-void
-tepsnfa_fast_union(tepsnfa* self, const tepsnfa* right)
+tepsnfa_frag_t
+tepsnfa_union(
+    tepsnfa* self, const tepsnfa_frag_t* left, const tepsnfa_frag_t* right
+)
 {
-    size_t i, j;
-    assert(right->state_transitions.size == 2);
-    dynarr_t* right_start_transition_set
-        = at(&right->state_transitions, right->start_state);
-    assert(right_start_transition_set->size == 1);
-    /* append right's transition to self */
-    for (i = 0; i < right->state_transitions.size; i++) {
-        dynarr_t* from_transition_set = at(&right->state_transitions, i);
-        dynarr_t to_transition_set = dynarr_new(sizeof(transition_t));
-        for (j = 0; j < from_transition_set->size; j++) {
-            transition_t* t = at(from_transition_set, j);
-            transition_t new_t = {
-                .matcher = t->matcher,
-                .to_state = self->state_num + t->to_state,
-            };
-            append(&to_transition_set, &new_t);
-        }
-        append(&self->state_transitions, &to_transition_set);
-    }
+    /* because the start of right has no in-transition and its final has no
+       out-transition, left can be hung between them without new states. the
+       ast of "a|b|c" is "a|(b|c)", so all alternatives share one start and
+       one final and the epsilon closures stay shallow */
     tepsnfa_add_transition(
-        self, self->start_state, eps_matcher(),
-        right->start_state + self->state_num
+        self, right->start_state, alter_eps_matcher(), left->start_state
     );
     tepsnfa_add_transition(
-        self, right->final_state + self->state_num, eps_matcher(),
-        self->final_state
+        self, left->final_state, eps_matcher(), right->final_state
+    );
+    return make_frag(
+        self, right->start_state, right->final_state,
+        min_size(left->states_begin, right->states_begin),
+        min_size(left->transitions_begin, right->transitions_begin)
     );
-    self->state_num += 2;
 }
 
-void
-tepsnfa_to_star(tepsnfa* self)
+tepsnfa_frag_t
+tepsnfa_to_star(tepsnfa* self, const tepsnfa_frag_t* frag)
 {
-    size_t star_start = self->state_num;
-    size_t star_final = self->state_num + 1;
-    tepsnfa_add_state(self);
-    tepsnfa_add_state(self);
+    size_t star_start = tepsnfa_add_state(self);
+    size_t star_final = tepsnfa_add_state(self);
     /* add eps from star-start to self-start */
-    tepsnfa_add_transition(self, star_start, eps_matcher(), self->start_state);
+    tepsnfa_add_transition(self, star_start, eps_matcher(), frag->start_state);
     /* add eps from self-finals to self-start */
     tepsnfa_add_transition(
-        self, self->final_state, eps_matcher(), self->start_state
+        self, frag->final_state, eps_matcher(), frag->start_state
     );
     /* add eps from self-finals to star-final */
-    tepsnfa_add_transition(self, self->final_state, eps_matcher(), star_final);
+    tepsnfa_add_transition(self, frag->final_state, eps_matcher(), star_final);
     /* add eps from star-start to star-final */
     tepsnfa_add_transition(self, star_start, eps_matcher(), star_final);
-    /* set new start and final state */
-    self->start_state = star_start;
-    self->final_state = star_final;
+    return make_frag(
+        self, star_start, star_final, frag->states_begin,
+        frag->transitions_begin
+    );
 }
 
-void
-tepsnfa_to_opt(tepsnfa* self)
+tepsnfa_frag_t
+tepsnfa_to_plus(tepsnfa* self, const tepsnfa_frag_t* frag)
+{
+    /* same as star but without the eps from star-start to star-final */
+    size_t plus_start = tepsnfa_add_state(self);
+    size_t plus_final = tepsnfa_add_state(self);
+    tepsnfa_add_transition(self, plus_start, eps_matcher(), frag->start_state);
+    tepsnfa_add_transition(
+        self, frag->final_state, eps_matcher(), frag->start_state
+    );
+    tepsnfa_add_transition(self, frag->final_state, eps_matcher(), plus_final);
+    return make_frag(
+        self, plus_start, plus_final, frag->states_begin,
+        frag->transitions_begin
+    );
+}
+
+tepsnfa_frag_t
+tepsnfa_to_opt(tepsnfa* self, const tepsnfa_frag_t* frag)
 {
     /* add an eps-transition from start state to final state */
     tepsnfa_add_transition(
-        self, self->start_state, eps_matcher(), self->final_state
+        self, frag->start_state, eps_matcher(), frag->final_state
+    );
+    return make_frag(
+        self, frag->start_state, frag->final_state, frag->states_begin,
+        frag->transitions_begin
     );
 }
 
-/* remove states with zero degree from tepsnfa, return epsnfa */
-static epsnfa
-to_epsnfa(const tepsnfa* input)
+tepsnfa_frag_t
+tepsnfa_to_group(tepsnfa* self, const tepsnfa_frag_t* frag, int group)
 {
-    size_t i, j;
-    epsnfa output;
-    int* state_degrees = calloc(input->state_num, sizeof(int));
-    int* output_index = malloc(input->state_num * sizeof(int));
-    int nonzero_deg_state_index = 0;
-    /* get degrees */
-    for (i = 0; i < input->state_transitions.size; i++) {
-        dynarr_t* transition_set = at(&input->state_transitions, i);
-        for (j = 0; j < transition_set->size; j++) {
-            transition_t* t = at(transition_set, j);
-            state_degrees[i]++;
-            state_degrees[t->to_state]++;
-        }
-    }
-    /* assign new index to state removing zero-degree states */
-    memset(output_index, -1, sizeof(int) * input->state_num);
-    for (i = 0; i < input->state_num; i++) {
-        if (state_degrees[i] != 0) {
-            output_index[i] = nonzero_deg_state_index;
-            nonzero_deg_state_index++;
-        }
-    }
-    /* copy nonzero-degree states to epsnfa */
-    output = epsnfa_new(nonzero_deg_state_index);
-    bitmask_add(&output.is_finish, output_index[input->final_state]);
-    bitmask_add(&output.is_start, output_index[input->start_state]);
-    for (i = 0; i < input->state_num; i++) {
-        dynarr_t* transition_set = at(&input->state_transitions, i);
-        for (j = 0; j < transition_set->size; j++) {
-            transition_t* t = at(transition_set, j);
-            int k = output_index[i] * output.state_num
-                + output_index[t->to_state];
-            output.transition_table[k] = t->matcher;
-        }
-    }
-    free(state_degrees);
-    free(output_index);
-    return output;
+    size_t group_start = tepsnfa_add_state(self);
+    size_t group_final = tepsnfa_add_state(self);
+    /* the slots of group k are 2k-2 and 2k-1 because groups start from 1 */
+    tepsnfa_add_transition(
+        self, group_start, save_matcher(2 * group - 2), frag->start_state
+    );
+    tepsnfa_add_transition(
+        self, frag->final_state, save_matcher(2 * group - 1), group_final
+    );
+    return make_frag(
+        self, group_start, group_final, frag->states_begin,
+        frag->transitions_begin
+    );
 }
 
-/* remove unreachable states from epsnfa, return new epsnfa */
-static epsnfa
-remove_unreachable_states(epsnfa* input)
+capnfa
+tepsnfa_to_capnfa(
+    const tepsnfa* input, const tepsnfa_frag_t* frag, arena_t* output_arena
+)
 {
-    size_t i, j;
-    epsnfa output;
-    int* state_in_degrees = calloc(input->state_num, sizeof(int));
-    int* state_degrees = calloc(input->state_num, sizeof(int));
-    int* output_index = malloc(input->state_num * sizeof(int));
-    int nonzero_deg_state_index = 0;
-    /* get in-degrees */
-    for (i = 0; i < input->state_num; i++) {
-        for (j = 0; j < input->state_num; j++) {
-            int k = i * input->state_num + j;
-            if (input->transition_table[k].flag != MATCHER_FLAG_NIL) {
-                state_in_degrees[j]++;
-            }
-        }
+    const size_t base = frag->states_begin;
+    const size_t n = frag->states_end - base;
+    const size_t transition_num
+        = frag->transitions_end - frag->transitions_begin;
+    size_t i;
+    size_t* fill;
+    capnfa output = {
+        .state_num = n,
+        .start_state = frag->start_state - base,
+        .final_state = frag->final_state - base,
+        .transition_offsets
+        = arena_alloc(output_arena, (n + 1) * sizeof(size_t)),
+        .transitions
+        = arena_alloc(output_arena, transition_num * sizeof(transition_t)),
+        .group_num = 0,
+    };
+    for (i = frag->transitions_begin; i < frag->transitions_end; i++) {
+        tepsnfa_transition_t* t = at(&input->transitions, i);
+        output.transition_offsets[t->from_state - base + 1]++;
     }
-    /* if in-degree is zero and is not start than remove all its out-edges */
-    for (i = 0; i < input->state_num; i++) {
-        if (!bitmask_contains(&input->is_start, i)
-            && state_in_degrees[i] == 0) {
-            memset(
-                &input->transition_table[i * input->state_num], 0,
-                sizeof(matcher_t) * input->state_num
-            );
-        }
+    for (i = 0; i < n; i++) {
+        output.transition_offsets[i + 1] += output.transition_offsets[i];
     }
-    /* get degrees again */
-    for (i = 0; i < input->state_num; i++) {
-        for (j = 0; j < input->state_num; j++) {
-            int k = i * input->state_num + j;
-            if (input->transition_table[k].flag != MATCHER_FLAG_NIL) {
-                state_degrees[i]++;
-                state_degrees[j]++;
-            }
+    /* the left alternatives of a union are added after the right one, so
+       they go first in reverse. the others keep the order they were added
+       in, which already prefers the longer repetition */
+    fill = arena_alloc(input->arena, n * sizeof(size_t));
+    memcpy(fill, output.transition_offsets, n * sizeof(size_t));
+    for (i = frag->transitions_end; i > frag->transitions_begin; i--) {
+        tepsnfa_transition_t* t = at(&input->transitions, i - 1);
+        if (is_alter_eps(t->matcher)) {
+            output.transitions[fill[t->from_state - base]++] = (transition_t) {
+                .matcher = eps_matcher(),
+                .to_state = t->to_state - base,
+            };
         }
     }
-    /* assign new index for output removing zero-degree states */
-    memset(output_index, -1, sizeof(int) * input->state_num);
-    for (i = 0; i < input->state_num; i++) {
-        if (bitmask_contains(&input->is_start, i) || state_degrees[i] != 0) {
-            output_index[i] = nonzero_deg_state_index;
-            nonzero_deg_state_index++;
+    for (i = frag->transitions_begin; i < frag->transitions_end; i++) {
+        tepsnfa_transition_t* t = at(&input->transitions, i);
+        if (!is_alter_eps(t->matcher)) {
+            output.transitions[fill[t->from_state - base]++] = (transition_t) {
+                .matcher = t->matcher,
+                .to_state = t->to_state - base,
+            };
         }
     }
-    /* copy nonzero-degree states to output */
-    output = epsnfa_new(nonzero_deg_state_index);
-    /* copy starts and finishes */
-    for (i = 0; i < input->state_num; i++) {
-        if (bitmask_contains(&input->is_start, i)) {
-            bitmask_add(&output.is_start, output_index[i]);
-        }
-        if (bitmask_contains(&input->is_finish, i)) {
-            bitmask_add(&output.is_finish, output_index[i]);
-        }
+    return output;
+}
+
+epsnfa
+tepsnfa_to_epsnfa_and_reduce_eps(
+    const tepsnfa* input, const tepsnfa_frag_t* frag, arena_t* output_arena
+)
+{
+    arena_t* arena = input->arena;
+    const size_t n = input->state_num;
+    const tepsnfa_transition_t* in_trans = input->transitions.data;
+    size_t i, j, k, queue_head = 0;
+    /* the out-transitions of every input state, sorted by counting */
+    size_t* in_offsets = arena_alloc(arena, (n + 1) * sizeof(size_t));
+    size_t* in_order
+        = arena_alloc(arena, input->transitions.size * sizeof(size_t));
+    /* the output index of an input state, 0 means not assigned */
+    size_t* output_index = arena_alloc(arena, n * sizeof(size_t));
+    /* the input state of an output state, also the bfs queue */
+    size_t* input_index = arena_alloc(arena, n * sizeof(size_t));
+    /* the latest output state whose closure contains the input state */
+    size_t* closure_stamp = arena_alloc(arena, n * sizeof(size_t));
+    dynarr_t closure_stack = dynarr_new_in(arena, sizeof(size_t));
+    dynarr_t out_offsets = dynarr_new_in(arena, sizeof(size_t));
+    dynarr_t out_trans = dynarr_new_in(arena, sizeof(transition_t));
+    dynarr_t out_finish = dynarr_new_in(arena, sizeof(size_t));
+    size_t output_num = 0;
+    epsnfa output;
+
+    for (i = 0; i < input->transitions.size; i++) {
+        in_offsets[in_trans[i].from_state + 1]++;
     }
-    /* copy transitions */
-    for (i = 0; i < input->state_num; i++) {
-        if (output_index[i] == -1) {
-            continue;
+    for (i = 0; i < n; i++) {
+        in_offsets[i + 1] += in_offsets[i];
+    }
+    {
+        size_t* fill = arena_alloc(arena, n * sizeof(size_t));
+        memcpy(fill, in_offsets, n * sizeof(size_t));
+        for (i = 0; i < input->transitions.size; i++) {
+            in_order[fill[in_trans[i].from_state]++] = i;
         }
-        for (j = 0; j < input->state_num; j++) {
-            if (output_index[j] == -1) {
-                continue;
+    }
+
+    /* breadth-first from the start. every reached state gets the
+       non-epsilon transitions of its epsilon closure, and is final if its
+       closure has the final state. the states that are only reachable with
+       epsilons are never assigned, so nothing has to be removed later */
+    output_index[frag->start_state] = ++output_num;
+    input_index[0] = frag->start_state;
+    while (queue_head < output_num) {
+        const size_t cur = queue_head++;
+        size_t top = input_index[cur];
+        int is_finish = 0;
+        append(&out_offsets, &out_trans.size);
+        closure_stamp[top] = cur + 1;
+        closure_stack.size = 0;
+        append(&closure_stack, &top);
+        while (closure_stack.size > 0) {
+            size_t s = *(size_t*)back(&closure_stack);
+            pop(&closure_stack);
+            if (s == frag->final_state) {
+                is_finish = 1;
             }
-            int k = output_index[i] * output.state_num + output_index[j];
-            int l = i * input->state_num + j;
-            output.transition_table[k] = input->transition_table[l];
+            for (j = in_offsets[s]; j < in_offsets[s + 1]; j++) {
+                const tepsnfa_transition_t* t = &in_trans[in_order[j]];
+                /* use "==" because need to exclude anchor */
+                if (t->matcher.flag == MATCHER_FLAG_EPS) {
+                    if (closure_stamp[t->to_state] != cur + 1) {
+                        closure_stamp[t->to_state] = cur + 1;
+                        append(&closure_stack, &t->to_state);
+                    }
+                    continue;
+                }
+                if (output_index[t->to_state] == 0) {
+                    input_index[output_num] = t->to_state;
+                    output_index[t->to_state] = ++output_num;
+                }
+                transition_t new_t = {
+                    .matcher = t->matcher,
+                    .to_state = output_index[t->to_state] - 1,
+                };
+                append(&out_trans, &new_t);
+            }
+        }
+        if (is_finish) {
+            append(&out_finish, &cur);
         }
     }
-    free(state_in_degrees);
-    free(state_degrees);
-    free(output_index);
-    return output;
-}
+    append(&out_offsets, &out_trans.size);
 
-epsnfa
-tepsnfa_to_epsnfa_and_reduce_eps(tepsnfa* input)
-{
-    epsnfa temp = to_epsnfa(input);
-    size_t i;
-    for (i = 0; i < temp.state_num; i++) {
-        epsnfa_reduce_eps(&temp, i);
+    output = epsnfa_new(output_num, out_trans.size, output_arena);
+    memcpy(
+        output.transition_offsets, out_offsets.data,
+        (output_num + 1) * sizeof(size_t)
+    );
+    memcpy(
+        output.transitions, out_trans.data,
+        out_trans.size * sizeof(transition_t)
+    );
+    bitmask_add(&output.is_start, 0);
+    for (k = 0; k < out_finish.size; k++) {
+        bitmask_add(&output.is_finish, *(size_t*)at(&out_finish, k));
     }
-    epsnfa output = remove_unreachable_states(&temp);
-    epsnfa_clear(&temp);
     return output;
 }
 
 epsnfa
-epsnfa_new(const size_t state_num)
+epsnfa_new(const size_t state_num, const size_t transition_num, arena_t* arena)
 {
+    const size_t offsets_size = (state_num + 1) * sizeof(size_t);
+    const size_t transitions_size = transition_num * sizeof(transition_t);
     assert(state_num > 0);
     return (epsnfa) {
         .state_num = state_num,
-        .is_start = bitmask_new(state_num),
-        .is_finish = bitmask_new(state_num),
-        .transition_table = calloc(state_num * state_num, sizeof(matcher_t)),
+        .transition_num = transition_num,
+        .transition_offsets = arena ? arena_alloc(arena, offsets_size)
+                                    : calloc(1, offsets_size),
+        .transitions = arena ? arena_alloc(arena, transitions_size)
+                             : calloc(1, transitions_size + 1),
+        .is_start = bitmask_new_in(arena, state_num),
+        .is_finish = bitmask_new_in(arena, state_num),
         .char_class_pool = (dynarr_t) {
             .size = 0,
             .cap = 0,
             .data = NULL,
             .elem_size = 0,
+            .arena = NULL,
         },
+        .arena = arena,
+        .class_num = 0,
+        .jump_offsets = NULL,
+        .jump_targets = NULL,
+        .anchor_offsets = NULL,
+        .anchor_transitions = NULL,
+        .runs = NULL,
+        .run_bytes = NULL,
     };
 }
 
 void
-epsnfa_get_eps_closure(epsnfa* self, size_t state, bitmask_t* closure)
+epsnfa_print(const epsnfa* self)
 {
-    if (bitmask_contains(closure, state)) {
-        return;
+    size_t i, j;
+    printf("---- PRINT EPSNFA ----\n");
+    printf("Number of state: %lu\nStarting state:\n", self->state_num);
+    for (i = 0; i < self->state_num; i++) {
+        if (bitmask_contains(&self->is_start, i)) {
+            printf(" %lu", i);
+        }
     }
-    bitmask_add(closure, state);
-    size_t i;
+    printf("\nFinal states:\n");
+    for (i = 0; i < self->state_num; i++) {
+        if (bitmask_contains(&self->is_finish, i)) {
+            printf(" %lu", i);
+        }
+    }
+    printf("\nCharactor classes:\n");
+    for (i = 0; i < self->char_class_pool.size; i++) {
+        printf("#%lu ", i);
+    }
+    printf("\nTransitions:\n\nstateDiagram\n");
     for (i = 0; i < self->state_num; i++) {
-        matcher_t m = self->transition_table[state * self->state_num + i];
-        /* use "==" because need to exclude anchor */
-        if (m.flag == MATCHER_FLAG_EPS) {
-            epsnfa_get_eps_closure(self, i, closure);
+        for (j = self->transition_offsets[i];
+             j < self->transition_offsets[i + 1]; j++) {
+            transition_t* t = &self->transitions[j];
+            printf(
+                "  %lu --> %lu: %s\n", i, t->to_state,
+                get_matcher_str(t->matcher)
+            );
         }
     }
+    printf("----------------------\n");
 }
 
 void
-epsnfa_reduce_eps(epsnfa* self, size_t state)
+epsnfa_clear(epsnfa* self)
 {
-    size_t i, j;
-    bitmask_t closure = bitmask_new(self->state_num);
-
-    /* get epsilon closure of s */
-    epsnfa_get_eps_closure(self, state, &closure);
-    // printf("closure %d:", state);
-    // for (i = 0; i < self->state_num; i++) {
-    //     if (bitmask_contains(&closure, i)) {
-    //         printf(" %d", i);
-    //     }
-    // }
-    // printf("\n");
-
-    /* for each transition (s_from, p, s_to) in EPSNFA */
-    for (i = 0; i < self->state_num; i++) {
-        /* if s_from != s and s_from is in closure */
-        if (i != state && bitmask_contains(&closure, i)) {
-            for (j = 0; j < self->state_num; j++) {
-                matcher_t m = self->transition_table[i * self->state_num + j];
-                if (m.flag == MATCHER_FLAG_NIL) {
-                    continue;
-                }
-                /* add (s, p, s_to) to EPSNFA */
-                // printf("add (%d, %s, %d)\n", state, get_matcher_str(m), j);
-                self->transition_table[state * self->state_num + j] = m;
-            }
-        }
+    self->state_num = 0;
+    self->transition_num = 0;
+    if (self->arena == NULL) {
+        bitmask_free(&self->is_start);
+        bitmask_free(&self->is_finish);
+        free(self->transition_offsets);
+        free(self->transitions);
+        free(self->jump_offsets);
+        free(self->jump_targets);
+        free(self->anchor_offsets);
+        free(self->anchor_transitions);
+        free(self->runs);
+        free(self->run_bytes);
     }
+    self->transition_offsets = NULL;
+    self->transitions = NULL;
+    self->class_num = 0;
+    self->jump_offsets = NULL;
+    self->jump_targets = NULL;
+    self->anchor_offsets = NULL;
+    self->anchor_transitions = NULL;
+    self->runs = NULL;
+    self->run_bytes = NULL;
+    dynarr_free(&self->char_class_pool);
+}
 
-    /* if s is start state then for s' in closure, set s' as
-       a start state */
-    if (bitmask_contains(&self->is_start, state)) {
-        for (j = 0; j < self->state_num; j++) {
-            if (bitmask_contains(&closure, j)) {
-                bitmask_add(&self->is_start, state);
-            }
+static inline void*
+epsnfa_alloc(const epsnfa* self, const size_t size)
+{
+    /* one more byte so that an empty table is not a NULL */
+    return self->arena ? arena_alloc(self->arena, size + 1)
+                       : calloc(1, size + 1);
+}
+
+static int
+compare_uint64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* does the consuming matcher m match byte c */
+static inline int
+match_consuming(const epsnfa* self, const matcher_t m, const unsigned char c)
+{
+    if (m.flag & MATCHER_FLAG_CLASS) {
+        const char_class_t* cc = at(&self->char_class_pool, m.payload);
+        return match_class(*cc, c);
+    }
+    return match_byte(m, c);
+}
+
+/* the slot of table that has the class with bitmap in pool, or the empty
+   slot where it goes. table is open addressing with a power of two size */
+static size_t
+find_class_slot(
+    const dynarr_t* pool, const uint32_t* table, const size_t table_size,
+    const uint8_t* bitmap
+)
+{
+    uint64_t hash = 14695981039346656037u;
+    size_t i, h;
+    for (i = 0; i < 32; i++) {
+        hash = (hash ^ bitmap[i]) * 1099511628211u;
+    }
+    for (h = hash & (table_size - 1); table[h] != UINT32_MAX;
+         h = (h + 1) & (table_size - 1)) {
+        const char_class_t* cc = at(pool, table[h]);
+        if (memcmp(cc->bitmap, bitmap, 32) == 0) {
+            break;
         }
     }
+    return h;
+}
 
-    /* if exists (s, eps, s') where s' is in closure and s' is finish state then
-       also set s as finish state */
-    for (j = 0; j < self->state_num; j++) {
-        if (bitmask_contains(&closure, j)
-            && bitmask_contains(&self->is_finish, j)) {
-            bitmask_add(&self->is_finish, state);
+void
+epsnfa_merge_edges(epsnfa* self)
+{
+    arena_t tmp_arena
+        = arena_new(self->arena ? &self->arena->allocator : NULL);
+    /* 1 + the last edge to a state, valid if it is from the current state */
+    size_t* edge_to = arena_alloc(&tmp_arena, self->state_num * sizeof(size_t));
+    dynarr_t sets = dynarr_new_in(&tmp_arena, sizeof(char_class_t));
+    dynarr_t is_merged = dynarr_new_in(&tmp_arena, sizeof(int));
+    size_t table_size = 1, s, i, j, k, out = 0, in_begin = 0;
+    uint32_t* table;
+    int c;
+
+    /* the pool can grow by one class per transition at most */
+    while (table_size
+           < 2 * (self->char_class_pool.size + self->transition_num)) {
+        table_size *= 2;
+    }
+    table = arena_alloc(&tmp_arena, table_size * sizeof(uint32_t));
+    memset(table, 0xFF, table_size * sizeof(uint32_t));
+    for (i = 0; i < self->char_class_pool.size; i++) {
+        const char_class_t* cc = at(&self->char_class_pool, i);
+        if (!cc->is_negated) {
+            const size_t h = find_class_slot(
+                &self->char_class_pool, table, table_size, cc->bitmap
+            );
+            if (table[h] == UINT32_MAX) {
+                table[h] = i;
+            }
         }
     }
 
-    /* remove eps transitions from s to another states in the closure */
-    for (j = 0; j < self->state_num; j++) {
-        if (bitmask_contains(&closure, j)) {
-            int k = state * self->state_num + j;
-            matcher_t m = self->transition_table[k];
-            if (m.flag == MATCHER_FLAG_EPS) {
-                // printf("remove (%d, ?, %d)\n", state, j);
-                self->transition_table[k] = nil_matcher();
+    for (s = 0; s < self->state_num; s++) {
+        const size_t begin = out, in_end = self->transition_offsets[s + 1];
+        self->transition_offsets[s] = begin;
+        sets.size = is_merged.size = 0;
+        for (j = in_begin; j < in_end; j++) {
+            const transition_t t = self->transitions[j];
+            const size_t e = edge_to[t.to_state];
+            int is_new = 1;
+            if (t.matcher.flag & MATCHER_FLAG_ANCHOR) {
+                /* anchors stay conditions of their own, without repeats */
+                for (k = begin; k < out && is_new; k++) {
+                    is_new = !(
+                        self->transitions[k].to_state == t.to_state
+                        && self->transitions[k].matcher.flag == t.matcher.flag
+                        && self->transitions[k].matcher.payload
+                            == t.matcher.payload
+                    );
+                }
+            } else if (e > begin) {
+                const matcher_t m = self->transitions[e - 1].matcher;
+                char_class_t* set = at(&sets, e - 1 - begin);
+                int* merged = at(&is_merged, e - 1 - begin);
+                is_new = 0;
+                if (m.flag == t.matcher.flag
+                    && m.payload == t.matcher.payload) {
+                    continue;
+                }
+                if (!*merged) {
+                    for (c = 0; c < 256; c++) {
+                        if (match_consuming(self, m, c)) {
+                            char_class_set(set, c);
+                        }
+                    }
+                    *merged = 1;
+                }
+                for (c = 0; c < 256; c++) {
+                    if (match_consuming(self, t.matcher, c)) {
+                        char_class_set(set, c);
+                    }
+                }
+            }
+            if (is_new) {
+                const char_class_t empty = { .is_negated = 0 };
+                const int zero = 0;
+                if (!(t.matcher.flag & MATCHER_FLAG_ANCHOR)) {
+                    edge_to[t.to_state] = out + 1;
+                }
+                self->transitions[out++] = t;
+                append(&sets, &empty);
+                append(&is_merged, &zero);
+            }
+        }
+        /* a class is interned too, so that equal classes get one index */
+        for (k = begin; k < out; k++) {
+            char_class_t* set = at(&sets, k - begin);
+            const matcher_t m = self->transitions[k].matcher;
+            size_t h, byte_num = 0;
+            if (!*(int*)at(&is_merged, k - begin)) {
+                if (!(m.flag & MATCHER_FLAG_CLASS)) {
+                    continue;
+                }
+                for (c = 0; c < 256; c++) {
+                    if (match_consuming(self, m, c)) {
+                        char_class_set(set, c);
+                    }
+                }
+            }
+            for (c = 0; c < 256; c++) {
+                byte_num += match_class(*set, c);
+            }
+            if (byte_num == 1) {
+                for (c = 0; !match_class(*set, c); c++)
+                    ;
+                self->transitions[k].matcher = byte_matcher(c);
+                continue;
+            }
+            h = find_class_slot(
+                &self->char_class_pool, table, table_size, set->bitmap
+            );
+            if (table[h] == UINT32_MAX) {
+                table[h] = self->char_class_pool.size;
+                append(&self->char_class_pool, set);
             }
+            self->transitions[k].matcher = class_matcher(table[h]);
         }
+        in_begin = in_end;
     }
-    // epsnfa_print(self);
+    self->transition_offsets[self->state_num] = out;
+    self->transition_num = out;
+    arena_free(&tmp_arena);
+}
+
+/* does the state have only one transition, on one byte */
+static inline int
+is_run_step(const epsnfa* self, const size_t state)
+{
+    const size_t begin = self->transition_offsets[state];
+    return self->transition_offsets[state + 1] - begin == 1
+        && self->transitions[begin].matcher.flag == MATCHER_FLAG_BYTE;
+}
 
-    bitmask_free(&closure);
+/* the number of bytes of the chain from state, which may be finishing.
+   the states after it in the chain must not be, since a match could end
+   there */
+static size_t
+literal_run_length(const epsnfa* self, size_t state, size_t* to_state)
+{
+    size_t length = 0;
+    while (length < NFA_RUN_MAX_LEN && is_run_step(self, state)
+           && (length == 0 || !bitmask_contains(&self->is_finish, state))) {
+        state = self->transitions[self->transition_offsets[state]].to_state;
+        length++;
+    }
+    *to_state = state;
+    return length;
+}
+
+/* a run starts at every state that heads a chain of at least
+   NFA_RUN_MIN_LEN bytes. the states of the chain are kept, since other
+   transitions can lead into its middle */
+static void
+build_literal_runs(epsnfa* self)
+{
+    size_t s, i, state, to_state, length, byte_num = 0;
+    self->runs = epsnfa_alloc(self, self->state_num * sizeof(literal_run_t));
+    for (s = 0; s < self->state_num; s++) {
+        length = literal_run_length(self, s, &to_state);
+        if (length >= NFA_RUN_MIN_LEN) {
+            self->runs[s] = (literal_run_t) {
+                .offset = byte_num,
+                .length = length,
+                .to_state = to_state,
+            };
+            byte_num += length;
+        }
+    }
+    self->run_bytes = epsnfa_alloc(self, byte_num);
+    for (s = 0; s < self->state_num; s++) {
+        state = s;
+        for (i = 0; i < self->runs[s].length; i++) {
+            const transition_t* t
+                = &self->transitions[self->transition_offsets[state]];
+            self->run_bytes[self->runs[s].offset + i] = t->matcher.payload;
+            state = t->to_state;
+        }
+    }
 }
 
 void
-epsnfa_print(epsnfa* self)
+epsnfa_build_jump_table(epsnfa* self)
 {
-    size_t i, j;
-    printf("---- PRINT EPSNFA ----\n");
-    printf("Number of state: %lu\nStarting state:\n", self->state_num);
-    for (i = 0; i < self->state_num; i++) {
-        if (bitmask_contains(&self->is_start, i)) {
-            printf(" %lu", i);
+    arena_t tmp_arena
+        = arena_new(self->arena ? &self->arena->allocator : NULL);
+    dynarr_t keys = dynarr_new_in(&tmp_arena, sizeof(uint64_t));
+    unsigned char class_bytes[256];
+    uint8_t next_classes[256];
+    int16_t remap[2 * 256];
+    uint32_t* cursors;
+    size_t i, j, k, s, entry_num, anchor_num = 0, class_num = 1;
+    int c;
+
+    /* split the bytes into classes by every distinct consuming matcher */
+    memset(self->byte_classes, 0, sizeof(self->byte_classes));
+    for (i = 0; i < self->transition_num; i++) {
+        const matcher_t m = self->transitions[i].matcher;
+        uint64_t key = ((uint64_t)m.flag << 32) | m.payload;
+        if (m.flag & MATCHER_FLAG_ANCHOR) {
+            anchor_num++;
+        } else {
+            append(&keys, &key);
         }
     }
-    printf("\nFinal states:\n");
-    for (i = 0; i < self->state_num; i++) {
-        if (bitmask_contains(&self->is_finish, i)) {
-            printf(" %lu", i);
+    qsort(keys.data, keys.size, sizeof(uint64_t), compare_uint64);
+    for (i = 0; i < keys.size && class_num < 256; i++) {
+        const uint64_t key = *(uint64_t*)at(&keys, i);
+        const matcher_t m = { .flag = key >> 32, .payload = (uint32_t)key };
+        if (i > 0 && key == *(uint64_t*)at(&keys, i - 1)) {
+            continue;
+        }
+        memset(remap, 0xFF, sizeof(remap));
+        class_num = 0;
+        for (c = 0; c < 256; c++) {
+            int old = self->byte_classes[c] * 2 + match_consuming(self, m, c);
+            if (remap[old] < 0) {
+                remap[old] = class_num++;
+            }
+            next_classes[c] = remap[old];
         }
+        memcpy(self->byte_classes, next_classes, sizeof(next_classes));
     }
-    printf("\nCharactor classes:\n");
-    for (i = 0; i < self->char_class_pool.size; i++) {
-        printf("#%lu ", i);
+    /* a byte of each class stands for all of it */
+    for (c = 255; c >= 0; c--) {
+        class_bytes[self->byte_classes[c]] = c;
     }
-    printf("\nTransitions:\n\nstateDiagram\n");
-    for (i = 0; i < self->state_num; i++) {
-        for (j = 0; j < self->state_num; j++) {
-            int k = i * self->state_num + j;
-            matcher_t m = self->transition_table[k];
-            if (m.flag) {
-                printf("  %lu --> %lu: %s\n", i, j, get_matcher_str(m));
+    self->class_num = class_num;
+
+    /* count the targets of every state and class, then fill them in */
+    entry_num = self->state_num * class_num;
+    self->jump_offsets = epsnfa_alloc(self, (entry_num + 1) * sizeof(uint32_t));
+    cursors = arena_alloc(&tmp_arena, class_num * sizeof(uint32_t));
+    for (s = 0; s < self->state_num; s++) {
+        uint32_t* counts = self->jump_offsets + s * class_num + 1;
+        for (j = self->transition_offsets[s];
+             j < self->transition_offsets[s + 1]; j++) {
+            const matcher_t m = self->transitions[j].matcher;
+            if (m.flag & MATCHER_FLAG_ANCHOR) {
+                continue;
+            }
+            for (k = 0; k < class_num; k++) {
+                counts[k] += match_consuming(self, m, class_bytes[k]);
             }
         }
     }
-    printf("----------------------\n");
+    for (i = 0; i < entry_num; i++) {
+        self->jump_offsets[i + 1] += self->jump_offsets[i];
+    }
+    self->jump_targets = epsnfa_alloc(
+        self, self->jump_offsets[entry_num] * sizeof(uint32_t)
+    );
+    self->anchor_offsets
+        = epsnfa_alloc(self, (self->state_num + 1) * sizeof(size_t));
+    self->anchor_transitions
+        = epsnfa_alloc(self, anchor_num * sizeof(transition_t));
+    anchor_num = 0;
+    for (s = 0; s < self->state_num; s++) {
+        memcpy(
+            cursors, self->jump_offsets + s * class_num,
+            class_num * sizeof(uint32_t)
+        );
+        self->anchor_offsets[s] = anchor_num;
+        for (j = self->transition_offsets[s];
+             j < self->transition_offsets[s + 1]; j++) {
+            const transition_t* t = &self->transitions[j];
+            if (t->matcher.flag & MATCHER_FLAG_ANCHOR) {
+                self->anchor_transitions[anchor_num++] = *t;
+                continue;
+            }
+            for (k = 0; k < class_num; k++) {
+                if (match_consuming(self, t->matcher, class_bytes[k])) {
+                    self->jump_targets[cursors[k]++] = t->to_state;
+                }
+            }
+        }
+    }
+    self->anchor_offsets[self->state_num] = anchor_num;
+    arena_free(&tmp_arena);
+    build_literal_runs(self);
 }
 
-void
-epsnfa_clear(epsnfa* self)
+nfa_memory_t
+nfa_memory_new(arena_t* arena)
 {
-    self->state_num = 0;
-    bitmask_free(&self->is_start);
-    bitmask_free(&self->is_finish);
-    free(self->transition_table);
+    return (nfa_memory_t) {
+        .stack = dynarr_new_in(arena, sizeof(match_memory_t)),
+        .visited = dynarr_new_in(arena, sizeof(uint64_t)),
+        .visited_dirty = 0,
+        .cur_states = dynarr_new_in(arena, sizeof(size_t)),
+        .next_states = dynarr_new_in(arena, sizeof(size_t)),
+        .stamps = dynarr_new_in(arena, sizeof(size_t)),
+        .generation = 0,
+    };
 }
 
-/* return n if n is the largest integer such that input_str[0:n] matches
-   return 0 if no match found */
-size_t
-epsnfa_find_initial_match(
-    const epsnfa* self, const char* input_str, const size_t intput_len,
-    const size_t start_offset
+static inline int
+match_anchor_at(
+    const transition_t* t, const char* input_str, const size_t input_len,
+    const size_t pos
 )
 {
-    typedef struct memory {
-        size_t cur_state;
-        size_t depth;
-        size_t pos; /* the position in input string */
-    } memory_t;
-    size_t i, matched_len = 0;
-    dynarr_t stack = dynarr_new(sizeof(memory_t));
+    return match_anchor(
+        t->matcher.payload, get_behind(input_str, pos),
+        get_ahead(input_str, input_len, pos)
+    );
+}
+
+/* depth-first search that marks every visited (state, position) pair, so
+   that no pair is searched twice */
+static size_t
+find_initial_match_bitstate(
+    const epsnfa* self, const char* input_str, const size_t input_len,
+    const size_t start_offset, nfa_memory_t* memory
+)
+{
+    dynarr_t* stack = &memory->stack;
+    const literal_run_t* run;
+    uint64_t* visited;
+    size_t i, j, matched_len = 0, max_pos = 0, words;
+    /* only the words that the last search could have set are cleared */
+    if (memory->visited.size < BITSTATE_MAX_BITS / 64) {
+        dynarr_resize(&memory->visited, BITSTATE_MAX_BITS / 64);
+    }
+    visited = memory->visited.data;
+    memset(visited, 0, memory->visited_dirty * sizeof(uint64_t));
+    stack->size = 0;
 #ifdef VERBOSE_MATCH
     printf("start_offset: %lu\n", start_offset);
 #endif
@@ -554,28 +857,29 @@ epsnfa_find_initial_match(
     /* init from start states */
     for (i = 0; i < self->state_num; i++) {
         if (bitmask_contains(&self->is_start, i)) {
-            memory_t init_mem = {
-                .pos = 0,
-                .depth = 0,
-                .cur_state = i,
-            };
-            append(&stack, &init_mem);
+            match_memory_t init_mem = { .pos = 0, .cur_state = i };
+            append(stack, &init_mem);
         }
     }
 
-    /* depth-first search */
-    while (stack.size > 0) {
-        memory_t cur_mem = *(memory_t*)back(&stack);
-        size_t cur_pos = cur_mem.pos;
-        char cur_char = input_str[start_offset + cur_pos];
-        pop(&stack);
+    while (stack->size > 0) {
+        match_memory_t cur_mem = *(match_memory_t*)back(stack);
+        const size_t cur_pos = cur_mem.pos;
+        const size_t bit = cur_pos * self->state_num + cur_mem.cur_state;
+        pop(stack);
+        if (visited[bit / 64] & ((uint64_t)1 << (bit % 64))) {
+            continue;
+        }
+        visited[bit / 64] |= (uint64_t)1 << (bit % 64);
+        if (cur_pos > max_pos) {
+            max_pos = cur_pos;
+        }
 
 #ifdef VERBOSE_MATCH
         printf("---\n");
         printf("input pos : %lu\n", cur_pos);
-        printf("cur char  : %c\n", cur_char);
-        printf("stack size: %lu\n", stack.size + 1);
-        printf("cur state : %*lu\n", stack.size + 1, cur_mem.cur_state);
+        printf("stack size: %lu\n", stack->size + 1);
+        printf("cur state : %lu\n", cur_mem.cur_state);
         printf("---\n");
 #endif
 
@@ -583,137 +887,489 @@ epsnfa_find_initial_match(
             && bitmask_contains(&self->is_finish, cur_mem.cur_state)) {
             matched_len = cur_pos;
         }
-        if (cur_mem.depth == MATCH_SEARCH_DEPTH_LIMIT) {
+
+        run = &self->runs[cur_mem.cur_state];
+        if (run->length > 0) {
+            /* the chain dies on a mismatch, and no match ends inside it */
+            if (start_offset + cur_pos + run->length <= input_len
+                && memcmp(
+                       input_str + start_offset + cur_pos,
+                       self->run_bytes + run->offset, run->length
+                   ) == 0) {
+                match_memory_t next_mem = {
+                    .pos = cur_pos + run->length,
+                    .cur_state = run->to_state,
+                };
+                append(stack, &next_mem);
+            }
             continue;
         }
 
-        for (i = 0; i < self->state_num; i++) {
-            anchor_byte behind, ahead;
-            int is_matched = 0;
-            size_t k = cur_mem.cur_state * self->state_num + i;
-            matcher_t m = self->transition_table[k];
-            if (m.flag == MATCHER_FLAG_NIL) {
-                continue;
+        for (j = self->anchor_offsets[cur_mem.cur_state];
+             j < self->anchor_offsets[cur_mem.cur_state + 1]; j++) {
+            const transition_t* t = &self->anchor_transitions[j];
+            match_memory_t next_mem = {
+                .pos = cur_pos,
+                .cur_state = t->to_state,
+            };
+            if (match_anchor_at(
+                    t, input_str, input_len, start_offset + cur_pos
+                )) {
+                append(stack, &next_mem);
             }
-#ifdef VERBOSE_MATCH
-            printf("%lu %s\n", i, get_matcher_str(m));
-#endif
-            if (m.flag & MATCHER_FLAG_ANCHOR) {
-                if (cur_pos == 0 && start_offset == 0) {
-                    behind = ANCHOR_BYTE_START;
-                } else {
-                    behind = input_str[start_offset + cur_pos - 1];
-                }
-                if (cur_pos + start_offset == intput_len - 1) {
-                    ahead = ANCHOR_BYTE_END;
-                } else {
-                    ahead = cur_char;
-                }
-                is_matched = match_anchor(m.payload, behind, ahead);
-            } else if (m.flag & MATCHER_FLAG_CLASS) {
-                char_class_t* c = at(&self->char_class_pool, m.payload);
-                assert(c != NULL);
-                is_matched = match_class(*c, cur_char);
-            } else if (cur_pos + start_offset <= intput_len - 1) {
-                is_matched = match_byte(m, cur_char);
-            } else {
-                continue;
+        }
+        if (start_offset + cur_pos < input_len) {
+            const uint32_t* row = epsnfa_jump_row(
+                self, cur_mem.cur_state, input_str[start_offset + cur_pos]
+            );
+            for (j = row[0]; j < row[1]; j++) {
+                match_memory_t next_mem = {
+                    .pos = cur_pos + 1,
+                    .cur_state = self->jump_targets[j],
+                };
+                append(stack, &next_mem);
+            }
+        }
+    }
+    words = ((max_pos + 1) * self->state_num + 63) / 64;
+    memory->visited_dirty = words;
+    return matched_len;
+}
+
+/* add the states that the anchors lead to from states at pos */
+static void
+add_anchor_closure(
+    const epsnfa* self, const char* input_str, const size_t input_len,
+    const size_t pos, dynarr_t* states, nfa_memory_t* memory
+)
+{
+    size_t* stamps = memory->stamps.data;
+    size_t i, j;
+    /* states grows while it is walked, so the new states are done too */
+    for (i = 0; i < states->size; i++) {
+        size_t s = *(size_t*)at(states, i);
+        for (j = self->anchor_offsets[s]; j < self->anchor_offsets[s + 1];
+             j++) {
+            const transition_t* t = &self->anchor_transitions[j];
+            if (stamps[t->to_state] != memory->generation
+                && match_anchor_at(t, input_str, input_len, pos)) {
+                stamps[t->to_state] = memory->generation;
+                append(states, &t->to_state);
             }
+        }
+    }
+}
 
-            if (is_matched) {
-                memory_t next_mem = {
-                    .pos = cur_pos,
-                    .depth = cur_mem.depth,
-                    .cur_state = i,
-                };
-                if ((m.flag & MATCHER_FLAG_ANCHOR)) {
-#ifdef VERBOSE_MATCH
-                    printf(" matched archor \"%c%c\"\n", behind, cur_char);
-#endif
-                } else {
-                    next_mem.pos++;
-#ifdef VERBOSE_MATCH
-                    printf(" matched byte %c\n", cur_char);
-#endif
+/* keep the set of states that can be reached at every position, until it
+   is empty or the input ends */
+static size_t
+find_initial_match_simulate(
+    const epsnfa* self, const char* input_str, const size_t input_len,
+    const size_t start_offset, nfa_memory_t* memory
+)
+{
+    dynarr_t* cur = &memory->cur_states;
+    dynarr_t* next = &memory->next_states;
+    const literal_run_t* run;
+    size_t* stamps;
+    size_t i, j, to, pos, matched_len = 0;
+    if (memory->stamps.size < self->state_num) {
+        dynarr_resize(&memory->stamps, self->state_num);
+    }
+    stamps = memory->stamps.data;
+    cur->size = 0;
+    memory->generation++;
+    for (i = 0; i < self->state_num; i++) {
+        if (bitmask_contains(&self->is_start, i)) {
+            stamps[i] = memory->generation;
+            append(cur, &i);
+        }
+    }
+    for (pos = start_offset;; pos++) {
+        dynarr_t* tmp;
+        add_anchor_closure(self, input_str, input_len, pos, cur, memory);
+        if (pos > start_offset) {
+            for (i = 0; i < cur->size; i++) {
+                if (bitmask_contains(&self->is_finish, *(size_t*)at(cur, i))) {
+                    matched_len = pos - start_offset;
+                    break;
                 }
-                append(&stack, &next_mem);
             }
         }
+        if (pos >= input_len || cur->size == 0) {
+            break;
+        }
+        next->size = 0;
+        memory->generation++;
+        run = &self->runs[*(size_t*)at(cur, 0)];
+        if (cur->size == 1 && run->length > 0) {
+            /* a lone state on a run goes through it in one step */
+            if (pos + run->length > input_len
+                || memcmp(
+                       input_str + pos, self->run_bytes + run->offset,
+                       run->length
+                   ) != 0) {
+                break;
+            }
+            to = run->to_state;
+            stamps[to] = memory->generation;
+            append(next, &to);
+            pos += run->length - 1;
+        } else {
+            for (i = 0; i < cur->size; i++) {
+                const uint32_t* row = epsnfa_jump_row(
+                    self, *(size_t*)at(cur, i), input_str[pos]
+                );
+                for (j = row[0]; j < row[1]; j++) {
+                    to = self->jump_targets[j];
+                    if (stamps[to] != memory->generation) {
+                        stamps[to] = memory->generation;
+                        append(next, &to);
+                    }
+                }
+            }
+        }
+        tmp = cur;
+        cur = next;
+        next = tmp;
     }
-    dynarr_free(&stack);
     return matched_len;
 }
 
-dynarr_t
-epsnfa_find_matches(
-    const epsnfa* epsnfa, const char* input, const int is_global
+size_t
+epsnfa_find_initial_match(
+    const epsnfa* self, const char* input_str, const size_t input_len,
+    const size_t start_offset, nfa_memory_t* memory
 )
 {
-    const size_t input_len = strlen(input);
-    size_t start = 0, line_num = 1, col_num = 1, match_len = 0, i = 0;
-    dynarr_t matches = dynarr_new(sizeof(match_t));
-    for (start = 0; start < input_len; start += (match_len ? match_len : 1)) {
-        match_len = epsnfa_find_initial_match(epsnfa, input, input_len, start);
-        if (match_len) {
-            match_t m = {
-                .offset = start,
-                .length = match_len,
-                .line = line_num,
-                .col = col_num,
+    const size_t rest = input_len - start_offset + 1;
+    if (rest <= BITSTATE_MAX_BITS / self->state_num) {
+        return find_initial_match_bitstate(
+            self, input_str, input_len, start_offset, memory
+        );
+    }
+    return find_initial_match_simulate(
+        self, input_str, input_len, start_offset, memory
+    );
+}
+
+epsnfa
+epsnfa_reverse(const epsnfa* self, arena_t* arena)
+{
+    epsnfa output = epsnfa_new(self->state_num, self->transition_num, arena);
+    arena_t tmp_arena = arena_new(arena ? &arena->allocator : NULL);
+    size_t* fill = arena_alloc(&tmp_arena, self->state_num * sizeof(size_t));
+    size_t i, j;
+    for (i = 0; i < self->transition_num; i++) {
+        output.transition_offsets[self->transitions[i].to_state + 1]++;
+    }
+    for (i = 0; i < self->state_num; i++) {
+        output.transition_offsets[i + 1] += output.transition_offsets[i];
+    }
+    memcpy(fill, output.transition_offsets, self->state_num * sizeof(size_t));
+    for (i = 0; i < self->state_num; i++) {
+        for (j = self->transition_offsets[i];
+             j < self->transition_offsets[i + 1]; j++) {
+            const transition_t* t = &self->transitions[j];
+            output.transitions[fill[t->to_state]++] = (transition_t) {
+                .matcher = t->matcher,
+                .to_state = i,
             };
-            append(&matches, &m);
-            if (!is_global) {
-                break;
+        }
+    }
+    arena_free(&tmp_arena);
+    memcpy(
+        output.is_start.mask, self->is_finish.mask, self->is_finish.byte_size
+    );
+    memcpy(
+        output.is_finish.mask, self->is_start.mask, self->is_start.byte_size
+    );
+    output.char_class_pool = self->char_class_pool;
+    epsnfa_build_jump_table(&output);
+    return output;
+}
+
+size_t
+epsnfa_find_leftmost_start(
+    const epsnfa* reverse, const char* input_str, const size_t input_len,
+    const size_t end, const size_t limit, nfa_memory_t* memory
+)
+{
+    dynarr_t* cur = &memory->cur_states;
+    dynarr_t* next = &memory->next_states;
+    size_t* stamps;
+    size_t i, j, pos, leftmost = NFA_NO_START;
+    if (memory->stamps.size < reverse->state_num) {
+        dynarr_resize(&memory->stamps, reverse->state_num);
+    }
+    stamps = memory->stamps.data;
+    cur->size = 0;
+    memory->generation++;
+    for (i = 0; i < reverse->state_num; i++) {
+        if (bitmask_contains(&reverse->is_start, i)) {
+            stamps[i] = memory->generation;
+            append(cur, &i);
+        }
+    }
+    for (pos = end;; pos--) {
+        dynarr_t* tmp;
+        add_anchor_closure(reverse, input_str, input_len, pos, cur, memory);
+        if (pos < end) {
+            for (i = 0; i < cur->size; i++) {
+                if (bitmask_contains(
+                        &reverse->is_finish, *(size_t*)at(cur, i)
+                    )) {
+                    leftmost = pos;
+                    break;
+                }
             }
         }
-        /* update line and col from start to start + match_len */
-        for (i = 0; i < (match_len ? match_len : 1); i++) {
-            if (start && input[start + i] == '\n') {
-                line_num++;
-                col_num = 1;
-            } else {
-                col_num++;
+        if (pos <= limit || cur->size == 0) {
+            break;
+        }
+        next->size = 0;
+        memory->generation++;
+        for (i = 0; i < cur->size; i++) {
+            const uint32_t* row = epsnfa_jump_row(
+                reverse, *(size_t*)at(cur, i), input_str[pos - 1]
+            );
+            for (j = row[0]; j < row[1]; j++) {
+                size_t to = reverse->jump_targets[j];
+                if (stamps[to] != memory->generation) {
+                    stamps[to] = memory->generation;
+                    append(next, &to);
+                }
             }
         }
+        tmp = cur;
+        cur = next;
+        next = tmp;
     }
-    return matches;
+    return leftmost;
 }
 
-dynarr_t
-epsnfa_find_matches_multiline(
-    const epsnfa* epsnfa, const char* input, const int is_global
+size_t
+epsnfa_find_first_end(
+    const epsnfa* self, const char* input_str, const size_t input_len,
+    const size_t start, nfa_memory_t* memory
 )
 {
-    const size_t input_len = strlen(input);
-    size_t line_start = 0, line_end = 0, line_num = 1, line_len = 0;
-    size_t match_len = 0, i = 0;
-    dynarr_t matches = dynarr_new(sizeof(match_t));
-    while (line_start < input_len) {
-        while (input[line_end] != '\0' && input[line_end] != '\n') {
-            line_end++;
-        }
-        line_len = line_end + 1 - line_start;
-        for (i = 0; i < line_len; i++) {
-            match_len = epsnfa_find_initial_match(
-                epsnfa, &input[line_start], line_len, i
+    dynarr_t* cur = &memory->cur_states;
+    dynarr_t* next = &memory->next_states;
+    size_t* stamps;
+    size_t i, j, pos;
+    if (memory->stamps.size < self->state_num) {
+        dynarr_resize(&memory->stamps, self->state_num);
+    }
+    stamps = memory->stamps.data;
+    cur->size = 0;
+    memory->generation++;
+    for (pos = start;; pos++) {
+        dynarr_t* tmp;
+        add_anchor_closure(self, input_str, input_len, pos, cur, memory);
+        for (i = 0; i < cur->size; i++) {
+            if (bitmask_contains(&self->is_finish, *(size_t*)at(cur, i))) {
+                return pos;
+            }
+        }
+        if (pos >= input_len) {
+            return NFA_NO_END;
+        }
+        /* a match that starts here is not over yet, so it is added after
+           the accept is known */
+        for (i = 0; i < self->state_num; i++) {
+            if (bitmask_contains(&self->is_start, i)
+                && stamps[i] != memory->generation) {
+                stamps[i] = memory->generation;
+                append(cur, &i);
+            }
+        }
+        add_anchor_closure(self, input_str, input_len, pos, cur, memory);
+        next->size = 0;
+        memory->generation++;
+        for (i = 0; i < cur->size; i++) {
+            const uint32_t* row = epsnfa_jump_row(
+                self, *(size_t*)at(cur, i), input_str[pos]
             );
-            if (match_len) {
-                match_t m = {
-                    .offset = line_start + i,
-                    .length = match_len,
-                    .line = line_num,
-                    .col = i + 1,
-                };
-                append(&matches, &m);
-                if (!is_global) {
-                    break;
+            for (j = row[0]; j < row[1]; j++) {
+                size_t to = self->jump_targets[j];
+                if (stamps[to] != memory->generation) {
+                    stamps[to] = memory->generation;
+                    append(next, &to);
                 }
             }
         }
-        line_num++;
-        /* line_end + 1 because line_end points to a newline or EOF */
-        line_start = line_end + 1;
-        line_end = line_start;
+        tmp = cur;
+        cur = next;
+        next = tmp;
+    }
+}
+
+pike_memory_t
+pike_memory_new(arena_t* arena)
+{
+    return (pike_memory_t) {
+        .thread_transitions = {
+            dynarr_new_in(arena, sizeof(size_t)),
+            dynarr_new_in(arena, sizeof(size_t)),
+        },
+        .thread_slots = {
+            dynarr_new_in(arena, sizeof(size_t)),
+            dynarr_new_in(arena, sizeof(size_t)),
+        },
+        .work_slots = dynarr_new_in(arena, sizeof(size_t)),
+        .stamps = dynarr_new_in(arena, sizeof(size_t)),
+        .jobs = dynarr_new_in(arena, sizeof(pike_job_t)),
+        .generation = 0,
+    };
+}
+
+/* add the threads that the epsilon closure of state reaches at pos to list,
+   in priority order. a thread waits on one consuming transition, or on the
+   final state. a state that is already done was reached with a higher
+   priority, so it is skipped */
+static void
+pike_add_thread(
+    const capnfa* self, const char* input_str, const size_t input_len,
+    const size_t pos, size_t state, pike_memory_t* memory, int list
+)
+{
+    const size_t slot_num = 2 * self->group_num;
+    size_t* slots = memory->work_slots.data;
+    size_t* stamps = memory->stamps.data;
+    size_t j;
+    pike_job_t job = { .kind = PIKE_JOB_EXPLORE, .state = state };
+    memory->jobs.size = 0;
+    append(&memory->jobs, &job);
+    while (memory->jobs.size > 0) {
+        job = *(pike_job_t*)back(&memory->jobs);
+        pop(&memory->jobs);
+        if (job.kind == PIKE_JOB_RESTORE) {
+            slots[job.slot] = job.value;
+            continue;
+        }
+        if (job.kind == PIKE_JOB_THREAD) {
+            append(&memory->thread_transitions[list], &job.state);
+            for (j = 0; j < slot_num; j++) {
+                append(&memory->thread_slots[list], &slots[j]);
+            }
+            continue;
+        }
+        if (job.kind == PIKE_JOB_SAVE) {
+            /* put the slot back once everything after the save is done */
+            pike_job_t restore = {
+                .kind = PIKE_JOB_RESTORE,
+                .slot = job.slot,
+                .value = slots[job.slot],
+            };
+            append(&memory->jobs, &restore);
+            slots[job.slot] = pos;
+        }
+        if (stamps[job.state] == memory->generation) {
+            continue;
+        }
+        stamps[job.state] = memory->generation;
+        if (job.state == self->final_state) {
+            pike_job_t thread = {
+                .kind = PIKE_JOB_THREAD,
+                .state = PIKE_FINAL_THREAD,
+            };
+            append(&memory->jobs, &thread);
+            continue;
+        }
+        /* push in reverse so that the first transition is done first */
+        for (j = self->transition_offsets[job.state + 1];
+             j > self->transition_offsets[job.state]; j--) {
+            const transition_t* t = &self->transitions[j - 1];
+            pike_job_t next = {
+                .kind = PIKE_JOB_EXPLORE,
+                .state = t->to_state,
+            };
+            if ((t->matcher.flag & MATCHER_FLAG_EPS) == 0) {
+                next.kind = PIKE_JOB_THREAD;
+                next.state = j - 1;
+            } else if (t->matcher.flag & MATCHER_FLAG_SAVE) {
+                next.kind = PIKE_JOB_SAVE;
+                next.slot = t->matcher.payload;
+            } else if ((t->matcher.flag & MATCHER_FLAG_ANCHOR)
+                       && !match_anchor(
+                           t->matcher.payload, get_behind(input_str, pos),
+                           get_ahead(input_str, input_len, pos)
+                       )) {
+                continue;
+            }
+            append(&memory->jobs, &next);
+        }
+    }
+}
+
+int
+capnfa_find_groups(
+    const capnfa* self, const char* input_str, const size_t input_len,
+    const size_t offset, const size_t length, pike_memory_t* memory,
+    size_t* slots
+)
+{
+    const size_t slot_num = 2 * self->group_num;
+    size_t pos, i;
+    int cur = 0;
+    dynarr_resize(&memory->work_slots, slot_num);
+    if (memory->stamps.size < self->state_num) {
+        dynarr_resize(&memory->stamps, self->state_num);
+    }
+    for (i = 0; i < slot_num; i++) {
+        ((size_t*)memory->work_slots.data)[i] = CAPNFA_NO_SLOT;
+    }
+    memory->thread_transitions[cur].size = 0;
+    memory->thread_slots[cur].size = 0;
+    memory->generation++;
+    pike_add_thread(
+        self, input_str, input_len, offset, self->start_state, memory, cur
+    );
+    for (pos = offset; pos < offset + length; pos++) {
+        const unsigned char c = input_str[pos];
+        const int next = !cur;
+        memory->thread_transitions[next].size = 0;
+        memory->thread_slots[next].size = 0;
+        memory->generation++;
+        for (i = 0; i < memory->thread_transitions[cur].size; i++) {
+            size_t j = *(size_t*)at(&memory->thread_transitions[cur], i);
+            const transition_t* t = &self->transitions[j];
+            int is_matched;
+            if (j == PIKE_FINAL_THREAD) {
+                continue;
+            }
+            if (t->matcher.flag & MATCHER_FLAG_CLASS) {
+                char_class_t* cc
+                    = at(&self->char_class_pool, t->matcher.payload);
+                is_matched = match_class(*cc, c);
+            } else {
+                is_matched = match_byte(t->matcher, c);
+            }
+            if (!is_matched) {
+                continue;
+            }
+            /* the thread's slots are copied because the list can move */
+            memcpy(
+                memory->work_slots.data,
+                at(&memory->thread_slots[cur], i * slot_num),
+                slot_num * sizeof(size_t)
+            );
+            pike_add_thread(
+                self, input_str, input_len, pos + 1, t->to_state, memory, next
+            );
+        }
+        cur = next;
+    }
+    for (i = 0; i < memory->thread_transitions[cur].size; i++) {
+        size_t j = *(size_t*)at(&memory->thread_transitions[cur], i);
+        if (j == PIKE_FINAL_THREAD) {
+            memcpy(
+                slots, at(&memory->thread_slots[cur], i * slot_num),
+                slot_num * sizeof(size_t)
+            );
+            return 1;
+        }
     }
-    return matches;
+    return 0;
 }
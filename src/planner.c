@@ -0,0 +1,413 @@
+#include "planner.h"
+#include "byte_scan.h"
+#include "dfa.h"
+#include "re_token.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char* ENGINE_NAME_STRS[] = { "literal", "dfa", "nfa" };
+static const char* SCAN_NAME_STRS[] = {
+    "none", "prefix", "first bytes", "first byte range", "first byte bitmap",
+};
+
+/* take the bytes at the front of the concatenation at the root, through
+   groups and past anchors, which take no bytes. the pattern is a literal if
+   nothing else is found. with RE_FLAG_IGNORE_CASE the letters are kept in
+   lower case. with RE_FLAG_SINGLE_LINE a newline matches nothing, so the
+   prefix stops before it */
+static void
+find_prefix(
+    const re_ast_t* re_ast, const int flags, plan_t* plan, arena_t* arena
+)
+{
+    dynarr_t stack = dynarr_new_in(arena, sizeof(int));
+    dynarr_t prefix = dynarr_new_in(arena, sizeof(unsigned char));
+    plan->is_literal = 1;
+    append(&stack, &re_ast->root);
+    while (stack.size > 0) {
+        int i = *(int*)back(&stack);
+        re_token_t* t = &re_ast->tokens[i];
+        pop(&stack);
+        if (t->type == TYPE_BOP && t->payload.op == OP_CONCAT) {
+            append(&stack, &re_ast->rights[i]);
+            append(&stack, &re_ast->lefts[i]);
+        } else if (t->type == TYPE_GROUP) {
+            append(&stack, &re_ast->lefts[i]);
+        } else if (t->type == TYPE_BYTE
+                   && !((flags & RE_FLAG_SINGLE_LINE)
+                        && t->payload.byte == '\n')) {
+            unsigned char c = t->payload.byte;
+            if ((flags & RE_FLAG_IGNORE_CASE) && isalpha(c)) {
+                c = tolower(c);
+                plan->is_prefix_folded = 1;
+            }
+            append(&prefix, &c);
+        } else if (t->type == TYPE_ANCHOR) {
+            plan->is_literal = 0;
+        } else {
+            plan->is_literal = 0;
+            break;
+        }
+    }
+    plan->prefix = prefix.data;
+    plan->prefix_len = prefix.size;
+}
+
+static inline int
+has_first_byte(const plan_t* plan, const int c)
+{
+    return plan->first_bytes[c / 8] & (1 << (c % 8));
+}
+
+/* add the bytes that the consuming transitions take from the start states
+   and from the states their anchors lead to, to bitmap. an anchor could
+   fail, so this may take more bytes than needed but never fewer. return
+   the number of bytes */
+static int
+find_first_bytes(const epsnfa* nfa, unsigned char* bitmap, arena_t* arena)
+{
+    arena_t tmp_arena = arena_new(arena ? &arena->allocator : NULL);
+    dynarr_t states = dynarr_new_in(&tmp_arena, sizeof(size_t));
+    bitmask_t is_seen = bitmask_new_in(&tmp_arena, nfa->state_num);
+    unsigned char has_class[256] = { 0 };
+    size_t i, j, k;
+    int c, byte_num = 0;
+    for (i = 0; i < nfa->state_num; i++) {
+        if (bitmask_contains(&nfa->is_start, i)) {
+            bitmask_add(&is_seen, i);
+            append(&states, &i);
+        }
+    }
+    for (i = 0; i < states.size; i++) {
+        const size_t s = *(size_t*)at(&states, i);
+        const uint32_t* row = nfa->jump_offsets + s * nfa->class_num;
+        for (j = nfa->anchor_offsets[s]; j < nfa->anchor_offsets[s + 1]; j++) {
+            size_t to = nfa->anchor_transitions[j].to_state;
+            if (!bitmask_contains(&is_seen, to)) {
+                bitmask_add(&is_seen, to);
+                append(&states, &to);
+            }
+        }
+        for (k = 0; k < nfa->class_num; k++) {
+            if (row[k] < row[k + 1]) {
+                has_class[k] = 1;
+            }
+        }
+    }
+    for (c = 0; c < 256; c++) {
+        if (has_class[nfa->byte_classes[c]]) {
+            bitmap[c / 8] |= 1 << (c % 8);
+            byte_num++;
+        }
+    }
+    arena_free(&tmp_arena);
+    return byte_num;
+}
+
+/* is every transition out of the start states a "^" */
+static int
+find_start_anchored(const epsnfa* nfa)
+{
+    size_t i, j;
+    for (i = 0; i < nfa->state_num; i++) {
+        if (!bitmask_contains(&nfa->is_start, i)) {
+            continue;
+        }
+        for (j = nfa->transition_offsets[i];
+             j < nfa->transition_offsets[i + 1]; j++) {
+            const matcher_t m = nfa->transitions[j].matcher;
+            if (!(m.flag & MATCHER_FLAG_ANCHOR)
+                || m.payload != ANCHOR_START) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* every transition into a final state must be the same "$", then a match
+   can only end where it holds. the line "$" is only used if no transition
+   takes a newline, so that the matches of a line end at its end */
+static enum PLAN_END_ANCHOR
+find_end_anchor(const epsnfa* nfa)
+{
+    int anchor = -1;
+    size_t i, s;
+    for (i = 0; i < nfa->transition_num; i++) {
+        const transition_t* t = &nfa->transitions[i];
+        if (!bitmask_contains(&nfa->is_finish, t->to_state)) {
+            continue;
+        }
+        if (!(t->matcher.flag & MATCHER_FLAG_ANCHOR)
+            || (t->matcher.payload != ANCHOR_END
+                && t->matcher.payload != ANCHOR_LINE_END)
+            || (anchor != -1 && (int)t->matcher.payload != anchor)) {
+            return PLAN_END_ANY;
+        }
+        anchor = t->matcher.payload;
+    }
+    if (anchor == ANCHOR_END) {
+        return PLAN_END_INPUT;
+    }
+    if (anchor == -1) {
+        return PLAN_END_ANY;
+    }
+    for (s = 0; s < nfa->state_num; s++) {
+        const uint32_t* row = epsnfa_jump_row(nfa, s, '\n');
+        if (row[0] < row[1]) {
+            return PLAN_END_ANY;
+        }
+    }
+    return PLAN_END_LINE;
+}
+
+/* pick the scan for the prefix and the first bytes */
+static void
+plan_scan(plan_t* plan)
+{
+    int c, n = 0, lo = -1, hi = -1;
+    if (plan->prefix_len > 1) {
+        plan->scan = PLAN_SCAN_PREFIX;
+        return;
+    }
+    if (plan->first_byte_num > PLAN_SCAN_MAX_FIRST_BYTES) {
+        plan->scan = PLAN_SCAN_NONE;
+        return;
+    }
+    for (c = 0; c < 256; c++) {
+        if (has_first_byte(plan, c)) {
+            if (n < 3) {
+                plan->scan_bytes[n] = c;
+            }
+            n++;
+            lo = lo == -1 ? c : lo;
+            hi = c;
+        }
+    }
+    if (n >= 1 && n <= 3) {
+        /* pad with the first byte, so three compares always work */
+        for (c = n; c < 3; c++) {
+            plan->scan_bytes[c] = plan->scan_bytes[0];
+        }
+        plan->scan = PLAN_SCAN_BYTES;
+    } else if (n > 0 && hi - lo + 1 == n) {
+        plan->scan_bytes[0] = lo;
+        plan->scan_bytes[1] = hi;
+        plan->scan = PLAN_SCAN_RANGE;
+    } else {
+        plan->scan = PLAN_SCAN_BITMAP;
+    }
+}
+
+plan_t
+plan_new(
+    const re_ast_t* re_ast, const epsnfa* nfa, const int flags, arena_t* arena
+)
+{
+    plan_t plan = {
+        .engine = PLAN_ENGINE_NFA,
+        .jit = { .match = NULL, .scan = NULL, .memory = NULL },
+        .scan = PLAN_SCAN_NONE,
+        .prefix = NULL,
+        .prefix_len = 0,
+        .is_prefix_folded = 0,
+        .first_bytes = { 0 },
+        .first_byte_num = 0,
+        .last_bytes = { 0 },
+        .scan_bytes = { 0 },
+        .is_start_anchored = 0,
+        .end_anchor = PLAN_END_ANY,
+        .is_literal = 0,
+        .has_anchor = 0,
+        .group_num = re_ast->group_num,
+        .state_num = nfa->state_num,
+        .transition_num = nfa->transition_num,
+    };
+    int i;
+    for (i = 0; i < re_ast->size; i++) {
+        const re_token_t* t = &re_ast->tokens[i];
+        if (t->type == TYPE_ANCHOR) {
+            plan.has_anchor = 1;
+        }
+    }
+    if (re_ast->size > 0) {
+        find_prefix(re_ast, flags, &plan, arena);
+    }
+    plan.first_byte_num = find_first_bytes(nfa, plan.first_bytes, arena);
+    plan_scan(&plan);
+    plan.is_start_anchored = find_start_anchored(nfa);
+    if (!plan.is_start_anchored) {
+        plan.end_anchor = find_end_anchor(nfa);
+    }
+    /* a scan back from every line end costs more than a literal scan that
+       skips most lines */
+    if (plan.end_anchor == PLAN_END_LINE
+        && (plan.scan == PLAN_SCAN_PREFIX || plan.scan == PLAN_SCAN_BYTES)) {
+        plan.end_anchor = PLAN_END_ANY;
+    }
+    if (plan.is_literal && plan.prefix_len > 0) {
+        plan.engine = PLAN_ENGINE_LITERAL;
+    } else if (nfa->state_num <= PLAN_DFA_MAX_STATES) {
+        plan.engine = PLAN_ENGINE_DFA;
+    }
+    /* the code takes the place of the lazy dfa, which stays when the dfas
+       cannot be compiled */
+    if (plan.engine == PLAN_ENGINE_DFA && (flags & RE_FLAG_JIT)) {
+        plan.jit = jit_compile(nfa, plan.scan != PLAN_SCAN_NONE, arena);
+    }
+    /* the lazy dfa also finds the start of a match with it */
+    if (plan.end_anchor != PLAN_END_ANY || plan.engine == PLAN_ENGINE_DFA) {
+        plan.reverse = epsnfa_reverse(nfa, arena);
+        find_first_bytes(&plan.reverse, plan.last_bytes, arena);
+    }
+    return plan;
+}
+
+void
+plan_free(plan_t* self)
+{
+    jit_free(&self->jit);
+}
+
+static size_t
+print_byte(unsigned char c)
+{
+    return isprint(c) ? printf("%c", c) : printf("\\x%02x", c);
+}
+
+/* the first bytes as ranges, like a bracket expression */
+static size_t
+print_first_bytes(const plan_t* self)
+{
+    size_t byte_count = 0;
+    int c = 0, end;
+    while (c < 256) {
+        if (!has_first_byte(self, c)) {
+            c++;
+            continue;
+        }
+        for (end = c; end + 1 < 256 && has_first_byte(self, end + 1); end++)
+            ;
+        byte_count += print_byte(c);
+        if (end > c) {
+            byte_count += printf("-");
+            byte_count += print_byte(end);
+        }
+        c = end + 1;
+    }
+    return byte_count;
+}
+
+size_t
+plan_print(const plan_t* self)
+{
+    size_t i, byte_count = 0;
+    byte_count += printf("---- PRINT PLAN ----\n");
+    byte_count += printf("engine: %s\n", ENGINE_NAME_STRS[self->engine]);
+    if (self->engine == PLAN_ENGINE_DFA && self->jit.match != NULL) {
+        byte_count += printf(
+            "  dfas of %lu and %lu unanchored states in %lu bytes of x86-64 "
+            "code\n",
+            self->jit.state_num, self->jit.scan_state_num,
+            self->jit.code_size
+        );
+    } else if (self->engine == PLAN_ENGINE_DFA) {
+        byte_count += printf(
+            "  lazy dfa of at most %d cached states, the nfa takes over if "
+            "the cache thrashes\n",
+            DFA_CACHE_MAX_STATES
+        );
+    }
+    /* the code never gives up on the input */
+    if ((self->engine == PLAN_ENGINE_DFA && self->jit.match == NULL)
+        || self->engine == PLAN_ENGINE_NFA) {
+        byte_count += printf(
+            "  nfa: bitstate backtracker when %d bits cover the rest of the "
+            "input, otherwise state set simulation\n",
+            BITSTATE_MAX_BITS
+        );
+    }
+    byte_count += printf("prefilter: %s", SCAN_NAME_STRS[self->scan]);
+    if (self->scan == PLAN_SCAN_PREFIX) {
+        byte_count += printf(" \"");
+        for (i = 0; i < self->prefix_len; i++) {
+            byte_count += print_byte(self->prefix[i]);
+        }
+        byte_count += printf("\"");
+        if (self->is_prefix_folded) {
+            byte_count += printf(" in either case");
+        }
+    } else if (self->scan != PLAN_SCAN_NONE) {
+        byte_count += printf(" [");
+        byte_count += print_first_bytes(self);
+        byte_count += printf("]");
+    }
+    byte_count += printf("\n");
+    if (self->is_start_anchored) {
+        byte_count += printf("anchored: start, only offset 0 is tried\n");
+    } else if (self->end_anchor == PLAN_END_INPUT) {
+        byte_count += printf(
+            "anchored: end, scan back from the end of input\n"
+        );
+    } else if (self->end_anchor == PLAN_END_LINE) {
+        byte_count += printf(
+            "anchored: line end, scan back from the end of each line\n"
+        );
+    }
+    byte_count += printf(
+        "states: %lu\ntransitions: %lu\nliteral: %s\nanchors: %s\n"
+        "groups: %d\n",
+        self->state_num, self->transition_num,
+        self->is_literal ? "yes" : "no", self->has_anchor ? "yes" : "no",
+        self->group_num
+    );
+    byte_count += printf("--------------------\n");
+    return byte_count;
+}
+
+size_t
+plan_next_candidate(
+    const plan_t* self, const char* input_str, const size_t input_len,
+    const size_t start
+)
+{
+    size_t pos = start;
+    switch (self->scan) {
+    case PLAN_SCAN_NONE:
+        return start;
+    case PLAN_SCAN_BYTES:
+        if (self->scan_bytes[0] == self->scan_bytes[1]
+            && self->scan_bytes[0] == self->scan_bytes[2]) {
+            return scan_byte(input_str, input_len, start, self->scan_bytes[0]);
+        }
+        return scan_byte3(
+            input_str, input_len, start, self->scan_bytes[0],
+            self->scan_bytes[1], self->scan_bytes[2]
+        );
+    case PLAN_SCAN_RANGE:
+        return scan_range(
+            input_str, input_len, start, self->scan_bytes[0],
+            self->scan_bytes[1]
+        );
+    case PLAN_SCAN_BITMAP:
+        return scan_bitmap(input_str, input_len, start, self->first_bytes);
+    case PLAN_SCAN_PREFIX:
+        break;
+    }
+    while (pos + self->prefix_len <= input_len) {
+        if (self->is_prefix_folded && isalpha(self->prefix[0])) {
+            pos = scan_byte_folded(input_str, input_len, pos, self->prefix[0]);
+        } else {
+            pos = scan_byte(input_str, input_len, pos, self->prefix[0]);
+        }
+        if (pos + self->prefix_len > input_len) {
+            break;
+        }
+        if (plan_is_prefix_at(self, input_str + pos)) {
+            return pos;
+        }
+        pos++;
+    }
+    return input_len;
+}
@@ -1,8 +1,12 @@
 #include "re_token.h"
 #include "re_ast.h"
+#include "glushkov.h"
+#include "minimize.h"
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 
+/* only for an ast that is parsed without an arena */
 void
 re_ast_free(re_ast_t* ast)
 {
@@ -20,31 +24,940 @@ re_ast_free(re_ast_t* ast)
     }
 }
 
-epsnfa
-re_ast_to_nfa(const re_ast_t* re_ast, const int is_debug)
+matcher_t
+re_token_to_matcher(
+    const re_token_t* token, const int flags, dynarr_t* char_class_pool,
+    nacre_error_t* error
+)
 {
-    epsnfa result;
-    tepsnfa* nfas;
-    unsigned char* is_visited;
-    dynarr_t index_stack;
-    dynarr_t char_class_pool = dynarr_new(sizeof(char_class_t));
+    const int is_single_line = (flags & RE_FLAG_SINGLE_LINE) != 0;
+    char_class_t* cc;
+    int c;
+    switch (token->type) {
+    case TYPE_BYTE:
+        if (((flags & RE_FLAG_IGNORE_CASE) && isalpha(token->payload.byte))
+            || (is_single_line && token->payload.byte == '\n')) {
+            /* the newline gets the empty class */
+            char_class_t both = { .bitmap = { 0 }, .is_negated = 0 };
+            if (token->payload.byte != '\n') {
+                char_class_set(&both, token->payload.byte);
+                char_class_fold_case(&both);
+            }
+            append(char_class_pool, &both);
+            return class_matcher(char_class_pool->size - 1);
+        }
+        return byte_matcher(token->payload.byte);
+    case TYPE_WC:
+        if (is_single_line && match_wc(token->payload.wc, '\n')) {
+            char_class_t without_newline = { .bitmap = { 0 }, .is_negated = 0 };
+            for (c = 0; c < 256; c++) {
+                if (c != '\n' && match_wc(token->payload.wc, c)) {
+                    char_class_set(&without_newline, c);
+                }
+            }
+            append(char_class_pool, &without_newline);
+            return class_matcher(char_class_pool->size - 1);
+        }
+        return wc_matcher(token->payload.wc);
+    case TYPE_CLASS:
+        append(char_class_pool, &token->payload.class);
+        cc = back(char_class_pool);
+        if (flags & RE_FLAG_IGNORE_CASE) {
+            char_class_fold_case(cc);
+        }
+        if (is_single_line) {
+            /* a negated class misses the newline if it is in the bitmap */
+            if (cc->is_negated) {
+                char_class_set(cc, '\n');
+            } else {
+                char_class_unset(cc, '\n');
+            }
+        }
+        return class_matcher(char_class_pool->size - 1);
+    case TYPE_ANCHOR: {
+        enum ANCHOR_NAME anch = token->payload.anch;
+        if (flags & RE_FLAG_MULTILINE) {
+            if (anch == ANCHOR_START) {
+                anch = ANCHOR_LINE_START;
+            } else if (anch == ANCHOR_END) {
+                anch = ANCHOR_LINE_END;
+            }
+        }
+        return anchor_matcher(anch);
+    }
+    default:
+        re_error_set(
+            error, NACRE_ERROR_SYNTAX, "token type %d has no matcher",
+            token->type
+        );
+        return eps_matcher();
+    }
+}
+
+/* the arrays of an ast under construction */
+typedef struct ast_builder {
+    dynarr_t tokens; /* type: re_token_t */
+    dynarr_t lefts; /* type: int */
+    dynarr_t rights; /* type: int */
+    dynarr_t begins; /* type: int, the first index of the subtree */
+} ast_builder_t;
+
+static int
+ast_push(ast_builder_t* b, re_token_t token, int left, int right)
+{
+    int index = b->tokens.size;
+    int begin = index;
+    if (left != -1) {
+        begin = *(int*)at(&b->begins, left);
+    }
+    if (right != -1 && *(int*)at(&b->begins, right) < begin) {
+        begin = *(int*)at(&b->begins, right);
+    }
+    append(&b->tokens, &token);
+    append(&b->lefts, &left);
+    append(&b->rights, &right);
+    append(&b->begins, &begin);
+    return index;
+}
+
+/* copy the subtree at root to the end, return the root of the copy */
+static int
+ast_copy(ast_builder_t* b, int root)
+{
+    int begin = *(int*)at(&b->begins, root);
+    int shift = b->tokens.size - begin;
+    int i;
+    for (i = begin; i <= root; i++) {
+        re_token_t token = *(re_token_t*)at(&b->tokens, i);
+        int left = *(int*)at(&b->lefts, i);
+        int right = *(int*)at(&b->rights, i);
+        ast_push(
+            b, token, left == -1 ? -1 : left + shift,
+            right == -1 ? -1 : right + shift
+        );
+    }
+    return root + shift;
+}
+
+static int
+ast_take(ast_builder_t* b, int root, int* is_taken)
+{
+    if (*is_taken) {
+        return ast_copy(b, root);
+    }
+    *is_taken = 1;
+    return root;
+}
+
+re_ast_t
+re_ast_expand_dups(const re_ast_t* re_ast, arena_t* arena)
+{
+    const re_token_t concat_op = {
+        .type = TYPE_BOP,
+        .payload = { .op = OP_CONCAT },
+    };
+    const re_token_t star_op = {
+        .type = TYPE_UOP,
+        .payload = { .op = OP_STAR },
+    };
+    const re_token_t opt_op = {
+        .type = TYPE_UOP,
+        .payload = { .op = OP_OPT },
+    };
+    ast_builder_t b = {
+        .tokens = dynarr_new_in(arena, sizeof(re_token_t)),
+        .lefts = dynarr_new_in(arena, sizeof(int)),
+        .rights = dynarr_new_in(arena, sizeof(int)),
+        .begins = dynarr_new_in(arena, sizeof(int)),
+    };
+    int* new_index = arena_alloc(arena, (re_ast->size + 1) * sizeof(int));
+    int i, j;
+    /* the tokens are in postfix order so the children are always done */
+    for (i = 0; i < re_ast->size; i++) {
+        re_token_t token = re_ast->tokens[i];
+        int left = re_ast->lefts[i] == -1 ? -1 : new_index[re_ast->lefts[i]];
+        int right
+            = re_ast->rights[i] == -1 ? -1 : new_index[re_ast->rights[i]];
+        dup_payload_t dup = token.payload.dup;
+        int result = -1, piece, is_taken = 0;
+        if (token.type != TYPE_DUP || (dup.min == 0 && dup.max == 0)) {
+            new_index[i] = ast_push(&b, token, left, right);
+            continue;
+        }
+        for (j = 0; j < dup.min; j++) {
+            piece = ast_take(&b, left, &is_taken);
+            result = result == -1 ? piece
+                                  : ast_push(&b, concat_op, result, piece);
+        }
+        if (dup.max == DUP_NO_MAX) {
+            piece = ast_take(&b, left, &is_taken);
+            piece = ast_push(&b, star_op, piece, -1);
+            result = result == -1 ? piece
+                                  : ast_push(&b, concat_op, result, piece);
+        } else if (dup.max > dup.min) {
+            /* the optional tail is made from the inside out */
+            int tail = ast_take(&b, left, &is_taken);
+            tail = ast_push(&b, opt_op, tail, -1);
+            for (j = 1; j < dup.max - dup.min; j++) {
+                piece = ast_take(&b, left, &is_taken);
+                tail = ast_push(&b, concat_op, piece, tail);
+                tail = ast_push(&b, opt_op, tail, -1);
+            }
+            result = result == -1 ? tail
+                                  : ast_push(&b, concat_op, result, tail);
+        }
+        new_index[i] = result;
+    }
+    return (re_ast_t) {
+        .tokens = b.tokens.data,
+        .lefts = b.lefts.data,
+        .rights = b.rights.data,
+        .size = b.tokens.size,
+        .root = new_index[re_ast->root],
+        .group_num = re_ast->group_num,
+    };
+}
+
+re_ast_t
+re_ast_wrap_anchors(
+    const re_ast_t* re_ast, const enum ANCHOR_NAME before,
+    const enum ANCHOR_NAME after, arena_t* arena
+)
+{
+    const re_token_t concat_op = {
+        .type = TYPE_BOP,
+        .payload = { .op = OP_CONCAT },
+    };
+    const re_token_t before_token = {
+        .type = TYPE_ANCHOR,
+        .payload = { .anch = before },
+    };
+    const re_token_t after_token = {
+        .type = TYPE_ANCHOR,
+        .payload = { .anch = after },
+    };
+    ast_builder_t b = {
+        .tokens = dynarr_new_in(arena, sizeof(re_token_t)),
+        .lefts = dynarr_new_in(arena, sizeof(int)),
+        .rights = dynarr_new_in(arena, sizeof(int)),
+        .begins = dynarr_new_in(arena, sizeof(int)),
+    };
+    int i, root, after_index;
+    /* everything moves one place for the anchor in front */
+    ast_push(&b, before_token, -1, -1);
+    for (i = 0; i < re_ast->size; i++) {
+        ast_push(
+            &b, re_ast->tokens[i],
+            re_ast->lefts[i] == -1 ? -1 : re_ast->lefts[i] + 1,
+            re_ast->rights[i] == -1 ? -1 : re_ast->rights[i] + 1
+        );
+    }
+    root = ast_push(&b, concat_op, 0, re_ast->root + 1);
+    after_index = ast_push(&b, after_token, -1, -1);
+    root = ast_push(&b, concat_op, root, after_index);
+    return (re_ast_t) {
+        .tokens = b.tokens.data,
+        .lefts = b.lefts.data,
+        .rights = b.rights.data,
+        .size = b.tokens.size,
+        .root = root,
+        .group_num = re_ast->group_num,
+    };
+}
+
+/* the working state of re_ast_simplify. the rewritten nodes are pushed to
+   b and can share subtrees, which are copied apart at the end */
+typedef struct simplifier {
+    ast_builder_t b;
+    arena_t* arena;
+    dynarr_t pairs; /* type: int, the stack of subtree_equal */
+} simplifier_t;
+
+/* a run of atoms in simplifier_atoms, the concatenation of an alternative */
+typedef struct atom_range {
+    int begin;
+    int end;
+} atom_range_t;
+
+/* an operand of a fixed repetition that is a literal of up to this many
+   bytes is written out, "ab{3}" becomes "abbb" */
+#define SIMPLIFY_MAX_LITERAL_RUN 64
+
+static inline re_token_t*
+ast_token(const ast_builder_t* b, const int index)
+{
+    return at(&b->tokens, index);
+}
+
+static inline int
+ast_left(const ast_builder_t* b, const int index)
+{
+    return *(int*)at(&b->lefts, index);
+}
+
+static inline int
+ast_right(const ast_builder_t* b, const int index)
+{
+    return *(int*)at(&b->rights, index);
+}
+
+static inline int
+is_bop(const re_token_t* t, const enum OPERATOR_NAME op)
+{
+    return t->type == TYPE_BOP && t->payload.op == op;
+}
+
+static int
+token_equal(const re_token_t* a, const re_token_t* b)
+{
+    if (a->type != b->type) {
+        return 0;
+    }
+    switch (a->type) {
+    case TYPE_BYTE:
+        return a->payload.byte == b->payload.byte;
+    case TYPE_WC:
+        return a->payload.wc == b->payload.wc;
+    case TYPE_CLASS:
+        return a->payload.class.is_negated == b->payload.class.is_negated
+            && memcmp(
+                   a->payload.class.bitmap, b->payload.class.bitmap,
+                   sizeof(a->payload.class.bitmap)
+               ) == 0;
+    case TYPE_DUP:
+        return a->payload.dup.min == b->payload.dup.min
+            && a->payload.dup.max == b->payload.dup.max;
+    case TYPE_ANCHOR:
+        return a->payload.anch == b->payload.anch;
+    case TYPE_GROUP:
+        return a->payload.group == b->payload.group;
+    default:
+        return a->payload.op == b->payload.op;
+    }
+}
+
+/* are the subtrees at x and y the same */
+static int
+subtree_equal(simplifier_t* s, const int x, const int y)
+{
+    int i, j, next[4];
+    s->pairs.size = 0;
+    append(&s->pairs, &x);
+    append(&s->pairs, &y);
+    while (s->pairs.size > 0) {
+        j = *(int*)back(&s->pairs);
+        pop(&s->pairs);
+        i = *(int*)back(&s->pairs);
+        pop(&s->pairs);
+        if (i == j) {
+            continue;
+        }
+        if (i == -1 || j == -1
+            || !token_equal(ast_token(&s->b, i), ast_token(&s->b, j))) {
+            return 0;
+        }
+        next[0] = ast_left(&s->b, i);
+        next[1] = ast_left(&s->b, j);
+        next[2] = ast_right(&s->b, i);
+        next[3] = ast_right(&s->b, j);
+        for (i = 0; i < 4; i++) {
+            append(&s->pairs, &next[i]);
+        }
+    }
+    return 1;
+}
+
+/* append the operands of the chain of op at root to atoms, in order */
+static void
+collect_operands(
+    simplifier_t* s, const int root, const enum OPERATOR_NAME op,
+    dynarr_t* atoms
+)
+{
+    dynarr_t stack = dynarr_new_in(s->arena, sizeof(int));
+    append(&stack, &root);
+    while (stack.size > 0) {
+        int i = *(int*)back(&stack);
+        pop(&stack);
+        if (is_bop(ast_token(&s->b, i), op)) {
+            int left = ast_left(&s->b, i), right = ast_right(&s->b, i);
+            append(&stack, &right);
+            append(&stack, &left);
+        } else {
+            append(atoms, &i);
+        }
+    }
+}
+
+static int
+push_bop(simplifier_t* s, const enum OPERATOR_NAME op, int left, int right)
+{
+    const re_token_t token = { .type = TYPE_BOP, .payload = { .op = op } };
+    return ast_push(&s->b, token, left, right);
+}
+
+static int
+push_uop(simplifier_t* s, const enum OPERATOR_NAME op, int left)
+{
+    const re_token_t token = { .type = TYPE_UOP, .payload = { .op = op } };
+    return ast_push(&s->b, token, left, -1);
+}
+
+/* the concatenation of atoms[range], which is not empty */
+static int
+push_concat(simplifier_t* s, const int* atoms, const atom_range_t range)
+{
+    int i, result = atoms[range.begin];
+    for (i = range.begin + 1; i < range.end; i++) {
+        result = push_bop(s, OP_CONCAT, result, atoms[i]);
+    }
+    return result;
+}
+
+/* a leaf that takes one byte of a set that a class can hold. a negated
+   class is left out, since ignoring case folds its bitmap before it is
+   negated */
+static int
+is_set_leaf(const re_token_t* t)
+{
+    return t->type == TYPE_BYTE || t->type == TYPE_WC
+        || (t->type == TYPE_CLASS && !t->payload.class.is_negated);
+}
+
+static void
+add_set_leaf(const re_token_t* t, char_class_t* cc)
+{
+    int c;
+    switch (t->type) {
+    case TYPE_BYTE:
+        char_class_set(cc, t->payload.byte);
+        break;
+    case TYPE_WC:
+        for (c = 0; c < 256; c++) {
+            if (match_wc(t->payload.wc, c)) {
+                char_class_set(cc, c);
+            }
+        }
+        break;
+    default:
+        for (c = 0; c < 32; c++) {
+            cc->bitmap[c] |= t->payload.class.bitmap[c];
+        }
+    }
+}
+
+static int
+factor_alternatives(
+    simplifier_t* s, const int* atoms, atom_range_t* seqs, const int seq_num
+);
+
+/* the alternation of the sequences with the common suffix of suffix_len
+   atoms taken off and put after it. empty_num of them are empty */
+static int
+factor_suffix(
+    simplifier_t* s, const int* atoms, atom_range_t* seqs, const int seq_num,
+    const int suffix_len, const int empty_num
+)
+{
+    atom_range_t* rest = arena_alloc(s->arena, seq_num * sizeof(atom_range_t));
+    atom_range_t suffix = { .begin = 0, .end = 0 };
+    int i, rest_num = 0, result;
+    for (i = 0; i < seq_num; i++) {
+        if (seqs[i].begin < seqs[i].end) {
+            suffix.begin = seqs[i].end - suffix_len;
+            suffix.end = seqs[i].end;
+            rest[rest_num].begin = seqs[i].begin;
+            rest[rest_num].end = seqs[i].end - suffix_len;
+            rest_num++;
+        }
+    }
+    result = factor_alternatives(s, atoms, rest, rest_num);
+    if (result == -1) {
+        result = push_concat(s, atoms, suffix);
+    } else {
+        result = push_bop(s, OP_CONCAT, result, push_concat(s, atoms, suffix));
+    }
+    return empty_num > 0 ? push_uop(s, OP_OPT, result) : result;
+}
+
+/* the alternation of the concatenations of atoms in seqs, with the common
+   prefixes and suffixes taken out and the alternatives that take one byte
+   put in one class. an empty sequence is the empty string, and -1 is
+   returned if every sequence is empty */
+static int
+factor_alternatives(
+    simplifier_t* s, const int* atoms, atom_range_t* seqs, const int seq_num
+)
+{
+    int* group_of = arena_alloc(s->arena, seq_num * sizeof(int));
+    dynarr_t heads = dynarr_new_in(s->arena, sizeof(int)); /* the seq */
+    dynarr_t alternatives = dynarr_new_in(s->arena, sizeof(int));
+    re_token_t class_token = {
+        .type = TYPE_CLASS,
+        .payload = { .class = { .bitmap = { 0 }, .is_negated = 0 } },
+    };
+    int i, j, k = 0, empty_num = 0, nonempty_num, suffix_len = -1;
+    int class_index = -1, set_num = 0, result;
+
+    /* the suffix that every sequence that is not empty ends with */
+    for (i = 0; i < seq_num; i++) {
+        int len = seqs[i].end - seqs[i].begin, common = 0;
+        if (len == 0) {
+            empty_num++;
+            continue;
+        }
+        if (suffix_len == -1) {
+            suffix_len = len;
+            k = i;
+            continue;
+        }
+        while (common < suffix_len && common < len
+               && subtree_equal(
+                   s, atoms[seqs[k].end - 1 - common],
+                   atoms[seqs[i].end - 1 - common]
+               )) {
+            common++;
+        }
+        suffix_len = common;
+    }
+    nonempty_num = seq_num - empty_num;
+    if (nonempty_num == 0) {
+        return -1;
+    }
+    if (nonempty_num > 1 && suffix_len > 0) {
+        return factor_suffix(s, atoms, seqs, seq_num, suffix_len, empty_num);
+    }
+
+    /* the sequences that start with the same atom share it */
+    for (i = 0; i < seq_num; i++) {
+        group_of[i] = -1;
+        if (seqs[i].begin == seqs[i].end) {
+            continue;
+        }
+        for (j = 0; j < (int)heads.size; j++) {
+            k = *(int*)at(&heads, j);
+            if (subtree_equal(s, atoms[seqs[k].begin], atoms[seqs[i].begin])) {
+                group_of[i] = j;
+                break;
+            }
+        }
+        if (group_of[i] == -1) {
+            group_of[i] = heads.size;
+            append(&heads, &i);
+        }
+    }
+    for (j = 0; j < (int)heads.size; j++) {
+        atom_range_t* tails
+            = arena_alloc(s->arena, seq_num * sizeof(atom_range_t));
+        int tail_num = 0, head = *(int*)at(&heads, j), tail;
+        for (i = 0; i < seq_num; i++) {
+            if (group_of[i] == j) {
+                tails[tail_num].begin = seqs[i].begin + 1;
+                tails[tail_num].end = seqs[i].end;
+                tail_num++;
+            }
+        }
+        if (tail_num == 1) {
+            result = push_concat(s, atoms, seqs[head]);
+        } else {
+            tail = factor_alternatives(s, atoms, tails, tail_num);
+            result = atoms[seqs[head].begin];
+            if (tail != -1) {
+                result = push_bop(s, OP_CONCAT, result, tail);
+            }
+        }
+        append(&alternatives, &result);
+    }
+
+    /* the alternatives that take one byte become one class */
+    for (j = 0; j < (int)alternatives.size; j++) {
+        const re_token_t* t
+            = ast_token(&s->b, *(int*)at(&alternatives, j));
+        if (is_set_leaf(t)) {
+            add_set_leaf(t, &class_token.payload.class);
+            set_num++;
+        }
+    }
+    result = -1;
+    for (j = 0; j < (int)alternatives.size; j++) {
+        int alternative = *(int*)at(&alternatives, j);
+        if (set_num > 1 && is_set_leaf(ast_token(&s->b, alternative))) {
+            if (class_index != -1) {
+                continue;
+            }
+            alternative = class_index = ast_push(&s->b, class_token, -1, -1);
+        }
+        result = result == -1 ? alternative
+                              : push_bop(s, OP_ALTER, result, alternative);
+    }
+    return empty_num > 0 ? push_uop(s, OP_OPT, result) : result;
+}
+
+/* factor the alternation at root, whose alternatives are simplified */
+static int
+simplify_alternation(simplifier_t* s, const int root)
+{
+    dynarr_t branches = dynarr_new_in(s->arena, sizeof(int));
+    dynarr_t atoms = dynarr_new_in(s->arena, sizeof(int));
+    atom_range_t* seqs;
+    size_t i;
+    collect_operands(s, root, OP_ALTER, &branches);
+    seqs = arena_alloc(s->arena, branches.size * sizeof(atom_range_t));
+    for (i = 0; i < branches.size; i++) {
+        seqs[i].begin = atoms.size;
+        collect_operands(s, *(int*)at(&branches, i), OP_CONCAT, &atoms);
+        seqs[i].end = atoms.size;
+    }
+    return factor_alternatives(s, atoms.data, seqs, branches.size);
+}
+
+/* a repetition of a unary operator. two of the same are one, and any other
+   two are a star */
+static int
+simplify_uop(simplifier_t* s, const re_token_t token, const int left)
+{
+    const re_token_t* inner = ast_token(&s->b, left);
+    if (inner->type != TYPE_UOP) {
+        return ast_push(&s->b, token, left, -1);
+    }
+    if (inner->payload.op == token.payload.op) {
+        return left;
+    }
+    return push_uop(s, OP_STAR, ast_left(&s->b, left));
+}
+
+/* write out a fixed repetition of a short literal, and drop "{1}" */
+static int
+simplify_dup(simplifier_t* s, const re_token_t token, const int left)
+{
+    const dup_payload_t dup = token.payload.dup;
+    dynarr_t atoms = dynarr_new_in(s->arena, sizeof(int));
+    atom_range_t range = { .begin = 0, .end = 0 };
+    size_t i;
+    int j, result;
+    if (dup.min == 1 && dup.max == 1) {
+        return left;
+    }
+    if (dup.min != dup.max || dup.min == 0) {
+        return ast_push(&s->b, token, left, -1);
+    }
+    collect_operands(s, left, OP_CONCAT, &atoms);
+    for (i = 0; i < atoms.size; i++) {
+        if (ast_token(&s->b, *(int*)at(&atoms, i))->type != TYPE_BYTE) {
+            return ast_push(&s->b, token, left, -1);
+        }
+    }
+    if (atoms.size * dup.min > SIMPLIFY_MAX_LITERAL_RUN) {
+        return ast_push(&s->b, token, left, -1);
+    }
+    range.end = atoms.size;
+    result = left;
+    for (j = 1; j < dup.min; j++) {
+        result = push_bop(
+            s, OP_CONCAT, result, push_concat(s, atoms.data, range)
+        );
+    }
+    return result;
+}
+
+/* copy the subtree at root from b to a new ast in postfix order, so that
+   a shared subtree becomes two and nothing else is left */
+static re_ast_t
+ast_compact(
+    const ast_builder_t* b, const int root, const int group_num,
+    arena_t* arena, arena_t* tmp_arena
+)
+{
+    ast_builder_t out = {
+        .tokens = dynarr_new_in(arena, sizeof(re_token_t)),
+        .lefts = dynarr_new_in(arena, sizeof(int)),
+        .rights = dynarr_new_in(arena, sizeof(int)),
+        .begins = dynarr_new_in(arena, sizeof(int)),
+    };
+    /* a node is pushed once to take its children and once to copy it */
+    dynarr_t stack = dynarr_new_in(tmp_arena, sizeof(int));
+    dynarr_t copies = dynarr_new_in(tmp_arena, sizeof(int));
+    int cur = root;
+    append(&stack, &cur);
+    while (stack.size > 0) {
+        int left, right, new_left = -1, new_right = -1, index;
+        cur = *(int*)back(&stack);
+        pop(&stack);
+        if (cur >= 0) {
+            int done = -cur - 1;
+            left = ast_left(b, cur);
+            right = ast_right(b, cur);
+            append(&stack, &done);
+            if (right != -1) {
+                append(&stack, &right);
+            }
+            if (left != -1) {
+                append(&stack, &left);
+            }
+            continue;
+        }
+        cur = -cur - 1;
+        if (ast_right(b, cur) != -1) {
+            new_right = *(int*)back(&copies);
+            pop(&copies);
+        }
+        if (ast_left(b, cur) != -1) {
+            new_left = *(int*)back(&copies);
+            pop(&copies);
+        }
+        index = ast_push(&out, *ast_token(b, cur), new_left, new_right);
+        append(&copies, &index);
+    }
+    return (re_ast_t) {
+        .tokens = out.tokens.data,
+        .lefts = out.lefts.data,
+        .rights = out.rights.data,
+        .size = out.tokens.size,
+        .root = *(int*)back(&copies),
+        .group_num = group_num,
+    };
+}
+
+re_ast_t
+re_ast_simplify(const re_ast_t* re_ast, arena_t* arena)
+{
+    arena_t tmp_arena = arena_new(arena ? &arena->allocator : NULL);
+    simplifier_t s = {
+        .b = {
+            .tokens = dynarr_new_in(&tmp_arena, sizeof(re_token_t)),
+            .lefts = dynarr_new_in(&tmp_arena, sizeof(int)),
+            .rights = dynarr_new_in(&tmp_arena, sizeof(int)),
+            .begins = dynarr_new_in(&tmp_arena, sizeof(int)),
+        },
+        .arena = &tmp_arena,
+        .pairs = dynarr_new_in(&tmp_arena, sizeof(int)),
+    };
+    int* new_index = arena_alloc(&tmp_arena, re_ast->size * sizeof(int));
+    unsigned char* is_in_alternation
+        = arena_alloc(&tmp_arena, re_ast->size);
+    re_ast_t result;
     int i;
-    /* if ast is empty */
     if (re_ast->size == 0) {
-        tepsnfa empty = tepsnfa_one_transition(eps_matcher());
-        result = tepsnfa_to_epsnfa_and_reduce_eps(&empty);
-        tepsnfa_clear(&empty);
-        return result;
-    }
-    /* if ast is not empty */
-    nfas = calloc(re_ast->size, sizeof(tepsnfa));
-    is_visited = calloc(re_ast->size, sizeof(unsigned char));
-    index_stack = dynarr_new(sizeof(int));
+        arena_free(&tmp_arena);
+        return *re_ast;
+    }
+    /* an alternation is factored once, at the top of its chain, which
+       goes through the groups since they are dropped */
+    memset(is_in_alternation, 0, re_ast->size);
+    for (i = 0; i < re_ast->size; i++) {
+        int child, side;
+        if (!is_bop(&re_ast->tokens[i], OP_ALTER)) {
+            continue;
+        }
+        for (side = 0; side < 2; side++) {
+            child = side == 0 ? re_ast->lefts[i] : re_ast->rights[i];
+            while (re_ast->tokens[child].type == TYPE_GROUP) {
+                child = re_ast->lefts[child];
+            }
+            is_in_alternation[child] = 1;
+        }
+    }
+    /* the tokens are in postfix order so the children are always done */
+    for (i = 0; i < re_ast->size; i++) {
+        const re_token_t token = re_ast->tokens[i];
+        int left = re_ast->lefts[i] == -1 ? -1 : new_index[re_ast->lefts[i]];
+        int right
+            = re_ast->rights[i] == -1 ? -1 : new_index[re_ast->rights[i]];
+        switch (token.type) {
+        case TYPE_GROUP:
+            /* the groups are only kept for re_ast_to_capnfa */
+            new_index[i] = left;
+            break;
+        case TYPE_UOP:
+            new_index[i] = simplify_uop(&s, token, left);
+            break;
+        case TYPE_DUP:
+            new_index[i] = simplify_dup(&s, token, left);
+            break;
+        case TYPE_BOP:
+            new_index[i] = ast_push(&s.b, token, left, right);
+            if (token.payload.op == OP_ALTER && !is_in_alternation[i]) {
+                new_index[i] = simplify_alternation(&s, new_index[i]);
+            }
+            break;
+        default:
+            new_index[i] = ast_push(&s.b, token, -1, -1);
+        }
+    }
+    result = ast_compact(
+        &s.b, new_index[re_ast->root], re_ast->group_num, arena, &tmp_arena
+    );
+    arena_free(&tmp_arena);
+    return result;
+}
+
+static uint64_t
+hash_bytes(uint64_t hash, const void* data, const size_t size)
+{
+    const unsigned char* bytes = data;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211u;
+    }
+    return hash;
+}
+
+/* the hash of a node from the parts that token_equal compares, and the
+   first equal subtrees of its children */
+static uint64_t
+subtree_hash(const re_token_t* t, const int left, const int right)
+{
+    uint64_t hash = 14695981039346656037u;
+    hash = hash_bytes(hash, &t->type, sizeof(t->type));
+    switch (t->type) {
+    case TYPE_BYTE:
+        hash = hash_bytes(hash, &t->payload.byte, sizeof(t->payload.byte));
+        break;
+    case TYPE_WC:
+        hash = hash_bytes(hash, &t->payload.wc, sizeof(t->payload.wc));
+        break;
+    case TYPE_CLASS:
+        hash = hash_bytes(
+            hash, t->payload.class.bitmap, sizeof(t->payload.class.bitmap)
+        );
+        hash = hash_bytes(hash, &t->payload.class.is_negated, 1);
+        break;
+    case TYPE_DUP:
+        hash = hash_bytes(hash, &t->payload.dup, sizeof(t->payload.dup));
+        break;
+    case TYPE_ANCHOR:
+        hash = hash_bytes(hash, &t->payload.anch, sizeof(t->payload.anch));
+        break;
+    case TYPE_GROUP:
+        hash = hash_bytes(hash, &t->payload.group, sizeof(t->payload.group));
+        break;
+    default:
+        hash = hash_bytes(hash, &t->payload.op, sizeof(t->payload.op));
+    }
+    hash = hash_bytes(hash, &left, sizeof(left));
+    return hash_bytes(hash, &right, sizeof(right));
+}
+
+static inline int
+first_equal_child(const int* first_equal, const int child)
+{
+    return child == -1 ? -1 : first_equal[child];
+}
+
+int*
+re_ast_hash_cons(const re_ast_t* re_ast, arena_t* arena)
+{
+    int* first_equal = arena_alloc(arena, re_ast->size * sizeof(int) + 1);
+    int* table;
+    size_t table_size = 1, h;
+    int i, j, left, right;
+    while (table_size < 2 * (size_t)re_ast->size) {
+        table_size *= 2;
+    }
+    table = arena_alloc(arena, table_size * sizeof(int));
+    memset(table, 0xFF, table_size * sizeof(int));
+    /* the children are done before their parent, so two subtrees are the
+       same if their tokens are and their children have the same first */
+    for (i = 0; i < re_ast->size; i++) {
+        left = first_equal_child(first_equal, re_ast->lefts[i]);
+        right = first_equal_child(first_equal, re_ast->rights[i]);
+        for (h = subtree_hash(&re_ast->tokens[i], left, right)
+                 & (table_size - 1);
+             table[h] != -1; h = (h + 1) & (table_size - 1)) {
+            j = table[h];
+            if (first_equal_child(first_equal, re_ast->lefts[j]) == left
+                && first_equal_child(first_equal, re_ast->rights[j]) == right
+                && token_equal(&re_ast->tokens[i], &re_ast->tokens[j])) {
+                break;
+            }
+        }
+        if (table[h] == -1) {
+            table[h] = i;
+        }
+        first_equal[i] = table[h];
+    }
+    return first_equal;
+}
+
+/* return frag itself the first time, and a copy of it after that */
+static tepsnfa_frag_t
+take_frag(tepsnfa* nfa, const tepsnfa_frag_t* frag, int* is_taken)
+{
+    if (*is_taken) {
+        return tepsnfa_copy(nfa, frag);
+    }
+    *is_taken = 1;
+    return *frag;
+}
+
+/* expand the dup operation with concat, opt, and star.
+   for example:
+   - "a{3,}" become "aaa(a*)"
+   - "a{4}" become "aaaa"
+   - "a{2,5}" become "aa(a(a(a)?)?)?"
+   each copy of the operand costs its size, everything else is O(1) */
+static tepsnfa_frag_t
+expand_dup(tepsnfa* nfa, const tepsnfa_frag_t* left, dup_payload_t dup)
+{
+    tepsnfa_frag_t result, piece;
+    int is_taken = 0, has_result = 0;
+    int i;
+    for (i = 0; i < dup.min; i++) {
+        piece = take_frag(nfa, left, &is_taken);
+        result = has_result ? tepsnfa_concat(nfa, &result, &piece) : piece;
+        has_result = 1;
+    }
+    if (dup.max == DUP_NO_MAX) {
+        /* at least min depulication */
+        piece = take_frag(nfa, left, &is_taken);
+        piece = tepsnfa_to_star(nfa, &piece);
+        result = has_result ? tepsnfa_concat(nfa, &result, &piece) : piece;
+        has_result = 1;
+    } else if (dup.max > dup.min) {
+        /* the optional tail is made from the inside out */
+        tepsnfa_frag_t tail = take_frag(nfa, left, &is_taken);
+        tail = tepsnfa_to_opt(nfa, &tail);
+        for (i = 1; i < dup.max - dup.min; i++) {
+            piece = take_frag(nfa, left, &is_taken);
+            tail = tepsnfa_concat(nfa, &piece, &tail);
+            tail = tepsnfa_to_opt(nfa, &tail);
+        }
+        result = has_result ? tepsnfa_concat(nfa, &result, &tail) : tail;
+        has_result = 1;
+    }
+    if (!has_result) {
+        /* "a{0}" only matches the empty string */
+        result = tepsnfa_one_transition(nfa, eps_matcher());
+    }
+    return result;
+}
+
+/* build the thompson fragment of the ast in nfa. the group boundaries are
+   only kept as save transitions with RE_FLAG_CAPTURE */
+static tepsnfa_frag_t
+build_thompson(
+    const re_ast_t* re_ast, const int flags, tepsnfa* nfa,
+    dynarr_t* char_class_pool, const int is_debug, nacre_error_t* error
+)
+{
+    arena_t* tmp_arena = nfa->arena;
+    tepsnfa_frag_t* frags;
+    unsigned char* is_visited; /* 1 once the children are pushed, 2 built */
+    int* first_equal;
+    dynarr_t index_stack;
+    if (re_ast->size == 0) {
+        return tepsnfa_one_transition(nfa, eps_matcher());
+    }
+    frags = arena_alloc(tmp_arena, re_ast->size * sizeof(tepsnfa_frag_t));
+    is_visited = arena_alloc(tmp_arena, re_ast->size * sizeof(unsigned char));
+    first_equal = re_ast_hash_cons(re_ast, tmp_arena);
+    index_stack = dynarr_new_in(tmp_arena, sizeof(int));
     append(&index_stack, &re_ast->root);
     while (index_stack.size > 0) {
         int cur_index = *(int*)back(&index_stack);
         int left_index = re_ast->lefts[cur_index];
         int right_index = re_ast->rights[cur_index];
+        int first = first_equal[cur_index];
         re_token_t cur_token = re_ast->tokens[cur_index];
 
         if (is_debug) {
@@ -54,14 +967,24 @@ re_ast_to_nfa(const re_ast_t* re_ast, const int is_debug)
             re_token_print(cur_token);
         }
 
+        if (first != cur_index && is_visited[first] == 2) {
+            /* an equal subtree is built, and its copy costs the same
+               states without building the children or their classes */
+            pop(&index_stack);
+            frags[cur_index] = tepsnfa_copy(nfa, &frags[first]);
+            is_visited[cur_index] = 2;
+            continue;
+        }
         if (is_visited[cur_index] == 0
             && (left_index != -1 || right_index != -1)) {
-            if (left_index != -1) {
-                append(&index_stack, &left_index);
-            }
+            /* push right first so that left is built first and the
+               fragments of every subtree stay contiguous */
             if (right_index != -1) {
                 append(&index_stack, &right_index);
             }
+            if (left_index != -1) {
+                append(&index_stack, &left_index);
+            }
             is_visited[cur_index] = 1;
             continue;
         }
@@ -69,123 +992,141 @@ re_ast_to_nfa(const re_ast_t* re_ast, const int is_debug)
 
         switch (cur_token.type) {
         case TYPE_BYTE:
-            nfas[cur_index]
-                = tepsnfa_one_transition(byte_matcher(cur_token.payload.byte));
-            break;
+        case TYPE_WC:
+        case TYPE_CLASS:
         case TYPE_ANCHOR:
-            nfas[cur_index]
-                = tepsnfa_one_transition(anchor_matcher(cur_token.payload.anch)
-                );
+            frags[cur_index] = tepsnfa_one_transition(
+                nfa,
+                re_token_to_matcher(&cur_token, flags, char_class_pool, error)
+            );
             break;
-        case TYPE_CLASS:
-            nfas[cur_index]
-                = tepsnfa_one_transition(class_matcher(char_class_pool.size));
-            append(&char_class_pool, &cur_token.payload.class);
+        case TYPE_GROUP:
+            frags[cur_index] = (flags & RE_FLAG_CAPTURE)
+                ? tepsnfa_to_group(
+                      nfa, &frags[left_index], cur_token.payload.group
+                  )
+                : frags[left_index];
             break;
-        case TYPE_DUP: {
-            /* expand the dup operation with concat, alter, opt, and star.
-               for example:
-               - "a{3,}" become "aaa(a*)"
-               - "a{4}" become "aaaa"
-               - "a{2,5}" become "aa(a(a(a)?)?)?"
-            */
-            tepsnfa* cur_nfa = &nfas[cur_index];
-            tepsnfa* left_nfa = &nfas[left_index];
-            int min = cur_token.payload.dup.min;
-            int max = cur_token.payload.dup.max;
-            int i;
-            *cur_nfa = tepsnfa_deepcopy(left_nfa);
-            for (i = 1; i < min; i++) {
-                tepsnfa_concat(cur_nfa, left_nfa);
-            }
-            if (max == DUP_NO_MAX) {
-                /* at least min depulication */
-                tepsnfa left_star = tepsnfa_deepcopy(left_nfa);
-                tepsnfa_to_star(&left_star);
-                tepsnfa_concat(cur_nfa, &left_star);
-                tepsnfa_clear(&left_star);
-            } else if (min == max) {
-                /* extact duplication */
-                /* do nothing */
-            } else {
-                tepsnfa tail_opt = tepsnfa_deepcopy(left_nfa);
-                int j;
-                for (j = 1; j < max - min; j++) {
-                    tepsnfa head = tepsnfa_deepcopy(left_nfa);
-                    tepsnfa_to_opt(&tail_opt);
-                    tepsnfa_concat(&head, &tail_opt);
-                    tepsnfa_clear(&tail_opt);
-                    tail_opt = head;
-                }
-                tepsnfa_to_opt(&tail_opt);
-                tepsnfa_concat(cur_nfa, &tail_opt);
-                tepsnfa_clear(&tail_opt);
-            }
-            break;
-        }
-        case TYPE_WC:
-            nfas[cur_index]
-                = tepsnfa_one_transition(wc_matcher(cur_token.payload.wc));
+        case TYPE_DUP:
+            frags[cur_index]
+                = expand_dup(nfa, &frags[left_index], cur_token.payload.dup);
             break;
         case TYPE_UOP:
-            nfas[cur_index] = tepsnfa_deepcopy(&nfas[left_index]);
             switch (cur_token.payload.op) {
             case OP_PLUS:
-                tepsnfa_concat(&nfas[cur_index], &nfas[left_index]);
-                tepsnfa_to_star(&nfas[cur_index]);
+                frags[cur_index] = tepsnfa_to_plus(nfa, &frags[left_index]);
                 break;
             case OP_STAR:
-                tepsnfa_to_star(&nfas[cur_index]);
+                frags[cur_index] = tepsnfa_to_star(nfa, &frags[left_index]);
                 break;
             case OP_OPT:
-                tepsnfa_to_opt(&nfas[cur_index]);
+                frags[cur_index] = tepsnfa_to_opt(nfa, &frags[left_index]);
                 break;
             default:
-                printf("error: bad unary operator %d\n", cur_token.payload.op);
-                exit(1);
+                re_error_set(
+                    error, NACRE_ERROR_SYNTAX, "bad unary operator %d",
+                    cur_token.payload.op
+                );
             }
             break;
         case TYPE_BOP:
             if (cur_token.payload.op == OP_CONCAT) {
-                nfas[cur_index] = tepsnfa_deepcopy(&nfas[left_index]);
-                tepsnfa_concat(&nfas[cur_index], &nfas[right_index]);
+                frags[cur_index] = tepsnfa_concat(
+                    nfa, &frags[left_index], &frags[right_index]
+                );
             } else if (cur_token.payload.op == OP_ALTER) {
-                int is_left_one = nfas[left_index].state_num == 2;
-                int is_right_one = nfas[right_index].state_num == 2;
-                if (is_left_one) {
-                    nfas[cur_index] = tepsnfa_deepcopy(&nfas[right_index]);
-                    tepsnfa_fast_union(&nfas[cur_index], &nfas[left_index]);
-                } else if (is_right_one) {
-                    nfas[cur_index] = tepsnfa_deepcopy(&nfas[left_index]);
-                    tepsnfa_fast_union(&nfas[cur_index], &nfas[right_index]);
-                } else {
-                    nfas[cur_index] = tepsnfa_deepcopy(&nfas[left_index]);
-                    tepsnfa_union(&nfas[cur_index], &nfas[right_index]);
-                }
+                frags[cur_index] = tepsnfa_union(
+                    nfa, &frags[left_index], &frags[right_index]
+                );
             } else {
-                printf("error: bad binary operator %d\n", cur_token.payload.op);
-                exit(1);
+                re_error_set(
+                    error, NACRE_ERROR_SYNTAX, "bad binary operator %d",
+                    cur_token.payload.op
+                );
             }
             break;
         default:
-            printf("error: bad token type\n");
-            exit(1);
+            re_error_set(
+                error, NACRE_ERROR_SYNTAX, "bad token type %d", cur_token.type
+            );
+        }
+        if (error->code != NACRE_OK) {
+            return tepsnfa_one_transition(nfa, eps_matcher());
         }
+        is_visited[cur_index] = 2;
 
         if (is_debug) {
-            tepsnfa_print(&nfas[cur_index]);
+            tepsnfa_print(nfa, &frags[cur_index]);
         }
     }
-    result = tepsnfa_to_epsnfa_and_reduce_eps(&nfas[re_ast->root]);
-    result.char_class_pool = char_class_pool;
-    for (i = 0; i < re_ast->size; i++) {
-        tepsnfa_clear(&nfas[i]);
+    return frags[re_ast->root];
+}
+
+epsnfa
+re_ast_to_nfa(
+    const re_ast_t* re_ast, const int flags, arena_t* arena, const int is_debug,
+    nacre_error_t* error
+)
+{
+    epsnfa reduced, result;
+    tepsnfa nfa;
+    tepsnfa_frag_t frag;
+    /* the automata before minimization only live until the result is made */
+    arena_t tmp_arena = arena_new(arena ? &arena->allocator : NULL);
+    if (flags & RE_FLAG_GLUSHKOV) {
+        reduced = re_ast_to_glushkov_nfa(
+            re_ast, flags, &tmp_arena, is_debug, error
+        );
+    } else {
+        dynarr_t char_class_pool
+            = dynarr_new_in(&tmp_arena, sizeof(char_class_t));
+        nfa = tepsnfa_new(&tmp_arena);
+        frag = build_thompson(
+            re_ast, flags & ~RE_FLAG_CAPTURE, &nfa, &char_class_pool,
+            is_debug, error
+        );
+        reduced = tepsnfa_to_epsnfa_and_reduce_eps(&nfa, &frag, &tmp_arena);
+        reduced.char_class_pool = char_class_pool;
+        if (is_debug) {
+            epsnfa_print(&reduced);
+        }
     }
+    if (error->code != NACRE_OK) {
+        arena_free(&tmp_arena);
+        return epsnfa_new(1, 0, arena);
+    }
+    /* the labels are merged before minimization so that the same bytes
+       are the same signature, and after it for the edges that the merged
+       states have in parallel */
+    epsnfa_merge_edges(&reduced);
+    result = epsnfa_minimize(&reduced, arena);
+    epsnfa_merge_edges(&result);
+    epsnfa_build_jump_table(&result);
     if (is_debug) {
+        printf("after minimization:\n");
         epsnfa_print(&result);
     }
-    dynarr_free(&index_stack);
-    free(is_visited);
-    free(nfas);
+    arena_free(&tmp_arena);
+    return result;
+}
+
+capnfa
+re_ast_to_capnfa(
+    const re_ast_t* re_ast, const int flags, arena_t* arena,
+    nacre_error_t* error
+)
+{
+    capnfa result;
+    tepsnfa_frag_t frag;
+    dynarr_t char_class_pool = dynarr_new_in(arena, sizeof(char_class_t));
+    arena_t tmp_arena = arena_new(&arena->allocator);
+    tepsnfa nfa = tepsnfa_new(&tmp_arena);
+    frag = build_thompson(
+        re_ast, flags | RE_FLAG_CAPTURE, &nfa, &char_class_pool, 0, error
+    );
+    result = tepsnfa_to_capnfa(&nfa, &frag, arena);
+    result.char_class_pool = char_class_pool;
+    result.group_num = re_ast->group_num;
+    arena_free(&tmp_arena);
     return result;
 }
@@ -3,6 +3,88 @@
 #include <stdio.h>
 #include <string.h>
 
+/* read the utf-8 character at s[0:len] into code and return its length, or
+   return 0 if it is not well formed. overlong forms, surrogates and code
+   points over UTF8_CODE_MAX are not */
+static int
+decode_utf8(const unsigned char* s, const size_t len, uint32_t* code)
+{
+    int n, i;
+    uint32_t c;
+    if (s[0] < 0x80) {
+        *code = s[0];
+        return 1;
+    } else if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+        n = 2;
+        c = s[0] & 0x1F;
+    } else if ((s[0] & 0xF0) == 0xE0) {
+        n = 3;
+        c = s[0] & 0x0F;
+    } else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+        n = 4;
+        c = s[0] & 0x07;
+    } else {
+        return 0;
+    }
+    if ((size_t)n > len) {
+        return 0;
+    }
+    for (i = 1; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        c = (c << 6) | (s[i] & 0x3F);
+    }
+    if ((n == 3 && c < 0x800) || (n == 4 && c < 0x10000)
+        || c > UTF8_CODE_MAX || (c >= 0xD800 && c <= 0xDFFF)) {
+        return 0;
+    }
+    *code = c;
+    return n;
+}
+
+/* write the utf-8 form of code to out and return its length */
+static int
+encode_utf8(const uint32_t code, unsigned char out[4])
+{
+    if (code < 0x80) {
+        out[0] = code;
+        return 1;
+    } else if (code < 0x800) {
+        out[0] = 0xC0 | (code >> 6);
+        out[1] = 0x80 | (code & 0x3F);
+        return 2;
+    } else if (code < 0x10000) {
+        out[0] = 0xE0 | (code >> 12);
+        out[1] = 0x80 | ((code >> 6) & 0x3F);
+        out[2] = 0x80 | (code & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (code >> 18);
+    out[1] = 0x80 | ((code >> 12) & 0x3F);
+    out[2] = 0x80 | ((code >> 6) & 0x3F);
+    out[3] = 0x80 | (code & 0x3F);
+    return 4;
+}
+
+/* add the code points from..to to the class, or to wide_ranges for the
+   ones from 0x80 if it is not NULL */
+static void
+add_code_range(
+    char_class_t* char_class, dynarr_t* wide_ranges, const uint32_t from,
+    const uint32_t to
+)
+{
+    uint32_t c, bitmap_end = wide_ranges ? 0x80 : 0x100;
+    for (c = from; c <= to && c < bitmap_end; c++) {
+        char_class_set(char_class, c);
+    }
+    if (wide_ranges && to >= 0x80) {
+        code_range_t range = { .from = from < 0x80 ? 0x80 : from, .to = to };
+        append(wide_ranges, &range);
+    }
+}
+
 /*
     parse the bracket expression (the thing in side "[...]" or "[^...]")
 
@@ -13,29 +95,32 @@
                     ;
         RANGE_EXPR   = CHAR_EXPR '-' CHAR_EXPR;
         CHAR_EXPR    = CHAR | '\' ESC_CHAR;
-        ESC_CHAR     = '-' | ']' | '^' | 'n' | 'r' | 't' | 'v' | 'f';
+        ESC_CHAR     = '-' | ']' | '^' | '\\' | 'n' | 'r' | 't' | 'v' | 'f';
         CHAR         = [all printables]
     ```
 
-    into an class matcher
+    into an class matcher. in utf-8, CHAR is a whole character
 */
 char_class_t
-parse_bracket_expr(const char* input_str)
+parse_bracket_expr(
+    const char* input_str, dynarr_t* wide_ranges, arena_t* arena,
+    nacre_error_t* error
+)
 {
     typedef struct bracket_token {
         uint8_t is_range_char; // 1 if is range charactor "-", else 0
-        uint8_t byte;
+        uint32_t code; /* the byte, or the code point in utf-8 */
         int wc; // -1 if not wildcard
     } bracket_token_t;
     const size_t input_len = strlen(input_str);
-    dynarr_t intermidiate = dynarr_new(sizeof(bracket_token_t));
+    dynarr_t intermidiate = dynarr_new_in(arena, sizeof(bracket_token_t));
     char_class_t char_class = {
         .bitmap = { 0 },
         .is_negated = 0,
     };
     size_t i;
-    int j = 0, is_esc = 0, is_range = 0;
-    char range_from = 0;
+    int j = 0, is_esc = 0, is_range = 0, code_len;
+    uint32_t range_from = 0, code;
 
     /* transform escaped char to intermidiate bracket_token token */
     for (i = 0; i < input_len; i++) {
@@ -47,34 +132,50 @@ parse_bracket_expr(const char* input_str)
             if (esc_char) {
                 t = (bracket_token_t) {
                     .is_range_char = 0,
-                    .byte = BRACKET_ESC_CHARS_TO[esc_char - BRACKET_ESC_CHARS],
+                    .code = BRACKET_ESC_CHARS_TO[esc_char - BRACKET_ESC_CHARS],
                     .wc = -1,
                 };
                 append(&intermidiate, &t);
             } else if (wc_char) {
                 t = (bracket_token_t) {
                     .is_range_char = 0,
-                    .byte = 0,
+                    .code = 0,
                     .wc = wc_char - WC_ESC_CHARS,
                 };
                 append(&intermidiate, &t);
             } else {
-                printf("parse_bracket_expr: bad escape: '%c'", c);
-                exit(1);
+                re_error_set(
+                    error, NACRE_ERROR_SYNTAX, "bad escape in bracket: '%c'", c
+                );
+                return char_class;
             }
+            is_esc = 0;
         } else if (c == '\\') {
             is_esc = 1;
         } else if (c == '-') {
             t = (bracket_token_t) {
                 .is_range_char = 1,
-                .byte = 0,
+                .code = 0,
                 .wc = -1,
             };
             append(&intermidiate, &t);
         } else {
+            code = (unsigned char)c;
+            if (wide_ranges && code >= 0x80) {
+                code_len = decode_utf8(
+                    (const unsigned char*)input_str + i, input_len - i, &code
+                );
+                if (code_len == 0) {
+                    re_error_set(
+                        error, NACRE_ERROR_SYNTAX, "bad utf-8 in bracket"
+                    );
+                    return char_class;
+                }
+                i += code_len - 1;
+            }
             t = (bracket_token_t) {
                 .is_range_char = 0,
-                .byte = c,
+                .code = code,
                 .wc = -1,
             };
             append(&intermidiate, &t);
@@ -86,55 +187,267 @@ parse_bracket_expr(const char* input_str)
         bracket_token_t* t = at(&intermidiate, i);
         if (is_range) {
             if (t->wc != -1 || t->is_range_char) {
-                fprintf(stderr, "bracket expr: bad range\n");
-                exit(1);
+                re_error_set(error, NACRE_ERROR_SYNTAX, "bad range in bracket");
+                return char_class;
             }
-            if (t->byte < range_from) {
-                printf(
-                    "bracket expr: bad range: left '%c' < right '%c'\n",
-                    range_from, t->byte
+            if (t->code < range_from) {
+                re_error_set(
+                    error, NACRE_ERROR_SYNTAX,
+                    "bad range in bracket: left %u > right %u", range_from,
+                    t->code
                 );
-                exit(1);
-            }
-            for (j = range_from; j <= t->byte; j++) {
-                char_class_set(&char_class, j);
+                return char_class;
             }
+            add_code_range(&char_class, wide_ranges, range_from, t->code);
             is_range = 0;
         } else if (t->is_range_char) {
-            if (i == 0 || i == input_len - 1) {
-                printf("bracket expr: incomplete range expression\n");
-                exit(1);
+            if (i == 0 || i == intermidiate.size - 1) {
+                re_error_set(
+                    error, NACRE_ERROR_SYNTAX, "incomplete range in bracket"
+                );
+                return char_class;
             } else {
                 bracket_token_t* prev_t = at(&intermidiate, i - 1);
                 if (prev_t->wc != -1 || prev_t->is_range_char) {
-                    fprintf(stderr, "bracket expr: bad range\n");
-                    exit(1);
+                    re_error_set(
+                        error, NACRE_ERROR_SYNTAX, "bad range in bracket"
+                    );
+                    return char_class;
                 }
-                range_from = t->byte;
+                range_from = prev_t->code;
                 is_range = 1;
             }
         } else if (t->wc != -1) {
-            for (j = 0; j < 256; j++) {
+            for (j = 0; j < (wide_ranges ? 0x80 : 0x100); j++) {
                 if (match_wc(t->wc, j)) {
                     char_class_set(&char_class, j);
                 }
             }
+            /* in utf-8, a wildcard that takes the non-ascii bytes takes the
+               non-ascii characters */
+            if (wide_ranges && match_wc(t->wc, 0x80)) {
+                add_code_range(&char_class, wide_ranges, 0x80, UTF8_CODE_MAX);
+            }
         } else {
-            char_class_set(&char_class, t->byte);
+            add_code_range(&char_class, wide_ranges, t->code, t->code);
         }
     }
+    dynarr_free(&intermidiate);
     return char_class;
 }
 
+static const re_token_t CONCAT_OP = {
+    .type = TYPE_BOP,
+    .payload = { .op = OP_CONCAT },
+};
+static const re_token_t ALTER_OP = {
+    .type = TYPE_BOP,
+    .payload = { .op = OP_ALTER },
+};
+
+/* append the byte sequences of the code points from..to as alternatives,
+   one for every piece where each byte is a range of its own. the piece
+   ends are split until they have the same length and differ only in
+   bytes whose ranges are full, like "[\xE1-\xEC][\x80-\xBF][\x80-\xBF]" */
+static void
+append_utf8_pieces(
+    dynarr_t* tokens, const uint32_t from, const uint32_t to, int* piece_num
+)
+{
+    static const uint32_t max_by_len[3] = { 0x7F, 0x7FF, 0xFFFF };
+    unsigned char lo[4], hi[4];
+    re_token_t t;
+    uint32_t m;
+    int i, n, k;
+    if (from > to) {
+        return;
+    }
+    /* surrogates have no utf-8 form */
+    if (from <= 0xDFFF && to >= 0xD800) {
+        if (from < 0xD800) {
+            append_utf8_pieces(tokens, from, 0xD7FF, piece_num);
+        }
+        if (to > 0xDFFF) {
+            append_utf8_pieces(tokens, 0xE000, to, piece_num);
+        }
+        return;
+    }
+    for (i = 0; i < 3; i++) {
+        if (from <= max_by_len[i] && to > max_by_len[i]) {
+            append_utf8_pieces(tokens, from, max_by_len[i], piece_num);
+            append_utf8_pieces(tokens, max_by_len[i] + 1, to, piece_num);
+            return;
+        }
+    }
+    for (i = 1; i < 4; i++) {
+        m = (1u << (6 * i)) - 1;
+        if ((from & ~m) == (to & ~m)) {
+            continue;
+        }
+        if ((from & m) != 0) {
+            append_utf8_pieces(tokens, from, from | m, piece_num);
+            append_utf8_pieces(tokens, (from | m) + 1, to, piece_num);
+            return;
+        }
+        if ((to & m) != m) {
+            append_utf8_pieces(tokens, from, (to & ~m) - 1, piece_num);
+            append_utf8_pieces(tokens, to & ~m, to, piece_num);
+            return;
+        }
+    }
+    n = encode_utf8(from, lo);
+    encode_utf8(to, hi);
+    if (*piece_num > 0) {
+        append(tokens, &ALTER_OP);
+    }
+    for (k = 0; k < n; k++) {
+        if (k > 0) {
+            append(tokens, &CONCAT_OP);
+        }
+        if (lo[k] == hi[k]) {
+            t = (re_token_t) {
+                .type = TYPE_BYTE,
+                .payload = { .byte = lo[k] },
+            };
+        } else {
+            t = (re_token_t) { .type = TYPE_CLASS };
+            memset(&t.payload.class, 0, sizeof(char_class_t));
+            for (m = lo[k]; m <= hi[k]; m++) {
+                char_class_set(&t.payload.class, m);
+            }
+        }
+        append(tokens, &t);
+    }
+    (*piece_num)++;
+}
+
+static int
+compare_code_range(const void* a, const void* b)
+{
+    const code_range_t* x = a;
+    const code_range_t* y = b;
+    return x->from < y->from ? -1 : x->from > y->from;
+}
+
+/* append the tokens of a class in utf-8. the code points below 0x80 are the
+   bitmap of ascii_class, and the others are wide_ranges. the ascii part
+   stays a class token, so ignoring case and the single line mode still
+   work on it, and the rest are byte sequences. everything is alternated in
+   a parenthese with no group */
+static void
+append_utf8_class(
+    dynarr_t* tokens, char_class_t ascii_class, const int is_negated,
+    dynarr_t* wide_ranges
+)
+{
+    const re_token_t lp = { .type = TYPE_LP, .payload = { .group = 0 } };
+    const re_token_t rp = { .type = TYPE_RP };
+    re_token_t t = { .type = TYPE_CLASS };
+    code_range_t* ranges = wide_ranges->data;
+    size_t i, range_num = 0, lp_index = tokens->size;
+    uint32_t next = 0x80;
+    int c, piece_num = 0, is_ascii_empty = 1;
+
+    /* sort and merge the ranges */
+    qsort(ranges, wide_ranges->size, sizeof(code_range_t), compare_code_range);
+    for (i = 0; i < wide_ranges->size; i++) {
+        if (range_num > 0 && ranges[i].from <= ranges[range_num - 1].to + 1) {
+            if (ranges[i].to > ranges[range_num - 1].to) {
+                ranges[range_num - 1].to = ranges[i].to;
+            }
+        } else {
+            ranges[range_num++] = ranges[i];
+        }
+    }
+
+    /* the negated ascii part must miss every non-ascii byte */
+    ascii_class.is_negated = is_negated;
+    if (is_negated) {
+        for (c = 0x80; c < 0x100; c++) {
+            char_class_set(&ascii_class, c);
+        }
+    }
+    for (c = 0; c < 0x80; c++) {
+        if (char_class_has(&ascii_class, c) != is_negated) {
+            is_ascii_empty = 0;
+        }
+    }
+
+    append(tokens, &lp);
+    if (!is_ascii_empty) {
+        t.payload.class = ascii_class;
+        append(tokens, &t);
+        piece_num++;
+    }
+    if (is_negated) {
+        /* the pieces of the gaps between the ranges */
+        for (i = 0; i < range_num; i++) {
+            if (ranges[i].from > next) {
+                append_utf8_pieces(
+                    tokens, next, ranges[i].from - 1, &piece_num
+                );
+            }
+            next = ranges[i].to + 1;
+        }
+        append_utf8_pieces(tokens, next, UTF8_CODE_MAX, &piece_num);
+    } else {
+        for (i = 0; i < range_num; i++) {
+            append_utf8_pieces(
+                tokens, ranges[i].from, ranges[i].to, &piece_num
+            );
+        }
+    }
+    if (piece_num == 0) {
+        /* nothing matches, which is the empty class */
+        t.payload.class = ascii_class;
+        append(tokens, &t);
+        piece_num++;
+    }
+    if (tokens->size == lp_index + 2) {
+        /* one token needs no parenthese */
+        memmove(
+            at(tokens, lp_index), at(tokens, lp_index + 1),
+            (tokens->size - lp_index - 1) * sizeof(re_token_t)
+        );
+        pop(tokens);
+    } else {
+        append(tokens, &rp);
+    }
+}
+
+/* append the tokens of a wildcard in utf-8, the ones that take non-ascii
+   bytes take whole non-ascii characters instead */
+static void
+append_utf8_wc(dynarr_t* tokens, const enum WILDCARD_NAME wc, arena_t* arena)
+{
+    char_class_t ascii_class = { .bitmap = { 0 }, .is_negated = 0 };
+    dynarr_t wide_ranges = dynarr_new_in(arena, sizeof(code_range_t));
+    code_range_t range = { .from = 0x80, .to = UTF8_CODE_MAX };
+    re_token_t t = { .type = TYPE_WC, .payload = { .wc = wc } };
+    int c;
+    if (!match_wc(wc, 0x80)) {
+        append(tokens, &t);
+        return;
+    }
+    for (c = 0; c < 0x80; c++) {
+        if (match_wc(wc, c)) {
+            char_class_set(&ascii_class, c);
+        }
+    }
+    append(&wide_ranges, &range);
+    append_utf8_class(tokens, ascii_class, 0, &wide_ranges);
+    dynarr_free(&wide_ranges);
+}
+
 dynarr_t
-tokenize(const char* input_str)
+tokenize(
+    const char* input_str, const int is_utf8, arena_t* arena,
+    nacre_error_t* error
+)
 {
     size_t i, input_size = strlen(input_str);
-    if (input_size > RE_STR_LEN_LIMIT) {
-        printf("regexp str too long: %lu > %d\n", input_size, RE_STR_LEN_LIMIT);
-        exit(1);
-    }
     int can_add_concat = 0;
+    int group_num = 0;
 
     enum state { ST_ESC, ST_DUP, ST_BRK, ST_NORM };
     int cur_state = ST_NORM;
@@ -146,13 +459,16 @@ tokenize(const char* input_str)
     char brk_str[BRACKET_STR_MAX_LEN + 1];
 
     re_token_t t;
-    const re_token_t CONCAT_OP = {
-        .type = TYPE_BOP,
-        .payload = { .op = OP_CONCAT },
-    };
-    dynarr_t tokens = dynarr_new(sizeof(re_token_t));
+    dynarr_t tokens = dynarr_new_in(arena, sizeof(re_token_t));
 
-    for (i = 0; i < input_size; i++) {
+    if (input_size > RE_STR_LEN_LIMIT) {
+        re_error_set(
+            error, NACRE_ERROR_LIMIT, "pattern too long: %lu > %d",
+            input_size, RE_STR_LEN_LIMIT
+        );
+        return tokens;
+    }
+    for (i = 0; i < input_size && error->code == NACRE_OK; i++) {
         char c = input_str[i];
         /* ESCAPE STATE */
         if (cur_state == ST_ESC) {
@@ -180,9 +496,21 @@ tokenize(const char* input_str)
                         .type = TYPE_WC,
                         .payload = { .wc = wc - WC_ESC_CHARS },
                     };
+                    if (is_utf8) {
+                        if (can_add_concat) {
+                            append(&tokens, &CONCAT_OP);
+                        }
+                        append_utf8_wc(&tokens, t.payload.wc, arena);
+                        can_add_concat = 1;
+                        cur_state = ST_NORM;
+                        continue;
+                    }
                 } else {
-                    printf("error: bad escape sequence '%c'\n", c);
-                    exit(1);
+                    re_error_set(
+                        error, NACRE_ERROR_SYNTAX, "bad escape sequence '%c'",
+                        c
+                    );
+                    return tokens;
                 }
             }
             if (can_add_concat) {
@@ -204,18 +532,21 @@ tokenize(const char* input_str)
                 if (is_dup_have_sep == 1) {
                     t.payload.dup.min = dup_min;
                     /* if dup_str is empty (the "{m,}" format),
-                    dup_max should be 0 to indicate "no maximum" */
+                    dup_max is DUP_NO_MAX to indicate "no maximum" */
                     t.payload.dup.max = (dup_str_len == 0)
                         ? DUP_NO_MAX
-                        : atoi_check_dup_max(dup_str);
+                        : atoi_check_dup_max(dup_str, error);
                 } else {
                     /* "{}" is not allowed" */
                     if (dup_str_len == 0) {
-                        printf("error: duplication min is empty\n");
-                        exit(1);
+                        re_error_set(
+                            error, NACRE_ERROR_SYNTAX,
+                            "duplication min is empty"
+                        );
+                        return tokens;
                     }
                     /* the "{m}" format */
-                    dup_min = atoi_check_dup_max(dup_str);
+                    dup_min = atoi_check_dup_max(dup_str, error);
                     t.payload.dup.min = t.payload.dup.max = dup_min;
                 }
                 append(&tokens, &t);
@@ -224,29 +555,35 @@ tokenize(const char* input_str)
             } else if (c == DUP_SEP) {
                 /* "{,n}" is not allowed" */
                 if (dup_str_len == 0) {
-                    printf("error: duplication min is empty\n");
-                    exit(1);
+                    re_error_set(
+                        error, NACRE_ERROR_SYNTAX, "duplication min is empty"
+                    );
+                    return tokens;
                 }
                 dup_str[dup_str_len] = '\0';
-                dup_min = atoi_check_dup_max(dup_str);
+                dup_min = atoi_check_dup_max(dup_str, error);
                 dup_str_len = 0;
                 is_dup_have_sep = 1;
             } else if (c == ' ') {
                 continue;
             } else {
                 if (dup_str_len >= DUP_STR_MAX_LEN) {
-                    printf(
-                        "error: duplication number length over limit(%d): %d\n",
+                    re_error_set(
+                        error, NACRE_ERROR_LIMIT,
+                        "duplication number length over limit(%d): %d",
                         DUP_STR_MAX_LEN, dup_str_len
                     );
-                    exit(1);
+                    return tokens;
                 }
                 if (isdigit(c)) {
                     dup_str[dup_str_len] = c;
                     dup_str_len++;
                 } else {
-                    printf("error: duplication is not number: %c\n", c);
-                    exit(1);
+                    re_error_set(
+                        error, NACRE_ERROR_SYNTAX,
+                        "duplication is not number: %c", c
+                    );
+                    return tokens;
                 }
             }
             continue;
@@ -260,24 +597,28 @@ tokenize(const char* input_str)
                     brk_str_len++;
                     brk_is_esc = 0;
                 } else {
-                    printf(
-                        "bracket expr: \"^\" should appear at the "
-                        "begining of braket or escaped\n"
+                    re_error_set(
+                        error, NACRE_ERROR_SYNTAX,
+                        "\"^\" should appear at the begining of bracket or "
+                        "escaped"
                     );
-                    exit(1);
+                    return tokens;
                 }
             } else if (c == '\\') {
-                brk_is_esc = 1;
+                /* the backslash stays in the bracket string */
+                brk_str_len++;
+                brk_is_esc = !brk_is_esc;
             } else if (c == ']') {
                 if (brk_str_len > BRACKET_STR_MAX_LEN) {
-                    printf(
-                        "bracket expr too long (>%d)\n", BRACKET_STR_MAX_LEN
+                    re_error_set(
+                        error, NACRE_ERROR_LIMIT, "bracket too long (>%d)",
+                        BRACKET_STR_MAX_LEN
                     );
-                    exit(1);
+                    return tokens;
                 }
                 if (brk_str_len == 0) {
-                    printf("bracket expr: is empty\n");
-                    exit(1);
+                    re_error_set(error, NACRE_ERROR_SYNTAX, "bracket is empty");
+                    return tokens;
                 }
                 if (brk_is_esc) {
                     brk_str_len++;
@@ -286,20 +627,30 @@ tokenize(const char* input_str)
                 }
                 strncpy(brk_str, input_str + i - brk_str_len, brk_str_len);
                 brk_str[brk_str_len] = '\0';
-                {
-                    char_class_t char_class = parse_bracket_expr(brk_str);
+                if (can_add_concat) {
+                    append(&tokens, &CONCAT_OP);
+                }
+                if (is_utf8) {
+                    dynarr_t wide_ranges
+                        = dynarr_new_in(arena, sizeof(code_range_t));
+                    char_class_t char_class = parse_bracket_expr(
+                        brk_str, &wide_ranges, arena, error
+                    );
+                    append_utf8_class(
+                        &tokens, char_class, brk_is_neg, &wide_ranges
+                    );
+                    dynarr_free(&wide_ranges);
+                } else {
+                    char_class_t char_class
+                        = parse_bracket_expr(brk_str, NULL, arena, error);
                     char_class.is_negated = brk_is_neg;
-                    if (can_add_concat) {
-                        append(&tokens, &CONCAT_OP);
-                    }
                     t = (re_token_t) {
                         .type = TYPE_CLASS,
                         .payload = { .class = char_class },
                     };
                     append(&tokens, &t);
-                    can_add_concat = 1;
-                    cur_state = ST_NORM;
                 }
+                can_add_concat = 1;
                 cur_state = ST_NORM;
             } else {
                 brk_str_len++;
@@ -320,7 +671,11 @@ tokenize(const char* input_str)
             if (can_add_concat) {
                 append(&tokens, &CONCAT_OP);
             }
-            append(&tokens, &t);
+            if (is_utf8) {
+                append_utf8_wc(&tokens, WC_ANY, arena);
+            } else {
+                append(&tokens, &t);
+            }
         } else if (c == ANCHOR_START_CHAR) {
             t = (re_token_t) {
                 .type = TYPE_ANCHOR,
@@ -358,7 +713,11 @@ tokenize(const char* input_str)
             append(&tokens, &t);
             can_add_concat = 0;
         } else if (c == '(') {
-            t = (re_token_t) { .type = TYPE_LP };
+            /* groups are numbered by their left parenthese */
+            t = (re_token_t) {
+                .type = TYPE_LP,
+                .payload = { .group = ++group_num },
+            };
             if (can_add_concat) {
                 append(&tokens, &CONCAT_OP);
             }
@@ -366,6 +725,29 @@ tokenize(const char* input_str)
         } else if (c == ')') {
             t = (re_token_t) { .type = TYPE_RP };
             append(&tokens, &t);
+        } else if (is_utf8 && (unsigned char)c >= 0x80) {
+            /* a non-ascii character is one operand */
+            dynarr_t wide_ranges = dynarr_new_in(arena, sizeof(code_range_t));
+            char_class_t none = { .bitmap = { 0 }, .is_negated = 0 };
+            code_range_t range;
+            int code_len = decode_utf8(
+                (const unsigned char*)input_str + i, input_size - i,
+                &range.from
+            );
+            if (code_len == 0) {
+                re_error_set(
+                    error, NACRE_ERROR_SYNTAX, "bad utf-8 at %lu", i
+                );
+                return tokens;
+            }
+            range.to = range.from;
+            append(&wide_ranges, &range);
+            if (can_add_concat) {
+                append(&tokens, &CONCAT_OP);
+            }
+            append_utf8_class(&tokens, none, 0, &wide_ranges);
+            dynarr_free(&wide_ranges);
+            i += code_len - 1;
         } else {
             t = (re_token_t) { .type = TYPE_BYTE, .payload = { .byte = c } };
             if (can_add_concat) {
@@ -379,35 +761,59 @@ tokenize(const char* input_str)
             can_add_concat = !(IS_BOP(c) || c == '(');
         }
     }
+    if (cur_state == ST_ESC) {
+        re_error_set(error, NACRE_ERROR_SYNTAX, "pattern ends with \"\\\"");
+    } else if (cur_state == ST_DUP) {
+        re_error_set(error, NACRE_ERROR_SYNTAX, "unterminated duplication");
+    } else if (cur_state == ST_BRK) {
+        re_error_set(error, NACRE_ERROR_SYNTAX, "unterminated bracket");
+    }
     return tokens;
 }
 
 inline int
-atoi_check_dup_max(const char dup_str[DUP_STR_MAX_LEN])
+atoi_check_dup_max(const char dup_str[DUP_STR_MAX_LEN], nacre_error_t* error)
 {
     int d = atoi(dup_str);
     if (d > DUP_NUM_MAX) {
-        printf(
-            "error: duplication number over limit(%d): %d\n", DUP_NUM_MAX, d
+        re_error_set(
+            error, NACRE_ERROR_LIMIT, "duplication number over limit(%d): %d",
+            DUP_NUM_MAX, d
         );
-        exit(1);
+        return 0;
     }
     return d;
 }
 
 re_ast_t
-parse_regex(const char* input_str, const int is_debug)
+parse_regex(
+    const char* input_str, const int flags, arena_t* arena, const int is_debug,
+    nacre_error_t* error
+)
 {
     size_t i, j;
     /* list of re_token_t */
     dynarr_t input_tokens, postfix_tokens;
     dynarr_t op_stack, index_stack;
     re_ast_t ast = {
-        .tokens = NULL, .lefts = NULL, .rights = NULL, .size = 0, .root = -1
+        .tokens = NULL,
+        .lefts = NULL,
+        .rights = NULL,
+        .size = 0,
+        .root = -1,
+        .group_num = 0,
     };
+    /* the tokens and stacks only live until the ast is made */
+    arena_t tmp_arena = arena_new(arena ? &arena->allocator : NULL);
 
     /* tokenization */
-    input_tokens = tokenize(input_str);
+    input_tokens = tokenize(
+        input_str, (flags & RE_FLAG_UTF8) != 0, &tmp_arena, error
+    );
+    if (error->code != NACRE_OK || input_tokens.size == 0) {
+        arena_free(&tmp_arena);
+        return ast;
+    }
 
     if (is_debug) {
         printf("--- input_tokens ---\n");
@@ -417,8 +823,8 @@ parse_regex(const char* input_str, const int is_debug)
     }
 
     /* transform to postfix notation with shunting yard algorithm */
-    postfix_tokens = dynarr_new(sizeof(re_token_t));
-    op_stack = dynarr_new(sizeof(re_token_t));
+    postfix_tokens = dynarr_new_in(arena, sizeof(re_token_t));
+    op_stack = dynarr_new_in(&tmp_arena, sizeof(re_token_t));
     for (i = 0; i < input_tokens.size; i++) {
         re_token_t* cur_token = at(&input_tokens, i);
         if (cur_token->type == TYPE_BOP || cur_token->type == TYPE_LP) {
@@ -449,8 +855,16 @@ parse_regex(const char* input_str, const int is_debug)
                 stack_top = back(&op_stack);
             }
 
-            /* pop out the left bracket */
+            /* pop out the left bracket, the group ends here. group 0 is a
+               parenthese with no group, from a utf-8 character */
             if (stack_top != NULL) {
+                re_token_t group_token = {
+                    .type = TYPE_GROUP,
+                    .payload = { .group = stack_top->payload.group },
+                };
+                if (group_token.payload.group != 0) {
+                    append(&postfix_tokens, &group_token);
+                }
                 pop(&op_stack);
             }
         } else {
@@ -494,21 +908,28 @@ parse_regex(const char* input_str, const int is_debug)
 
     ast.tokens = postfix_tokens.data;
     ast.size = postfix_tokens.size;
-    ast.lefts = malloc(postfix_tokens.size * sizeof(int));
-    ast.rights = malloc(postfix_tokens.size * sizeof(int));
+    if (arena != NULL) {
+        ast.lefts = arena_alloc(arena, postfix_tokens.size * sizeof(int));
+        ast.rights = arena_alloc(arena, postfix_tokens.size * sizeof(int));
+    } else {
+        ast.lefts = malloc(postfix_tokens.size * sizeof(int));
+        ast.rights = malloc(postfix_tokens.size * sizeof(int));
+    }
     memset(ast.lefts, 0xFF, postfix_tokens.size * sizeof(int));
     memset(ast.rights, 0xFF, postfix_tokens.size * sizeof(int));
-    index_stack = dynarr_new(sizeof(int));
+    index_stack = dynarr_new_in(&tmp_arena, sizeof(int));
     for (i = 0; i < postfix_tokens.size; i++) {
         re_token_t* cur_token = &ast.tokens[i];
         int type = cur_token->type;
-        int is_op = type == TYPE_UOP || type == TYPE_DUP || type == TYPE_BOP;
-        if (is_op && index_stack.size == 0) {
-            printf(
-                "error when parsing pattern: an opartor doesn't have operand: "
+        int is_op = type == TYPE_UOP || type == TYPE_DUP || type == TYPE_BOP
+            || type == TYPE_GROUP;
+        if ((is_op && index_stack.size == 0)
+            || (type == TYPE_BOP && index_stack.size < 2)) {
+            re_error_set(
+                error, NACRE_ERROR_SYNTAX, "%s has no operand",
+                type == TYPE_BOP ? "\"|\"" : "an operator"
             );
-            re_token_print(*cur_token);
-            exit(1);
+            break;
         }
         switch (type) {
         case TYPE_BYTE:
@@ -517,6 +938,11 @@ parse_regex(const char* input_str, const int is_debug)
         case TYPE_CLASS:
             append(&index_stack, &i);
             break;
+        case TYPE_GROUP:
+            if (cur_token->payload.group > ast.group_num) {
+                ast.group_num = cur_token->payload.group;
+            }
+            /* fall through */
         case TYPE_UOP:
         case TYPE_DUP:
             ast.lefts[i] = *(int*)back(&index_stack);
@@ -531,8 +957,10 @@ parse_regex(const char* input_str, const int is_debug)
             append(&index_stack, &i);
             break;
         default:
-            printf("error building tree: bad token type\n");
-            exit(1);
+            re_error_set(error, NACRE_ERROR_SYNTAX, "unbalanced parenthesis");
+            break;
+        }
+        if (error->code != NACRE_OK) {
             break;
         }
 
@@ -546,15 +974,16 @@ parse_regex(const char* input_str, const int is_debug)
             printf("\n");
         }
     }
-    if (index_stack.size != 1) {
-        printf(
-            "error when making ast: index stack size is %lu at the end\n",
-            index_stack.size
-        );
-        exit(1);
+    if (error->code == NACRE_OK && index_stack.size != 1) {
+        re_error_set(error, NACRE_ERROR_SYNTAX, "malformed pattern");
+    }
+    if (error->code != NACRE_OK) {
+        ast.size = 0;
+        arena_free(&tmp_arena);
+        return ast;
     }
     ast.root = *(int*)index_stack.data;
-    dynarr_free(&index_stack);
+    arena_free(&tmp_arena);
 
     return ast;
 }
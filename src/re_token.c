@@ -1,17 +1,18 @@
 #include "re_token.h"
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 
 const char* TYPE_NAME_STRS[] = {
-    "BYTE", "WC", "CLASS", "UOP", "DUP", "BOP", "LP", "RP", "ANCHOR",
+    "BYTE", "WC", "CLASS", "UOP", "DUP", "BOP", "LP", "RP", "ANCHOR", "GROUP",
 };
 
 const char* BYTE_ESC_CHARS = ".+*?|(){\\";
 const char* NONPRINT_ESC_CHARS = "nrtvf";
 const char* NONPRINT_ESC_CHARS_TO = "\n\r\t\v\f";
 const char* WC_ESC_CHARS = "dDwWsS";
-const char* BRACKET_ESC_CHARS = "-]nrtvf";
-const char* BRACKET_ESC_CHARS_TO = "-]\n\r\t\v\f";
+const char* BRACKET_ESC_CHARS = "-]^\\nrtvf";
+const char* BRACKET_ESC_CHARS_TO = "-]^\\\n\r\t\v\f";
 
 const char* OP_CHARS = "+*?{ ||";
 const char* OP_NAME_STRS[] = {
@@ -77,6 +78,9 @@ re_token_print(re_token_t token)
         }
         break;
     case TYPE_LP:
+    case TYPE_GROUP:
+        byte_count += printf("#%d", token.payload.group);
+        break;
     case TYPE_RP:
         break;
     default:
@@ -85,3 +89,16 @@ re_token_print(re_token_t token)
     byte_count += printf("}\n");
     return byte_count;
 };
+
+void
+re_error_set(nacre_error_t* error, const int code, const char* format, ...)
+{
+    va_list args;
+    if (error->code != NACRE_OK) {
+        return;
+    }
+    error->code = code;
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef CHECK_H
+#define CHECK_H
+
+/* the checks of the tests print what failed and return 0. a test runs from
+   the top of the repo after make, so that the cli is at ./nacre */
+
+#define CHECK_OUTPUT_SIZE 4096
+
+/* write input to a new temporary file and put its path in path, which
+   holds at least 32 bytes. return 0 if it cannot be written */
+static int
+check_write_input(const char* input, const size_t input_len, char* path)
+{
+    int fd;
+    strcpy(path, "/tmp/nacre_test_XXXXXX");
+    fd = mkstemp(path);
+    if (fd < 0) {
+        printf("FAIL: cannot make a temporary file\n");
+        return 0;
+    }
+    if (write(fd, input, input_len) != (ssize_t)input_len) {
+        printf("FAIL: cannot write %s\n", path);
+        close(fd);
+        remove(path);
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+/* run shell command and put at most CHECK_OUTPUT_SIZE - 1 bytes of what it
+   prints in output */
+static int
+check_run(const char* command, char* output)
+{
+    FILE* out = popen(command, "r");
+    size_t output_len;
+    if (out == NULL) {
+        printf("FAIL: cannot run %s\n", command);
+        return 0;
+    }
+    output_len = fread(output, 1, CHECK_OUTPUT_SIZE - 1, out);
+    output[output_len] = '\0';
+    pclose(out);
+    return 1;
+}
+
+/* does "./nacre options FILE" print expected for a file of input. options
+   are written as for the shell */
+static int
+check_cli(const char* input, const char* options, const char* expected)
+{
+    char path[32], command[512], output[CHECK_OUTPUT_SIZE];
+    int is_run;
+    if (!check_write_input(input, strlen(input), path)) {
+        return 0;
+    }
+    snprintf(command, sizeof(command), "./nacre %s %s", options, path);
+    is_run = check_run(command, output);
+    remove(path);
+    if (!is_run) {
+        return 0;
+    }
+    if (strcmp(output, expected) != 0) {
+        printf(
+            "FAIL: ./nacre %s on \"%s\" printed \"%s\", expected \"%s\"\n",
+            options, input, output, expected
+        );
+        return 0;
+    }
+    return 1;
+}
+
+#endif
@@ -0,0 +1,127 @@
+#include "nacre.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* nacre_find_batch and nacre_match_batch give every record the first
+   match that nacre_find gives it alone, for the patterns of each engine,
+   and the records that are empty or have no match too */
+
+/* not a multiple of 8, so that the last byte of the bitmap is partial */
+#define RECORD_NUM 997
+#define RECORD_SIZE 64
+
+static char records[RECORD_NUM][RECORD_SIZE];
+static const char* inputs[RECORD_NUM];
+static size_t lens[RECORD_NUM];
+
+static const char* PATTERNS[] = {
+    "error",  "err(or)?[0-9]+", "(a|b)*abb", "^id[0-9]", "[0-9]+$",
+    "x\\b",   "(a|b)*a(a|b){8}c",
+};
+
+/* records of random words, some of which the patterns match */
+static void
+make_records(void)
+{
+    const char* words[] = { "error", "err42", "id7", "abb", "x ", "a", "b",
+                            "9",     "c",     " ",   "z" };
+    const size_t word_num = sizeof(words) / sizeof(words[0]);
+    size_t i, len;
+    srand(1);
+    for (i = 0; i < RECORD_NUM; i++) {
+        len = 0;
+        /* record 0 is empty */
+        while (i > 0 && len + 8 < RECORD_SIZE && rand() % 12 != 0) {
+            const char* word = words[rand() % word_num];
+            memcpy(records[i] + len, word, strlen(word));
+            len += strlen(word);
+        }
+        inputs[i] = records[i];
+        lens[i] = len;
+    }
+}
+
+static int
+check_batch(const char* pattern, const int flags)
+{
+    nacre_regex_t* regex = nacre_compile(pattern, flags);
+    nacre_scratch_t* scratch = nacre_scratch_new();
+    static nacre_match_t matches[RECORD_NUM];
+    static unsigned char bitmap[(RECORD_NUM + 7) / 8];
+    nacre_match_t match;
+    size_t i, count, bit_count, expected_count = 0;
+    int is_passed = 1;
+    if (regex == NULL || scratch == NULL) {
+        printf("FAIL: cannot compile \"%s\"\n", pattern);
+        nacre_scratch_free(scratch);
+        nacre_free(regex);
+        return 0;
+    }
+    /* the bits of the records without a match must be cleared */
+    memset(bitmap, 0xAA, sizeof(bitmap));
+    count = nacre_find_batch(
+        regex, scratch, inputs, lens, RECORD_NUM, matches
+    );
+    bit_count = nacre_match_batch(
+        regex, scratch, inputs, lens, RECORD_NUM, bitmap
+    );
+    for (i = 0; i < RECORD_NUM && is_passed; i++) {
+        const int is_found
+            = nacre_find(regex, scratch, inputs[i], lens[i], 0, &match);
+        const int has_bit = (bitmap[i / 8] >> (i % 8)) & 1;
+        expected_count += is_found;
+        if (is_found
+                ? matches[i].offset != match.offset
+                    || matches[i].length != match.length
+                : matches[i].offset != NACRE_NO_MATCH) {
+            printf(
+                "FAIL: \"%s\" with flags 0x%x on record %lu \"%.*s\"\n",
+                pattern, flags, i, (int)lens[i], inputs[i]
+            );
+            is_passed = 0;
+        }
+        if (has_bit != is_found) {
+            printf(
+                "FAIL: \"%s\" with flags 0x%x has bit %d for record %lu\n",
+                pattern, flags, has_bit, i
+            );
+            is_passed = 0;
+        }
+    }
+    if (is_passed && (count != expected_count || bit_count != count)) {
+        printf(
+            "FAIL: \"%s\" with flags 0x%x counted %lu and %lu records, "
+            "expected %lu\n",
+            pattern, flags, count, bit_count, expected_count
+        );
+        is_passed = 0;
+    }
+    /* an empty batch finds nothing and writes nothing */
+    if (is_passed
+        && nacre_find_batch(regex, scratch, inputs, lens, 0, NULL) != 0) {
+        printf("FAIL: \"%s\" found matches in no records\n", pattern);
+        is_passed = 0;
+    }
+    nacre_scratch_free(scratch);
+    nacre_free(regex);
+    return is_passed;
+}
+
+int
+main(void)
+{
+    size_t i;
+    int is_passed = 1;
+    make_records();
+    for (i = 0; i < sizeof(PATTERNS) / sizeof(PATTERNS[0]); i++) {
+        is_passed &= check_batch(PATTERNS[i], 0);
+        is_passed &= check_batch(PATTERNS[i], NACRE_IGNORE_CASE);
+        is_passed &= check_batch(PATTERNS[i], NACRE_JIT);
+    }
+    if (!is_passed) {
+        return 1;
+    }
+    printf("test_batch: ok\n");
+    return 0;
+}
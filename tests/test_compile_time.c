@@ -0,0 +1,92 @@
+#include "nacre.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* the chains of optionals have quadratically many transitions after the
+   epsilons are removed, and compiling them must not take much longer than
+   making those transitions. the limit is far above the time that it takes,
+   and far below the time that the minimization took before it was bounded */
+
+#define COMPILE_SECONDS_MAX 0.5
+#define PATTERN_SIZE 4096
+
+static double
+seconds_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* prefix, then repeat count times, then suffix */
+static void
+make_pattern(
+    char* pattern, const char* prefix, const char* repeat, const size_t count,
+    const char* suffix
+)
+{
+    size_t i;
+    strcpy(pattern, prefix);
+    for (i = 0; i < count; i++) {
+        strcat(pattern, repeat);
+    }
+    strcat(pattern, suffix);
+}
+
+/* compile pattern in time, and find a match of match_len bytes at offset in
+   input */
+static int
+check_compile(
+    const char* pattern, const char* input, const size_t offset,
+    const size_t match_len
+)
+{
+    nacre_scratch_t* scratch = nacre_scratch_new();
+    nacre_regex_t* regex;
+    nacre_match_t match;
+    double seconds = seconds_now();
+    int is_passed = 1;
+    regex = nacre_compile(pattern, 0);
+    seconds = seconds_now() - seconds;
+    if (regex == NULL || scratch == NULL) {
+        printf("FAIL: cannot compile \"%.40s...\"\n", pattern);
+        nacre_scratch_free(scratch);
+        return 0;
+    }
+    if (seconds > COMPILE_SECONDS_MAX) {
+        printf(
+            "FAIL: \"%.40s...\" took %.2f seconds to compile\n", pattern,
+            seconds
+        );
+        is_passed = 0;
+    }
+    if (!nacre_find(regex, scratch, input, strlen(input), 0, &match)
+        || match.offset != offset || match.length != match_len) {
+        printf("FAIL: \"%.40s...\" on \"%s\"\n", pattern, input);
+        is_passed = 0;
+    }
+    nacre_scratch_free(scratch);
+    nacre_free(regex);
+    return is_passed;
+}
+
+int
+main(void)
+{
+    static char pattern[PATTERN_SIZE];
+    int is_passed = 1;
+    make_pattern(pattern, "(a|b)", "(a|bc)?", 300, "");
+    is_passed &= check_compile(pattern, "xxbabcbca", 2, 7);
+    make_pattern(pattern, "x", "a?", 300, "aaa");
+    is_passed &= check_compile(pattern, "yxaaaaay", 1, 6);
+    make_pattern(pattern, "", "(ab|cd)?", 300, "z");
+    is_passed &= check_compile(pattern, "ababcdzz", 0, 7);
+    make_pattern(pattern, "#", "[0-9]?", 200, "");
+    is_passed &= check_compile(pattern, "a#0123b", 1, 5);
+    if (!is_passed) {
+        return 1;
+    }
+    printf("test_compile_time: ok\n");
+    return 0;
+}
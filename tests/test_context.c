@@ -0,0 +1,166 @@
+#include "check.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* -A, -B and -C print the lines around the matching lines once, with "--"
+   between the groups that do not touch. a file is mapped and stdin is read
+   in windows of 8 MB, and both must print the same, also when a context
+   crosses from one window to the next */
+
+/* lines of 13 bytes, and 17 with "hit", so that the first window of a
+   pipe ends in line 645277. the before context of 645279 starts in the
+   first window, and the contexts of 645274 and 645279 touch across it */
+#define BIG_LINE_NUM 700000
+#define BIG_LINE_SIZE 13
+
+static const size_t BIG_HITS[] = { 5, 645274, 645279, BIG_LINE_NUM };
+
+/* run options on the file at path, which is mapped, or with is_stream on
+   a pipe from it, which is read in windows */
+static int
+check_path(
+    const char* path, const char* options, const int is_stream,
+    const char* expected
+)
+{
+    char command[256], output[CHECK_OUTPUT_SIZE];
+    if (is_stream) {
+        snprintf(
+            command, sizeof(command), "cat %s | ./nacre %s -", path, options
+        );
+    } else {
+        snprintf(command, sizeof(command), "./nacre %s %s", options, path);
+    }
+    if (!check_run(command, output)) {
+        return 0;
+    }
+    if (strcmp(output, expected) != 0) {
+        printf(
+            "FAIL: %s printed \"%s\", expected \"%s\"\n", command, output,
+            expected
+        );
+        return 0;
+    }
+    return 1;
+}
+
+/* the same output for the input as a file and on a pipe */
+static int
+check_both(const char* input, const char* options, const char* expected)
+{
+    char path[32];
+    int is_passed;
+    if (!check_write_input(input, strlen(input), path)) {
+        return 0;
+    }
+    is_passed = check_path(path, options, 0, expected)
+        & check_path(path, options, 1, expected);
+    remove(path);
+    return is_passed;
+}
+
+/* the lines of the big input, where the lines of BIG_HITS have "hit" */
+static char*
+make_big_input(size_t* input_len)
+{
+    char* input = malloc(BIG_LINE_NUM * (BIG_LINE_SIZE + 4) + 1);
+    size_t line, hit = 0, len = 0;
+    if (input == NULL) {
+        return NULL;
+    }
+    for (line = 1; line <= BIG_LINE_NUM; line++) {
+        len += sprintf(input + len, "line %07lu", line);
+        if (hit < sizeof(BIG_HITS) / sizeof(BIG_HITS[0])
+            && BIG_HITS[hit] == line) {
+            len += sprintf(input + len, " hit");
+            hit++;
+        }
+        input[len++] = '\n';
+    }
+    *input_len = len;
+    return input;
+}
+
+/* what -B before -A after prints for the big input */
+static void
+make_big_expected(
+    const size_t before, const size_t after, char* expected,
+    const size_t expected_size
+)
+{
+    size_t i, line, last = 0, len = 0;
+    expected[0] = '\0';
+    for (line = 1; line <= BIG_LINE_NUM; line++) {
+        int is_hit = 0, is_shown = 0;
+        for (i = 0; i < sizeof(BIG_HITS) / sizeof(BIG_HITS[0]); i++) {
+            is_hit |= BIG_HITS[i] == line;
+            is_shown |= line + before >= BIG_HITS[i]
+                && line <= BIG_HITS[i] + after;
+        }
+        if (!is_shown || len + 64 > expected_size) {
+            continue;
+        }
+        if (last > 0 && line > last + 1) {
+            len += sprintf(expected + len, "--\n");
+        }
+        len += sprintf(
+            expected + len, "line %07lu%s\n", line, is_hit ? " hit" : ""
+        );
+        last = line;
+    }
+}
+
+static int
+check_big(
+    const char* path, const size_t before, const size_t after,
+    const int is_stream
+)
+{
+    char options[64], expected[CHECK_OUTPUT_SIZE];
+    make_big_expected(before, after, expected, sizeof(expected));
+    snprintf(options, sizeof(options), "-B%lu -A%lu hit", before, after);
+    return check_path(path, options, is_stream, expected);
+}
+
+int
+main(void)
+{
+    const char* input = "a\nb\nc\nd\ne\nb\n";
+    char path[32];
+    char* big_input;
+    size_t big_input_len;
+    int is_passed = 1;
+    is_passed &= check_both(input, "-A1 b", "b\nc\n--\nb\n");
+    is_passed &= check_both(input, "-B1 b", "a\nb\n--\ne\nb\n");
+    /* the windows of b and d overlap, and the ones of d and b touch */
+    is_passed &= check_both(input, "-C1 'b|d'", "a\nb\nc\nd\ne\nb\n");
+    is_passed &= check_both(input, "-A1 'b|d'", "b\nc\nd\ne\nb\n");
+    is_passed &= check_both(input, "-C 1 c", "b\nc\nd\n");
+    /* a context past either end of the input stops there */
+    is_passed &= check_both(input, "-C9 c", "a\nb\nc\nd\ne\nb\n");
+    is_passed &= check_both(input, "-B2 a", "a\n");
+    /* every match of a line prints the line once */
+    is_passed &= check_both("b b\nx\n", "-g -A1 b", "b b\nx\n");
+    /* the last line without a newline gets one */
+    is_passed &= check_both("x\nb", "-B5 b", "x\nb\n");
+    /* without context the matches are printed as before */
+    is_passed &= check_both(input, "-A0 d", "4, 1 (1)\nd\n^\n");
+
+    big_input = make_big_input(&big_input_len);
+    if (big_input == NULL
+        || !check_write_input(big_input, big_input_len, path)) {
+        free(big_input);
+        return 1;
+    }
+    free(big_input);
+    is_passed &= check_big(path, 2, 2, 0) & check_big(path, 2, 2, 1);
+    is_passed &= check_big(path, 4, 0, 0) & check_big(path, 4, 0, 1);
+    is_passed &= check_big(path, 0, 3, 0) & check_big(path, 0, 3, 1);
+    remove(path);
+    if (!is_passed) {
+        return 1;
+    }
+    printf("test_context: ok\n");
+    return 0;
+}
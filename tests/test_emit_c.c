@@ -0,0 +1,151 @@
+#include "check.h"
+#include "nacre.h"
+#include <stdio.h>
+#include <string.h>
+
+/* the C file of --emit-c finds the same matches as nacre_find. each
+   pattern is written with a main that prints every match of NAME_find in
+   a file, compiled with gcc and run. the long input has a run of 200000
+   bytes that "[a-z]*X" reads without a match, which takes seconds if
+   NAME_find tries NAME_match at every offset */
+
+#define EMIT_C_COMMAND_SIZE 512
+
+static const char* PATTERNS[] = {
+    "[a-z]*X", "a+b", "(a|b)*abb", "foo|bar|baz", "[0-9]{3}-[0-9]{4}",
+    "e[^e]*e", "x*y", "(ab|a)(bc|c)*", "b[ab]{0,3}", "q[0-9]?",
+};
+
+static const char* MAIN_SOURCE
+    = "\n#include <stdio.h>\n#include <stdlib.h>\n\n"
+      "int\nmain(int argc, char** argv)\n{\n"
+      "    FILE* in = fopen(argv[1], \"rb\");\n"
+      "    static char input[1 << 20];\n"
+      "    size_t len, start = 0, offset, length;\n"
+      "    (void)argc;\n"
+      "    len = fread(input, 1, sizeof(input), in);\n"
+      "    fclose(in);\n"
+      "    while (start < len\n"
+      "           && test_find(input, len, start, &offset, &length)) {\n"
+      "        printf(\"%lu,%lu;\", offset, length);\n"
+      "        start = offset + length;\n"
+      "    }\n"
+      "    return 0;\n"
+      "}\n";
+
+/* every match of the library, as the program prints them */
+static int
+find_all(
+    const char* pattern, const char* input, const size_t input_len,
+    char* out, const size_t out_size
+)
+{
+    nacre_regex_t* regex = nacre_compile(pattern, 0);
+    nacre_scratch_t* scratch = nacre_scratch_new();
+    nacre_match_t match;
+    size_t start = 0, out_len = 0;
+    if (regex == NULL || scratch == NULL) {
+        printf("FAIL: cannot compile \"%s\"\n", pattern);
+        nacre_scratch_free(scratch);
+        nacre_free(regex);
+        return 0;
+    }
+    out[0] = '\0';
+    while (start < input_len && out_len + 64 < out_size
+           && nacre_find(regex, scratch, input, input_len, start, &match)) {
+        out_len += snprintf(
+            out + out_len, out_size - out_len, "%lu,%lu;", match.offset,
+            match.length
+        );
+        start = match.offset + match.length;
+    }
+    nacre_scratch_free(scratch);
+    nacre_free(regex);
+    return 1;
+}
+
+/* write pattern as C with a main, build it in program and run it on the
+   file at path */
+static int
+run_emitted(
+    const char* pattern, const char* path, char* program, char* output
+)
+{
+    char source[40], command[EMIT_C_COMMAND_SIZE];
+    nacre_regex_t* regex = nacre_compile(pattern, 0);
+    FILE* out;
+    int is_written, fd;
+    strcpy(source, "/tmp/nacre_test_XXXXXX.c");
+    fd = mkstemps(source, 2);
+    if (regex == NULL || fd < 0 || (out = fdopen(fd, "w")) == NULL) {
+        printf("FAIL: cannot write C for \"%s\"\n", pattern);
+        nacre_free(regex);
+        return 0;
+    }
+    is_written = nacre_emit_c(regex, "test", out);
+    fputs(MAIN_SOURCE, out);
+    fclose(out);
+    nacre_free(regex);
+    strcpy(program, source);
+    program[strlen(program) - 2] = '\0';
+    snprintf(
+        command, sizeof(command), "gcc -O2 -Wall -o %s %s 2>&1", program,
+        source
+    );
+    if (!is_written || !check_run(command, output) || output[0] != '\0') {
+        printf("FAIL: cannot build the C of \"%s\": %s\n", pattern, output);
+        remove(source);
+        return 0;
+    }
+    remove(source);
+    snprintf(command, sizeof(command), "timeout 10 %s %s", program, path);
+    return check_run(command, output);
+}
+
+static int
+check_emitted(const char* pattern, const char* input, const size_t input_len)
+{
+    char path[32], program[40], output[CHECK_OUTPUT_SIZE];
+    char expected[CHECK_OUTPUT_SIZE];
+    int is_run;
+    if (!find_all(pattern, input, input_len, expected, sizeof(expected))
+        || !check_write_input(input, input_len, path)) {
+        return 0;
+    }
+    is_run = run_emitted(pattern, path, program, output);
+    remove(path);
+    remove(program);
+    if (!is_run) {
+        return 0;
+    }
+    if (strcmp(output, expected) != 0) {
+        printf(
+            "FAIL: the C of \"%s\" found \"%.200s\", expected \"%.200s\"\n",
+            pattern, output, expected
+        );
+        return 0;
+    }
+    return 1;
+}
+
+int
+main(void)
+{
+    static char long_input[200000 + 16];
+    const char* input = "abbaabb fooXbar 555-1234 eaaaee xxy abcbc bab q1 "
+                        "aaaab zzX\nbaz q";
+    const size_t pattern_num = sizeof(PATTERNS) / sizeof(PATTERNS[0]);
+    size_t i;
+    int is_passed = 1;
+    for (i = 0; i < pattern_num; i++) {
+        is_passed &= check_emitted(PATTERNS[i], input, strlen(input));
+    }
+    memset(long_input, 'a', 200000);
+    strcpy(long_input + 200000, " abX");
+    is_passed &= check_emitted("[a-z]*X", long_input, strlen(long_input));
+    if (!is_passed) {
+        return 1;
+    }
+    printf("test_emit_c: ok\n");
+    return 0;
+}
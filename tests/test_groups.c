@@ -0,0 +1,101 @@
+#include "check.h"
+#include "nacre.h"
+#include <stdio.h>
+#include <string.h>
+
+/* the capture groups of a match are taken from one parse of the match
+   that the leftmost-longest search found, which prefers the left
+   alternative and the longer repetition */
+
+#define GROUPS_MAX 16
+
+/* expected has "offset,length " for each group from 0, or "- " for a group
+   that takes no part, or is "none" if there is no match */
+static int
+check_groups(
+    const char* pattern, const int flags, const char* input,
+    const char* expected
+)
+{
+    nacre_regex_t* regex = nacre_compile(pattern, flags);
+    nacre_scratch_t* scratch = nacre_scratch_new();
+    nacre_match_t groups[GROUPS_MAX];
+    char found[CHECK_OUTPUT_SIZE];
+    size_t found_len = 0;
+    int i, group_num;
+    if (regex == NULL || scratch == NULL) {
+        printf("FAIL: cannot compile \"%s\"\n", pattern);
+        nacre_scratch_free(scratch);
+        nacre_free(regex);
+        return 0;
+    }
+    group_num = nacre_group_count(regex);
+    strcpy(found, "none");
+    if (group_num < GROUPS_MAX
+        && nacre_find_groups(
+            regex, scratch, input, strlen(input), 0, groups
+        )) {
+        for (i = 0; i <= group_num; i++) {
+            if (groups[i].offset == NACRE_NO_GROUP) {
+                strcpy(found + found_len, "- ");
+                found_len += 2;
+            } else {
+                found_len += sprintf(
+                    found + found_len, "%lu,%lu ", groups[i].offset,
+                    groups[i].length
+                );
+            }
+        }
+    }
+    nacre_scratch_free(scratch);
+    nacre_free(regex);
+    if (strcmp(found, expected) != 0) {
+        printf(
+            "FAIL: \"%s\" on \"%s\" has groups \"%s\", expected \"%s\"\n",
+            pattern, input, found, expected
+        );
+        return 0;
+    }
+    return 1;
+}
+
+int
+main(void)
+{
+    int is_passed = 1;
+    is_passed &= check_groups("(a+)(b)?", 0, "xaab", "1,3 1,2 3,1 ");
+    is_passed &= check_groups("(a)|(b)", 0, "b", "0,1 - 0,1 ");
+    is_passed &= check_groups("x(y)?z", 0, "xz", "0,2 - ");
+    is_passed &= check_groups("(foo)(bar)?", 0, "zfoobaz", "1,3 1,3 - ");
+    is_passed &= check_groups("(a)(b)", 0, "xy", "none");
+    /* the parse must give the longest match, not the left alternative
+       that would end sooner */
+    is_passed &= check_groups("(a|ab)(c|bcd)", 0, "abcd", "0,4 0,1 1,3 ");
+    is_passed &= check_groups("(a|ab)(b*)", 0, "abbb", "0,4 0,1 1,3 ");
+    /* the longer repetition first, and an empty group after it */
+    is_passed &= check_groups("(a*)(a*)", 0, "aaa", "0,3 0,3 3,0 ");
+    /* a group in a repetition is from the last time that it took part */
+    is_passed &= check_groups("((a)|b)+", 0, "ab", "0,2 1,1 0,1 ");
+    is_passed &= check_groups("((ab)+)c", 0, "abababc", "0,7 0,6 4,2 ");
+    is_passed &= check_groups("(a|b)*(c)", 0, "xabac", "1,4 3,1 4,1 ");
+    is_passed &= check_groups(
+        "(\\w+)@(\\w+)", 0, "mail me@host now", "5,7 5,2 8,4 "
+    );
+    is_passed &= check_groups("^(a)(b)$", 0, "ab", "0,2 0,1 1,1 ");
+    is_passed &= check_groups("(A+)", NACRE_IGNORE_CASE, "xaA", "1,2 1,2 ");
+    is_passed &= check_groups(
+        "(a)(b)(c)(d)(e)(f)(g)(h)(i)(j)", 0, "abcdefghij",
+        "0,10 0,1 1,1 2,1 3,1 4,1 5,1 6,1 7,1 8,1 9,1 "
+    );
+    /* -o prints the match or a group, and skips a group that takes no
+       part */
+    is_passed &= check_cli("xaab ab a\n", "-o '(a+)(b)?'", "aab\n");
+    is_passed &= check_cli("xaab ab a\n", "-g -o1 '(a+)(b)?'", "aa\na\na\n");
+    is_passed &= check_cli("xaab ab a\n", "-g -o2 '(a+)(b)?'", "b\nb\n");
+    is_passed &= check_cli("xaab\n", "-o3 '(a+)(b)?' 2>/dev/null", "");
+    if (!is_passed) {
+        return 1;
+    }
+    printf("test_groups: ok\n");
+    return 0;
+}
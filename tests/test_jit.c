@@ -0,0 +1,112 @@
+#include "check.h"
+#include "nacre.h"
+#include <stdio.h>
+#include <string.h>
+
+/* with NACRE_JIT every match is the same as with the lazy dfa. the input
+   has runs longer than the 16 bytes that the code skips at a time, and
+   matches that end at the end of the input */
+
+#define INPUT_SIZE 2048
+
+static char input[INPUT_SIZE];
+
+static const char* PATTERNS[] = {
+    "\\w+@\\w+", "a+b",   "[a-z]+ing",     "foo|bar|baz", "[0-9]{3}-[0-9]{4}",
+    "e[^e]*e",   "x*y",   "(ab|a)(bc|c)*", "[^ ]+",       "b[ab]{0,3}",
+    "(a|b)*abb", ".",     "z",             "q[0-9]?",
+};
+
+/* every match of pattern with flags, as "offset,length;" */
+static int
+find_all(const char* pattern, const int flags, char* out, size_t out_size)
+{
+    nacre_regex_t* regex = nacre_compile(pattern, flags);
+    nacre_scratch_t* scratch = nacre_scratch_new();
+    const size_t input_len = strlen(input);
+    nacre_match_t match;
+    size_t start = 0, out_len = 0;
+    if (regex == NULL || scratch == NULL) {
+        printf("FAIL: cannot compile \"%s\"\n", pattern);
+        nacre_scratch_free(scratch);
+        nacre_free(regex);
+        return 0;
+    }
+    out[0] = '\0';
+    while (start < input_len
+           && nacre_find(regex, scratch, input, input_len, start, &match)) {
+        out_len += snprintf(
+            out + out_len, out_size - out_len, "%lu,%lu;", match.offset,
+            match.length
+        );
+        if (out_len >= out_size) {
+            break;
+        }
+        start = match.offset + match.length;
+    }
+    nacre_scratch_free(scratch);
+    nacre_free(regex);
+    return 1;
+}
+
+static int
+check_same(const char* pattern, const int flags)
+{
+    static char expected[1 << 16], found[1 << 16];
+    if (!find_all(pattern, flags, expected, sizeof(expected))
+        || !find_all(pattern, flags | NACRE_JIT, found, sizeof(found))) {
+        return 0;
+    }
+    if (strcmp(expected, found) != 0) {
+        printf(
+            "FAIL: \"%s\" with flags 0x%x found \"%.200s\" with the jit, "
+            "expected \"%.200s\"\n",
+            pattern, flags, found, expected
+        );
+        return 0;
+    }
+    return 1;
+}
+
+int
+main(void)
+{
+    const char* parts[] = {
+        "foo@bar ",      "aaaaaaaaaaaaaaaaaaaaaaaaab ", "singing ",
+        "555-1234 ",     "eeeeeeeeeeeeeeeeeee ",        "abcbcbc ",
+        "xxxxxxxxxxxy ", "abababaabb\n",                "q1 q ",
+        "                                        ",
+    };
+    const size_t part_num = sizeof(parts) / sizeof(parts[0]);
+    const size_t pattern_num = sizeof(PATTERNS) / sizeof(PATTERNS[0]);
+    char output[CHECK_OUTPUT_SIZE];
+    size_t i, len = 0;
+    int is_passed = 1;
+    for (i = 0; len + 64 < INPUT_SIZE; i = (i + 3) % part_num) {
+        strcpy(input + len, parts[i]);
+        len += strlen(parts[i]);
+    }
+    /* a match that ends at the end of the input */
+    strcpy(input + len, "ab@cd");
+    for (i = 0; i < pattern_num; i++) {
+        is_passed &= check_same(PATTERNS[i], 0);
+        is_passed &= check_same(PATTERNS[i], NACRE_IGNORE_CASE);
+    }
+#if defined(__x86_64__) && defined(__SSE2__)
+    /* the code is used, and is not the engine that tries every offset */
+    if (!check_run("./nacre --jit --explain '\\w+@\\w+' /dev/null", output)) {
+        is_passed = 0;
+    } else if (strstr(output, "engine: dfa") == NULL
+               || strstr(output, "x86-64 code") == NULL) {
+        printf("FAIL: --jit --explain printed \"%s\"\n", output);
+        is_passed = 0;
+    }
+#else
+    (void)output;
+#endif
+    if (!is_passed) {
+        return 1;
+    }
+    printf("test_jit: ok\n");
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "check.h"
+#include <stdio.h>
+
+/* -x and -w wrap the pattern in anchors, which must work with the anchors
+   of the pattern itself, and -v selects the lines without a match, also
+   with context */
+
+int
+main(void)
+{
+    int is_passed = 1;
+    /* "^" and "$" of the pattern are line anchors with -x */
+    is_passed &= check_cli("x\nh\n", "-x '^h'", "2, 1 (1)\nh\n^\n");
+    is_passed &= check_cli("x\nh\n", "-x 'h$'", "2, 1 (1)\nh\n^\n");
+    is_passed &= check_cli("x\nh\n", "-x '^h$'", "2, 1 (1)\nh\n^\n");
+    is_passed &= check_cli(
+        "ab\ncd1\nef\n", "-gx '^[a-z]+$'",
+        "1, 1 (2)\nab\n^^\n3, 1 (2)\nef\n^^\n"
+    );
+    is_passed &= check_cli("ab\nh\n", "-v -x '^h'", "ab\n");
+    /* -w with "^" and "$", which are only line anchors with -m */
+    is_passed &= check_cli(
+        "ab cd\nabc\nab\n", "-gmw '^ab'",
+        "1, 1 (2)\nab cd\n^^\n3, 1 (2)\nab\n^^\n"
+    );
+    is_passed &= check_cli(
+        "ab cd\nabc\nab\n", "-gw 'ab$'", "3, 1 (2)\nab\n^^\n"
+    );
+    is_passed &= check_cli("ab cd\nabc\nab\n", "-v -w '^ab'", "abc\n");
+    /* -v with context, the groups that do not touch are split by "--" */
+    is_passed &= check_cli(
+        "a1\nb\na2\na3\na4\nc\n", "-v -A1 'a'", "b\na2\n--\nc\n"
+    );
+    is_passed &= check_cli(
+        "a1\nb\na2\na3\na4\nc\n", "-v -B1 'a'", "a1\nb\n--\na4\nc\n"
+    );
+    is_passed &= check_cli(
+        "a1\nb\na2\na3\na4\nc\n", "-v -C1 '^a'", "a1\nb\na2\n--\na4\nc\n"
+    );
+    is_passed &= check_cli("a\nb\n", "-v -C5 '.'", "");
+    if (!is_passed) {
+        return 1;
+    }
+    printf("test_line_modes: ok\n");
+    return 0;
+}
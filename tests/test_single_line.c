@@ -0,0 +1,58 @@
+#include "check.h"
+#include "nacre.h"
+#include <stdio.h>
+#include <string.h>
+
+/* with NACRE_SINGLE_LINE no match takes a newline, also when the pattern
+   is a literal that has one */
+
+static const char* INPUT = "xa\nby\nzz\n";
+
+static int
+check_find(const char* pattern, const int flags, const int is_expected)
+{
+    nacre_regex_t* regex = nacre_compile(pattern, flags);
+    nacre_scratch_t* scratch = nacre_scratch_new();
+    nacre_match_t match;
+    int is_found;
+    if (regex == NULL || scratch == NULL) {
+        printf("FAIL: cannot compile \"%s\"\n", pattern);
+        return 0;
+    }
+    is_found = nacre_find(regex, scratch, INPUT, strlen(INPUT), 0, &match);
+    nacre_scratch_free(scratch);
+    nacre_free(regex);
+    if (is_found != is_expected) {
+        printf(
+            "FAIL: \"%s\" with flags 0x%x: found %d, expected %d\n", pattern,
+            flags, is_found, is_expected
+        );
+        return 0;
+    }
+    return 1;
+}
+
+int
+main(void)
+{
+    const int line_mode = NACRE_MULTILINE | NACRE_SINGLE_LINE;
+    int is_passed = 1;
+    /* a literal with a newline */
+    is_passed &= check_find("a\\nb", 0, 1);
+    is_passed &= check_find("a\\nb", line_mode, 0);
+    is_passed &= check_find("a\\nb", line_mode | NACRE_IGNORE_CASE, 0);
+    is_passed &= check_find("\\nb", line_mode, 0);
+    is_passed &= check_find("a\\n", NACRE_WHOLE_LINE, 0);
+    /* and one that is not a literal */
+    is_passed &= check_find("a\\nb+", line_mode, 0);
+    is_passed &= check_find("a", line_mode, 1);
+    is_passed &= check_cli(INPUT, "-v 'a\\nb'", "xa\nby\nzz\n");
+    is_passed &= check_cli(INPUT, "-v -x 'xa\\nby'", "xa\nby\nzz\n");
+    is_passed &= check_cli(INPUT, "-A1 'a\\nb'", "");
+    is_passed &= check_cli(INPUT, "-v 'z'", "xa\nby\n");
+    if (!is_passed) {
+        return 1;
+    }
+    printf("test_single_line: ok\n");
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "check.h"
+#include "nacre.h"
+#include <stdio.h>
+#include <string.h>
+
+/* with NACRE_UTF8 the characters of the pattern become byte sequences, so
+   "." and classes match whole characters of 1 to 4 bytes, and bytes that
+   are not valid utf-8 are not matched by them. the automata of either
+   compiler, and the jit, read the same bytes */
+
+static const int COMPILE_MODES[] = { 0, NACRE_GLUSHKOV, NACRE_JIT };
+
+/* expected has "offset,length;" for every match of pattern in input */
+static int
+check_matches(
+    const char* pattern, const int flags, const char* input,
+    const char* expected
+)
+{
+    char found[CHECK_OUTPUT_SIZE];
+    size_t i, start, found_len, input_len = strlen(input);
+    nacre_match_t match;
+    int is_passed = 1;
+    for (i = 0; i < sizeof(COMPILE_MODES) / sizeof(COMPILE_MODES[0]); i++) {
+        const int mode_flags = flags | COMPILE_MODES[i];
+        nacre_regex_t* regex = nacre_compile(pattern, mode_flags);
+        nacre_scratch_t* scratch = nacre_scratch_new();
+        if (regex == NULL || scratch == NULL) {
+            printf("FAIL: cannot compile \"%s\"\n", pattern);
+            nacre_scratch_free(scratch);
+            nacre_free(regex);
+            return 0;
+        }
+        found[0] = '\0';
+        start = found_len = 0;
+        while (start < input_len && found_len + 64 < sizeof(found)
+               && nacre_find(
+                   regex, scratch, input, input_len, start, &match
+               )) {
+            found_len += sprintf(
+                found + found_len, "%lu,%lu;", match.offset, match.length
+            );
+            start = match.offset + match.length;
+        }
+        nacre_scratch_free(scratch);
+        nacre_free(regex);
+        if (strcmp(found, expected) != 0) {
+            printf(
+                "FAIL: \"%s\" with flags 0x%x found \"%s\", expected "
+                "\"%s\"\n",
+                pattern, mode_flags, found, expected
+            );
+            is_passed = 0;
+        }
+    }
+    return is_passed;
+}
+
+int
+main(void)
+{
+    /* a, e acute, the euro sign and an emoji: 1, 2, 3 and 4 bytes */
+    const char* chars = "a\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80";
+    int is_passed = 1;
+    is_passed &= check_matches(".", NACRE_UTF8, chars, "0,1;1,2;3,3;6,4;");
+    is_passed &= check_matches("[^a]", NACRE_UTF8, chars, "1,2;3,3;6,4;");
+    is_passed &= check_matches("\\W", NACRE_UTF8, chars, "1,2;3,3;6,4;");
+    is_passed &= check_matches(".{2}", NACRE_UTF8, chars, "0,3;3,7;");
+    /* without the flag a byte is a character */
+    is_passed &= check_matches(".", 0, "\xc3\xa9", "0,1;1,1;");
+    /* ranges and sets of characters of different lengths */
+    is_passed &= check_matches(
+        "[\xc3\xa9-\xc3\xb6]+", NACRE_UTF8, "x\xc3\xa9\xc3\xb6\xc3\xb8",
+        "1,4;"
+    );
+    is_passed &= check_matches(
+        "[\xce\xb1-\xcf\x89]+", NACRE_UTF8,
+        "\xce\xa9\xce\xb1\xce\xb2\xce\xb3", "2,6;"
+    );
+    is_passed &= check_matches(
+        "[\xe2\x82\xac\xf0\x9f\x98\x80]", NACRE_UTF8, chars, "3,3;6,4;"
+    );
+    is_passed &= check_matches(
+        "[^\xc3\xa9]", NACRE_UTF8, "\xc3\xa9" "a", "2,1;"
+    );
+    /* a character is one operand */
+    is_passed &= check_matches(
+        "\xc3\xa9+", NACRE_UTF8, "\xc3\xa9\xc3\xa9\xc3\xa9", "0,6;"
+    );
+    /* a stray byte, a cut sequence, an overlong form and a surrogate are
+       not characters */
+    is_passed &= check_matches(".", NACRE_UTF8, "a\xff" "b\xc3", "0,1;2,1;");
+    is_passed &= check_matches("[^x]+", NACRE_UTF8, "a\xe2\x82x", "0,1;");
+    is_passed &= check_matches(".+", NACRE_UTF8, "\xc0\xaf" "ab", "2,2;");
+    is_passed &= check_matches(".", NACRE_UTF8, "\xed\xa0\x80", "");
+    /* ignoring case only knows ascii */
+    is_passed &= check_matches(
+        "\xc3\xa9", NACRE_UTF8 | NACRE_IGNORE_CASE, "\xc3\x89", ""
+    );
+    is_passed &= check_matches(
+        "A\xc3\xa9", NACRE_UTF8 | NACRE_IGNORE_CASE, "a\xc3\xa9", "0,3;"
+    );
+    /* the cli marks every byte of a match */
+    is_passed &= check_cli(
+        "a\xc3\xa9\n", "-u -g '.'",
+        "1, 1 (1)\na\xc3\xa9\n^\n1, 2 (2)\na\xc3\xa9\n ^^\n"
+    );
+    if (!is_passed) {
+        return 1;
+    }
+    printf("test_utf8: ok\n");
+    return 0;
+}